@@ -0,0 +1,428 @@
+/**
+ * @file Header for lock-free concurrent generalized stack and work-stealing deque with the same debug options
+ */
+
+/**
+ * gstack.h must be included for the same STACK_TYPE before this header,
+ * concurrent stack shares its debug options, hashes, canaries and allocators
+ */
+
+#ifndef STACK_FUNC_GUARD
+    #error "gstack.h must be included before gcstack.h"
+#endif
+
+
+//===========================================
+// Concurrent stack options configuration
+
+#ifndef STACK_CONCURRENT_CONST_GUARD
+#define STACK_CONCURRENT_CONST_GUARD
+
+static const size_t   STACK_NODE_SEGMENT_BASE  = 64;            /// nodes in the first segment of the node pool, every next segment is twice bigger
+static const size_t   STACK_NODE_SEGMENT_COUNT = 26;            /// max segments in the pool, enough for 2^32 - 1 nodes
+static const uint32_t STACK_NODE_NULL          = 0;             /// reference to no node, references are node index + 1
+
+#ifdef STACK_USE_ELIMINATION                                    /// Pushes and pops that lost a CAS try to meet in the elimination array
+    static const size_t   STACK_ELIMINATION_SLOTS = 16;         /// slots pushes park their nodes in
+    static const size_t   STACK_ELIMINATION_SPINS = 128;        /// spins a parked push or a pop wait for a partner
+    static const uint64_t STACK_ELIMINATION_TAKEN = UINT64_MAX; /// slot value of a parked node taken by a pop
+#endif
+
+#ifdef STACK_USE_ELIMINATION
+/**
+ * @fn static size_t stack_eliminationSlot()
+ * @brief picks a random elimination slot with a per-thread xorshift
+ * @return slot index
+ */
+static size_t stack_eliminationSlot();
+#endif
+
+#endif  /* STACK_CONCURRENT_CONST_GUARD */
+
+
+//===========================================
+// Concurrent stack structure
+
+/**
+ * @addtogroup Concurrent_stack_struct
+ * @{
+ * @struct cstack_node
+ * @brief node of the concurrent stack, nodes live in segments of the node pool until the stack is destroyed
+ */
+struct GENERIC(cstack_node)
+{
+    /// @brief left node canary
+    #ifdef STACK_USE_CANARY
+        STACK_CANARY_TYPE leftCanary;
+    #endif
+
+    /// @brief elem of the stack
+    STACK_TYPE item;
+    /// @brief reference to the node below, accessed atomically
+    uint32_t next;
+
+    /// @brief crc32c of `item`
+    #ifdef STACK_USE_DATA_HASH
+        uint32_t hash;
+    #endif
+
+    /// @brief right node canary
+    #ifdef STACK_USE_CANARY
+        STACK_CANARY_TYPE rightCanary;
+    #endif
+} typedef GENERIC(cstack_node);
+
+
+/**
+ * @struct cstack
+ * @brief lock-free Treiber stack with ABA tags and optional elimination backoff;
+ *        push, pop and healthCheck could be called from any threads, ctor, dtor and dump need exclusive access
+ */
+struct GENERIC(cstack)
+{
+    /// @brief left canary array
+    #ifdef STACK_USE_CANARY
+        STACK_CANARY_TYPE leftCanary[STACK_CANARY_WRAPPER_LEN];
+    #endif
+
+    /// @brief reference to the top node in the low half, ABA tag bumped by every change in the high half
+    alignas(64) uint64_t head;
+    /// @brief reference to the top free node tagged the same way
+    alignas(64) uint64_t freeHead;
+    /// @brief number of nodes ever taken from the pool segments
+    alignas(64) uint64_t fresh;
+    /// @brief number of elems, exact only when there are no concurrent operations
+    alignas(64) size_t len;
+
+    /// @brief segments of the node pool, set once and never moved
+    GENERIC(cstack_node) *segments[STACK_NODE_SEGMENT_COUNT];
+    /// @brief backend for pool segments
+    const stack_allocator *allocator;
+
+    /// @brief bitset of stack statuses, updated atomically
+    mutable stack_status status;
+
+    /// @brief outp stream for stack logging
+    FILE *logStream;
+
+    /// @brief slots with nodes parked by pushes, `STACK_ELIMINATION_TAKEN` once taken by a pop
+    #ifdef STACK_USE_ELIMINATION
+        alignas(64) uint64_t elimination[STACK_ELIMINATION_SLOTS];
+    #endif
+
+    /// @brief right canary array
+    #ifdef STACK_USE_CANARY
+        STACK_CANARY_TYPE rightCanary[STACK_CANARY_WRAPPER_LEN];
+    #endif
+} typedef GENERIC(cstack);
+/** @} */
+
+
+/**
+ * @fn static stack_status cstack_ctor(cstack *this_)
+ * @brief concurrent stack constructor, doesn't allocate
+ * @param this_ pointer to memory allocated for stack structure
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(cstack_ctor)(GENERIC(cstack) *this_);
+
+
+/**
+ * @fn static stack_status cstack_ctorAllocator(cstack *this_, const stack_allocator *allocator)
+ * @brief concurrent stack constructor with a backend for pool segments, which must be usable from any thread
+ * @param this_ pointer to memory allocated for stack structure
+ * @param allocator backend for pool segments or NULL for `STACK_ALLOCATOR_MALLOC`
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(cstack_ctorAllocator)(GENERIC(cstack) *this_, const stack_allocator *allocator);
+
+
+/**
+ * @fn static stack_status cstack_dtor(cstack *this_)
+ * @brief concurrent stack destructor, frees the node pool
+ * @param this_ pointer to stack structure
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(cstack_dtor)(GENERIC(cstack) *this_);
+
+
+/**
+ * @fn static stack_status cstack_push(cstack *this_, STACK_TYPE item)
+ * @brief pushes `item` into stack, lock-free
+ * @param this_ pointer to stack
+ * @param item elem to be pushed
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(cstack_push)(GENERIC(cstack) *this_, STACK_TYPE item);
+
+
+/**
+ * @fn static stack_status cstack_pop(cstack *this_, STACK_TYPE *item, bool *popped)
+ * @brief pops top elem from stack, lock-free; canaries and hash of the node are checked
+ * @param this_ pointer to stack
+ * @param item pointer to var to write to or NULL if value should be discarded
+ * @param popped pointer to var set to `false` if stack was empty or NULL
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(cstack_pop)(GENERIC(cstack) *this_, STACK_TYPE *item, bool *popped);
+
+
+/**
+ * @fn static stack_status cstack_healthCheck(const cstack *this_)
+ * @brief checks struct canaries and canaries of every node in the pool, safe to run concurrently with push and pop
+ * @param this_ pointer to stack
+ * @return bitset of stack status (of errors)
+ */
+static stack_status GENERIC(cstack_healthCheck)(const GENERIC(cstack) *this_);
+
+
+/**
+ * @fn static stack_status cstack_dump(const cstack *this_)
+ * @brief dumps stack structure and live elems into this_->logStream
+ * @param this_ pointer to stack
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(cstack_dump)(const GENERIC(cstack) *this_);
+
+
+/**
+ * @fn static GENERIC(cstack_node) *cstack_nodeAt(const cstack *this_, uint32_t ref)
+ * @brief finds node by reference in the pool segments
+ * @param this_ pointer to stack
+ * @param ref node reference, not `STACK_NODE_NULL`
+ * @return pointer to node
+ */
+static GENERIC(cstack_node) *GENERIC(cstack_nodeAt)(const GENERIC(cstack) *this_, uint32_t ref);
+
+
+/**
+ * @fn static uint32_t cstack_nodeAlloc(cstack *this_)
+ * @brief takes a free node or a fresh one from the pool, allocates the next segment when needed
+ * @param this_ pointer to stack
+ * @return node reference or `STACK_NODE_NULL` on failure
+ */
+static uint32_t GENERIC(cstack_nodeAlloc)(GENERIC(cstack) *this_);
+
+
+/**
+ * @fn static stack_status cstack_nodeCheck(const GENERIC(cstack_node) *node)
+ * @brief checks canaries and hash of the node
+ * @param node pointer to node
+ * @return bitset of stack status (of errors)
+ */
+static stack_status GENERIC(cstack_nodeCheck)(const GENERIC(cstack_node) *node);
+
+
+/**
+ * @fn static bool cstack_tryPush(cstack *this_, uint64_t *head, uint32_t ref)
+ * @brief makes a single CAS attempt to put node on top of the tagged list
+ * @param this_ pointer to stack
+ * @param head `head` or `freeHead` of the stack
+ * @param ref reference to node owned by the caller
+ * @return `true` on success
+ */
+static bool GENERIC(cstack_tryPush)(GENERIC(cstack) *this_, uint64_t *head, uint32_t ref);
+
+
+/**
+ * @fn static bool cstack_tryPop(cstack *this_, uint64_t *head, uint32_t *ref)
+ * @brief makes a single CAS attempt to take the top node of the tagged list
+ * @param this_ pointer to stack
+ * @param head `head` or `freeHead` of the stack
+ * @param ref returns reference to the taken node, `STACK_NODE_NULL` if list is empty
+ * @return `true` if node was taken or list is empty, `false` if CAS lost
+ */
+static bool GENERIC(cstack_tryPop)(GENERIC(cstack) *this_, uint64_t *head, uint32_t *ref);
+
+
+#ifdef STACK_USE_ELIMINATION
+/**
+ * @fn static bool cstack_eliminatePush(cstack *this_, uint32_t ref)
+ * @brief parks node in a random elimination slot for a while, so that a pop could take it
+ * @param this_ pointer to stack
+ * @param ref reference to node owned by the caller
+ * @return `true` if node was taken by a pop
+ */
+static bool GENERIC(cstack_eliminatePush)(GENERIC(cstack) *this_, uint32_t ref);
+
+
+/**
+ * @fn static uint32_t cstack_eliminatePop(cstack *this_)
+ * @brief waits a while for a node parked in a random elimination slot
+ * @param this_ pointer to stack
+ * @return reference to the taken node or `STACK_NODE_NULL`
+ */
+static uint32_t GENERIC(cstack_eliminatePop)(GENERIC(cstack) *this_);
+#endif
+
+
+
+//===========================================
+// Work-stealing deque
+
+/**
+ * @addtogroup Work_stealing_deque_struct
+ * @{
+ * @struct wsdeque_buffer
+ * @brief circular storage of the work-stealing deque, immutable once published;
+ *        data is canary wrapped the same way as stack data
+ */
+struct GENERIC(wsdeque_buffer)
+{
+    /// @brief capacity of data, power of two
+    size_t capacity;
+    /// @brief size of the data mapping or 0 if data is from the allocator
+    size_t mappedSize;
+    /// @brief smaller buffer replaced by this one, kept until destruction for late thieves
+    struct GENERIC(wsdeque_buffer) *retired;
+    /// @brief pointer to data with canaries
+    STACK_CANARY_TYPE *dataWrapper;
+    /// @brief pointer to data, elem `i` is at `data[i & (capacity - 1)]`
+    STACK_TYPE *data;
+} typedef GENERIC(wsdeque_buffer);
+
+
+/**
+ * @struct wsdeque
+ * @brief Chase-Lev work-stealing deque; the owner thread pushes and pops at the bottom,
+ *        any thread steals from the top
+ */
+struct GENERIC(wsdeque)
+{
+    /// @brief left canary array
+    #ifdef STACK_USE_CANARY
+        STACK_CANARY_TYPE leftCanary[STACK_CANARY_WRAPPER_LEN];
+    #endif
+
+    /// @brief index of the oldest elem, advanced by thieves and by the owner taking the last elem with CAS
+    alignas(64) int64_t top;
+
+    /// @brief index past the newest elem, written by the owner only
+    alignas(64) int64_t bottom;
+    /// @brief current storage, replaced by the owner on growth
+    GENERIC(wsdeque_buffer) *buffer;
+    /// @brief backend for buffers
+    const stack_allocator *allocator;
+
+    /// @brief bitset of deque statuses, updated atomically
+    mutable stack_status status;
+
+    /// @brief outp stream for deque logging
+    FILE *logStream;
+
+    /// @brief right canary array
+    #ifdef STACK_USE_CANARY
+        STACK_CANARY_TYPE rightCanary[STACK_CANARY_WRAPPER_LEN];
+    #endif
+} typedef GENERIC(wsdeque);
+/** @} */
+
+
+/**
+ * @fn static stack_status wsdeque_ctor(wsdeque *this_, size_t capacity)
+ * @brief work-stealing deque constructor
+ * @param this_ pointer to memory allocated for deque structure
+ * @param capacity initial capacity, rounded up to a power of two
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(wsdeque_ctor)(GENERIC(wsdeque) *this_, size_t capacity);
+
+
+/**
+ * @fn static stack_status wsdeque_ctorAllocator(wsdeque *this_, size_t capacity, const stack_allocator *allocator)
+ * @brief work-stealing deque constructor with a backend for buffers
+ * @param this_ pointer to memory allocated for deque structure
+ * @param capacity initial capacity, rounded up to a power of two
+ * @param allocator backend for buffers or NULL for `STACK_ALLOCATOR_MALLOC`
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(wsdeque_ctorAllocator)(GENERIC(wsdeque) *this_, size_t capacity, const stack_allocator *allocator);
+
+
+/**
+ * @fn static stack_status wsdeque_dtor(wsdeque *this_)
+ * @brief work-stealing deque destructor, frees current and retired buffers
+ * @param this_ pointer to deque structure
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(wsdeque_dtor)(GENERIC(wsdeque) *this_);
+
+
+/**
+ * @fn static stack_status wsdeque_push(wsdeque *this_, STACK_TYPE item)
+ * @brief pushes `item` to the bottom, owner only; doesn't use atomic read-modify-writes or fences
+ * @param this_ pointer to deque
+ * @param item elem to be pushed
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(wsdeque_push)(GENERIC(wsdeque) *this_, STACK_TYPE item);
+
+
+/**
+ * @fn static stack_status wsdeque_pop(wsdeque *this_, STACK_TYPE *item, bool *popped)
+ * @brief pops the newest elem from the bottom, owner only; uses a single fence, and CAS only for the last elem
+ * @param this_ pointer to deque
+ * @param item pointer to var to write to or NULL if value should be discarded
+ * @param popped pointer to var set to `false` if deque was empty or the last elem was stolen, or NULL
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(wsdeque_pop)(GENERIC(wsdeque) *this_, STACK_TYPE *item, bool *popped);
+
+
+/**
+ * @fn static stack_status wsdeque_steal(wsdeque *this_, STACK_TYPE *item, bool *stolen)
+ * @brief steals the oldest elem from the top, lock-free, could be called from any thread
+ * @param this_ pointer to deque
+ * @param item pointer to var to write to or NULL if value should be discarded
+ * @param stolen pointer to var set to `false` if deque was empty, or NULL
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(wsdeque_steal)(GENERIC(wsdeque) *this_, STACK_TYPE *item, bool *stolen);
+
+
+/**
+ * @fn static size_t wsdeque_size(const wsdeque *this_)
+ * @brief gets number of elems, exact only for the owner when there are no thieves
+ * @param this_ pointer to deque
+ * @return number of elems
+ */
+static size_t GENERIC(wsdeque_size)(const GENERIC(wsdeque) *this_);
+
+
+/**
+ * @fn static stack_status wsdeque_healthCheck(const wsdeque *this_)
+ * @brief checks struct and data canaries, buffer ptrs and indices, safe to run from any thread
+ * @param this_ pointer to deque
+ * @return bitset of stack status (of errors)
+ */
+static stack_status GENERIC(wsdeque_healthCheck)(const GENERIC(wsdeque) *this_);
+
+
+/**
+ * @fn static stack_status wsdeque_dump(const wsdeque *this_)
+ * @brief dumps deque structure and elems into this_->logStream, owner only
+ * @param this_ pointer to deque
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(wsdeque_dump)(const GENERIC(wsdeque) *this_);
+
+
+/**
+ * @fn static GENERIC(wsdeque_buffer) *wsdeque_bufferAlloc(wsdeque *this_, size_t capacity)
+ * @brief allocates buffer with canary wrapped data
+ * @param this_ pointer to deque
+ * @param capacity capacity of data, power of two
+ * @return pointer to buffer or NULL on failure
+ */
+static GENERIC(wsdeque_buffer) *GENERIC(wsdeque_bufferAlloc)(GENERIC(wsdeque) *this_, size_t capacity);
+
+
+/**
+ * @fn static stack_status wsdeque_grow(wsdeque *this_, int64_t top, int64_t bottom)
+ * @brief doubles buffer copying elems `[top, bottom)`, old buffer is retired; owner only
+ * @param this_ pointer to deque
+ * @param top top index seen by the owner
+ * @param bottom bottom index
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(wsdeque_grow)(GENERIC(wsdeque) *this_, int64_t top, int64_t bottom);
@@ -0,0 +1,723 @@
+#include "gcstack-header.h"
+
+
+#ifndef STACK_CONCURRENT_FUNC_GUARD
+#define STACK_CONCURRENT_FUNC_GUARD
+
+#ifdef STACK_USE_ELIMINATION
+    static size_t stack_eliminationSlot()
+    {
+        static thread_local uint64_t state = 0;
+        if (state == 0)
+            state = (uint64_t)(size_t)&state | 1;                   // threads start from different seeds
+
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state % STACK_ELIMINATION_SLOTS;
+    }
+#endif
+
+#endif  /* STACK_CONCURRENT_FUNC_GUARD */
+
+
+static stack_status GENERIC(cstack_ctor)(GENERIC(cstack) *this_)
+{
+    return GENERIC(cstack_ctorAllocator)(this_, &STACK_ALLOCATOR_MALLOC);
+}
+
+
+static stack_status GENERIC(cstack_ctorAllocator)(GENERIC(cstack) *this_, const stack_allocator *allocator)
+{
+    STACK_PTR_VALIDATE(this_);
+
+    this_->head      = 0;
+    this_->freeHead  = 0;
+    this_->fresh     = 0;
+    this_->len       = 0;
+    this_->status    = STACK_OK;
+    this_->logStream = stderr;
+
+    if (allocator == NULL)
+        allocator = &STACK_ALLOCATOR_MALLOC;
+    this_->allocator = allocator;
+
+    for (size_t i = 0; i < STACK_NODE_SEGMENT_COUNT; ++i)
+        this_->segments[i] = NULL;
+
+    #ifdef STACK_USE_ELIMINATION
+        for (size_t i = 0; i < STACK_ELIMINATION_SLOTS; ++i)
+            this_->elimination[i] = 0;
+    #endif
+
+    #ifdef STACK_USE_CANARY
+        for (size_t i = 0; i < STACK_CANARY_WRAPPER_LEN; ++i) {
+            this_-> leftCanary[i] =  STACK_LEFT_CANARY_POISON;
+            this_->rightCanary[i] = STACK_RIGHT_CANARY_POISON;
+        }
+    #endif
+
+    return GENERIC(cstack_healthCheck)(this_);
+}
+
+
+static stack_status GENERIC(cstack_dtor)(GENERIC(cstack) *this_)
+{
+    STACK_PTR_VALIDATE(this_);
+
+    GENERIC(cstack_healthCheck)(this_);
+
+    for (size_t i = 0; i < STACK_NODE_SEGMENT_COUNT && this_->segments[i] != NULL; ++i) {
+        #ifdef STACK_USE_POISON
+            memset((char*)this_->segments[i], STACK_FREED_POISON, (STACK_NODE_SEGMENT_BASE << i) * sizeof(GENERIC(cstack_node)));
+        #endif
+        this_->allocator->free(this_->allocator->ctx, this_->segments[i]);
+        this_->segments[i] = NULL;
+    }
+
+    this_->head  = 0;
+    this_->fresh = 0;
+    this_->len   = STACK_SIZE_T_POISON;
+
+    return this_->status;
+}
+
+
+static GENERIC(cstack_node) *GENERIC(cstack_nodeAt)(const GENERIC(cstack) *this_, uint32_t ref)
+{
+    assert(ref != STACK_NODE_NULL);
+
+    size_t index   = ref - 1;
+    size_t segment = 63 - __builtin_clzll(index / STACK_NODE_SEGMENT_BASE + 1);       // segment k starts at BASE * (2^k - 1)
+    size_t offset  = index - STACK_NODE_SEGMENT_BASE * ((1ull << segment) - 1);
+
+    return &__atomic_load_n(&this_->segments[segment], __ATOMIC_ACQUIRE)[offset];
+}
+
+
+static uint32_t GENERIC(cstack_nodeAlloc)(GENERIC(cstack) *this_)
+{
+    uint32_t ref = STACK_NODE_NULL;
+    while (!GENERIC(cstack_tryPop)(this_, &this_->freeHead, &ref)) {}
+    if (ref != STACK_NODE_NULL)
+        return ref;
+
+    uint64_t index = __atomic_fetch_add(&this_->fresh, 1, __ATOMIC_RELAXED);
+    if (index >= STACK_NODE_SEGMENT_BASE * ((1ull << STACK_NODE_SEGMENT_COUNT) - 1))
+        return STACK_NODE_NULL;
+
+    size_t segment = 63 - __builtin_clzll(index / STACK_NODE_SEGMENT_BASE + 1);
+    if (__atomic_load_n(&this_->segments[segment], __ATOMIC_ACQUIRE) == NULL) {
+        size_t count = STACK_NODE_SEGMENT_BASE << segment;
+        GENERIC(cstack_node) *nodes = (GENERIC(cstack_node)*)this_->allocator->alloc(this_->allocator->ctx, count * sizeof(GENERIC(cstack_node)));
+        if (nodes == NULL)
+            return STACK_NODE_NULL;
+
+        #ifdef STACK_USE_POISON
+            memset((char*)nodes, STACK_ELEM_POISON, count * sizeof(GENERIC(cstack_node)));
+        #endif
+        #ifdef STACK_USE_CANARY
+            for (size_t i = 0; i < count; ++i) {
+                nodes[i]. leftCanary =  STACK_LEFT_CANARY_POISON;
+                nodes[i].rightCanary = STACK_RIGHT_CANARY_POISON;
+            }
+        #endif
+
+        GENERIC(cstack_node) *expected = NULL;                          // threads that raced for the segment keep the first one
+        if (!__atomic_compare_exchange_n(&this_->segments[segment], &expected, nodes, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            this_->allocator->free(this_->allocator->ctx, nodes);
+    }
+
+    return (uint32_t)(index + 1);
+}
+
+
+static stack_status GENERIC(cstack_nodeCheck)(const GENERIC(cstack_node) *node)
+{
+    (void)node;
+    stack_status status = STACK_OK;
+
+    #ifdef STACK_USE_CANARY
+        if (node->leftCanary != STACK_LEFT_CANARY_POISON)
+            status |= STACK_LEFT_DATA_CANARY_CORRUPT;
+        if (node->rightCanary != STACK_RIGHT_CANARY_POISON)
+            status |= STACK_RIGHT_DATA_CANARY_CORRUPT;
+    #endif
+
+    #ifdef STACK_USE_DATA_HASH
+        if (node->hash != stack_crc32c(0, &node->item, sizeof(STACK_TYPE)))
+            status |= STACK_BAD_DATA_HASH;
+    #endif
+
+    return status;
+}
+
+
+static bool GENERIC(cstack_tryPush)(GENERIC(cstack) *this_, uint64_t *head, uint32_t ref)
+{
+    GENERIC(cstack_node) *node = GENERIC(cstack_nodeAt)(this_, ref);
+
+    uint64_t old = __atomic_load_n(head, __ATOMIC_RELAXED);
+    __atomic_store_n(&node->next, (uint32_t)old, __ATOMIC_RELAXED);
+    uint64_t tagged = (((old >> 32) + 1) << 32) | ref;
+
+    return __atomic_compare_exchange_n(head, &old, tagged, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+
+static bool GENERIC(cstack_tryPop)(GENERIC(cstack) *this_, uint64_t *head, uint32_t *ref)
+{
+    uint64_t old = __atomic_load_n(head, __ATOMIC_ACQUIRE);
+    if ((uint32_t)old == STACK_NODE_NULL) {
+        *ref = STACK_NODE_NULL;
+        return true;
+    }
+
+    uint32_t next   = __atomic_load_n(&GENERIC(cstack_nodeAt)(this_, (uint32_t)old)->next, __ATOMIC_RELAXED);     // node could be taken and reused meanwhile, then the tag changed and CAS fails
+    uint64_t tagged = (((old >> 32) + 1) << 32) | next;
+
+    if (!__atomic_compare_exchange_n(head, &old, tagged, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return false;
+
+    *ref = (uint32_t)old;
+    return true;
+}
+
+
+#ifdef STACK_USE_ELIMINATION
+    static bool GENERIC(cstack_eliminatePush)(GENERIC(cstack) *this_, uint32_t ref)
+    {
+        uint64_t *slot = &this_->elimination[stack_eliminationSlot()];
+
+        uint64_t expected = 0;
+        if (!__atomic_compare_exchange_n(slot, &expected, ref, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return false;
+
+        for (size_t i = 0; i < STACK_ELIMINATION_SPINS; ++i) {
+            if (__atomic_load_n(slot, __ATOMIC_RELAXED) == STACK_ELIMINATION_TAKEN) {
+                __atomic_store_n(slot, 0, __ATOMIC_RELAXED);
+                return true;
+            }
+            stack_cpuRelax();
+        }
+
+        expected = ref;
+        if (__atomic_compare_exchange_n(slot, &expected, 0, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return false;                                               // nobody came, node is withdrawn
+
+        __atomic_store_n(slot, 0, __ATOMIC_RELAXED);                    // taken right before withdrawal
+        return true;
+    }
+
+
+    static uint32_t GENERIC(cstack_eliminatePop)(GENERIC(cstack) *this_)
+    {
+        uint64_t *slot = &this_->elimination[stack_eliminationSlot()];
+
+        for (size_t i = 0; i < STACK_ELIMINATION_SPINS; ++i) {
+            uint64_t parked = __atomic_load_n(slot, __ATOMIC_RELAXED);
+            if (parked != 0 && parked != STACK_ELIMINATION_TAKEN &&
+                    __atomic_compare_exchange_n(slot, &parked, STACK_ELIMINATION_TAKEN, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                return (uint32_t)parked;
+            stack_cpuRelax();
+        }
+
+        return STACK_NODE_NULL;
+    }
+#endif
+
+
+static stack_status GENERIC(cstack_push)(GENERIC(cstack) *this_, STACK_TYPE item)
+{
+    STACK_PTR_VALIDATE(this_);
+
+    uint32_t ref = GENERIC(cstack_nodeAlloc)(this_);
+    if (ref == STACK_NODE_NULL) {
+        if (STACK_VERBOSE >= 1)
+            fprintf(this_->logStream, "ERROR: node pool exhausted or segment allocation failed\n");
+        return __atomic_or_fetch(&this_->status, STACK_BAD_MEM_ALLOC, __ATOMIC_RELAXED);
+    }
+
+    GENERIC(cstack_node) *node = GENERIC(cstack_nodeAt)(this_, ref);
+
+    #ifdef STACK_USE_POISON
+        if (!GENERIC(stack_isRangePoisoned)(&node->item, 1)) {         // free node has been written to after pop
+            if (STACK_VERBOSE >= 1)
+                fprintf(this_->logStream, "ERROR: free node %u is not poisoned\n", ref);
+            __atomic_or_fetch(&this_->status, STACK_DATA_INTEGRITY_VIOLATED, __ATOMIC_RELAXED);
+        }
+    #endif
+
+    node->item = item;
+    #ifdef STACK_USE_DATA_HASH
+        node->hash = stack_crc32c(0, &node->item, sizeof(STACK_TYPE));
+    #endif
+
+    while (!GENERIC(cstack_tryPush)(this_, &this_->head, ref)) {
+        #ifdef STACK_USE_ELIMINATION
+            if (GENERIC(cstack_eliminatePush)(this_, ref))
+                break;
+        #endif
+    }
+    __atomic_add_fetch(&this_->len, 1, __ATOMIC_RELAXED);
+
+    return __atomic_load_n(&this_->status, __ATOMIC_RELAXED);
+}
+
+
+static stack_status GENERIC(cstack_pop)(GENERIC(cstack) *this_, STACK_TYPE *item, bool *popped)
+{
+    STACK_PTR_VALIDATE(this_);
+
+    uint32_t ref = STACK_NODE_NULL;
+    while (!GENERIC(cstack_tryPop)(this_, &this_->head, &ref)) {
+        #ifdef STACK_USE_ELIMINATION
+            if ((ref = GENERIC(cstack_eliminatePop)(this_)) != STACK_NODE_NULL)
+                break;
+        #endif
+    }
+
+    if (popped != NULL)
+        *popped = (ref != STACK_NODE_NULL);
+    if (ref == STACK_NODE_NULL)
+        return __atomic_load_n(&this_->status, __ATOMIC_RELAXED);
+
+    GENERIC(cstack_node) *node = GENERIC(cstack_nodeAt)(this_, ref);
+
+    stack_status status = GENERIC(cstack_nodeCheck)(node);
+    if (status) {
+        if (STACK_VERBOSE >= 1)
+            fprintf(this_->logStream, "ERROR: node %u is corrupted, status %d\n", ref, status);
+        __atomic_or_fetch(&this_->status, status, __ATOMIC_RELAXED);
+    }
+
+    if (item != NULL)
+        *item = node->item;
+
+    #ifdef STACK_USE_POISON
+        memset((char*)&node->item, STACK_ELEM_POISON, sizeof(STACK_TYPE));
+    #endif
+
+    while (!GENERIC(cstack_tryPush)(this_, &this_->freeHead, ref)) {}
+    __atomic_sub_fetch(&this_->len, 1, __ATOMIC_RELAXED);
+
+    return __atomic_load_n(&this_->status, __ATOMIC_RELAXED);
+}
+
+
+static stack_status GENERIC(cstack_healthCheck)(const GENERIC(cstack) *this_)
+{
+    STACK_PTR_VALIDATE(this_);
+
+    stack_status status = STACK_OK;
+
+    #ifdef STACK_USE_CANARY
+        for (size_t i = 0; i < STACK_CANARY_WRAPPER_LEN; ++i) {
+            if (this_->leftCanary[i] != STACK_LEFT_CANARY_POISON)
+                status |= STACK_LEFT_STRUCT_CANARY_CORRUPT;
+            if (this_->rightCanary[i] != STACK_RIGHT_CANARY_POISON)
+                status |= STACK_RIGHT_STRUCT_CANARY_CORRUPT;
+        }
+
+        for (size_t i = 0; i < STACK_NODE_SEGMENT_COUNT; ++i) {           // canaries are never written after segment allocation, so scan is race free
+            const GENERIC(cstack_node) *nodes = __atomic_load_n(&this_->segments[i], __ATOMIC_ACQUIRE);
+            if (nodes == NULL)
+                continue;
+            if (!ptrValid(nodes)) {
+                status |= STACK_BAD_DATA_PTR;
+                continue;
+            }
+            for (size_t j = 0; j < (STACK_NODE_SEGMENT_BASE << i); ++j) {
+                if (nodes[j].leftCanary != STACK_LEFT_CANARY_POISON)
+                    status |= STACK_LEFT_DATA_CANARY_CORRUPT;
+                if (nodes[j].rightCanary != STACK_RIGHT_CANARY_POISON)
+                    status |= STACK_RIGHT_DATA_CANARY_CORRUPT;
+            }
+        }
+    #endif
+
+    if (!ptrValid(this_->allocator))
+        status |= STACK_INTEGRITY_VIOLATED;
+
+    if (status) {
+        if (STACK_VERBOSE >= 1)
+            fprintf(this_->logStream, "Probles found in concurrent stack healthcheck, status %d\n\n", status);
+        __atomic_or_fetch(&this_->status, status, __ATOMIC_RELAXED);
+    }
+
+    return __atomic_load_n(&this_->status, __ATOMIC_RELAXED);
+}
+
+
+static stack_status GENERIC(cstack_dump)(const GENERIC(cstack) *this_)
+{
+    STACK_PTR_VALIDATE(this_);
+    FILE *out = this_->logStream;
+    if (!ptrValid(out)) {
+        fprintf(stderr, "WARNING: Bad log stream provided, outputing to stderr.\n");
+        out = stderr;
+    }
+
+    fprintf(out, "%s\n", STACK_LOG_DELIM);
+    fprintf(out, "| Concurrent stack [%p] :\n", this_);
+    fprintf(out, "|----------------\n");
+    fprintf(out, "| Current status = %d\n", this_->status);
+    if (this_->status & STACK_BAD_MEM_ALLOC)
+        fprintf(out, "| Bad memory allocation \n");
+    if (this_->status & STACK_INTEGRITY_VIOLATED)
+        fprintf(out, "| Stack integrity violated \n");
+    if (this_->status & STACK_DATA_INTEGRITY_VIOLATED)
+        fprintf(out, "| Data integrity violated, free node written to \n");
+    if (this_->status & STACK_LEFT_STRUCT_CANARY_CORRUPT)
+        fprintf(out, "| Left structure canary corrupted \n");
+    if (this_->status & STACK_RIGHT_STRUCT_CANARY_CORRUPT)
+        fprintf(out, "| Right structure canary corrupted \n");
+    if (this_->status & STACK_LEFT_DATA_CANARY_CORRUPT)
+        fprintf(out, "| Left node canary corrupted \n");
+    if (this_->status & STACK_RIGHT_DATA_CANARY_CORRUPT)
+        fprintf(out, "| Right node canary corrupted \n");
+    if (this_->status & STACK_BAD_DATA_HASH)
+        fprintf(out, "| Bad node hash, stack data may be corrupted \n");
+
+    if (STACK_VERBOSE >= 1) {
+        size_t segments = 0;
+        while (segments < STACK_NODE_SEGMENT_COUNT && this_->segments[segments] != NULL)
+            ++segments;
+
+        fprintf(out, "|----------------\n");
+        fprintf(out, "| Len              = %zu\n", this_->len);
+        fprintf(out, "| Nodes taken      = %" PRIu64 "\n", this_->fresh);
+        fprintf(out, "| Segments         = %zu\n", segments);
+        fprintf(out, "| Head tag         = %" PRIu64 "\n", this_->head >> 32);
+        fprintf(out, "|   {\n");
+
+        size_t count = 0;
+        for (uint32_t ref = (uint32_t)this_->head; ref != STACK_NODE_NULL && count < this_->len; ++count) {     // len bounds the walk in case the list is looped
+            const GENERIC(cstack_node) *node = GENERIC(cstack_nodeAt)(this_, ref);
+            fprintf(out, "| *   " ELEM_PRINTF_FORM "%s\n", node->item, GENERIC(cstack_nodeCheck)(node) ? "  (corrupted)" : "");
+            ref = node->next;
+        }
+
+        fprintf(out, "|  }\n");
+    }
+    fprintf(out, "%s\n", STACK_LOG_DELIM);
+
+    return this_->status;
+}
+
+
+static stack_status GENERIC(wsdeque_ctor)(GENERIC(wsdeque) *this_, size_t capacity)
+{
+    return GENERIC(wsdeque_ctorAllocator)(this_, capacity, &STACK_ALLOCATOR_MALLOC);
+}
+
+
+static stack_status GENERIC(wsdeque_ctorAllocator)(GENERIC(wsdeque) *this_, size_t capacity, const stack_allocator *allocator)
+{
+    STACK_PTR_VALIDATE(this_);
+
+    this_->top       = 0;
+    this_->bottom    = 0;
+    this_->status    = STACK_OK;
+    this_->logStream = stderr;
+
+    if (allocator == NULL)
+        allocator = &STACK_ALLOCATOR_MALLOC;
+    this_->allocator = allocator;
+
+    #ifdef STACK_USE_CANARY
+        for (size_t i = 0; i < STACK_CANARY_WRAPPER_LEN; ++i) {
+            this_-> leftCanary[i] =  STACK_LEFT_CANARY_POISON;
+            this_->rightCanary[i] = STACK_RIGHT_CANARY_POISON;
+        }
+    #endif
+
+    size_t powerCapacity = 1;
+    while (powerCapacity < capacity)
+        powerCapacity *= 2;
+
+    this_->buffer = GENERIC(wsdeque_bufferAlloc)(this_, powerCapacity);
+    if (this_->buffer == NULL) {
+        this_->status = STACK_BAD_MEM_ALLOC;
+        return this_->status;
+    }
+
+    return GENERIC(wsdeque_healthCheck)(this_);
+}
+
+
+static stack_status GENERIC(wsdeque_dtor)(GENERIC(wsdeque) *this_)
+{
+    STACK_PTR_VALIDATE(this_);
+
+    GENERIC(wsdeque_healthCheck)(this_);
+
+    GENERIC(wsdeque_buffer) *buffer = this_->buffer;
+    while (buffer != NULL) {
+        GENERIC(wsdeque_buffer) *retired = buffer->retired;
+        #ifdef STACK_USE_POISON
+            memset((char*)buffer->dataWrapper, STACK_FREED_POISON, GENERIC(stack_allocated_size)(buffer->capacity));
+        #endif
+        stack_storageFree(this_->allocator, buffer->dataWrapper, buffer->mappedSize);
+        this_->allocator->free(this_->allocator->ctx, buffer);
+        buffer = retired;
+    }
+
+    this_->buffer = NULL;
+    this_->top    = 0;
+    this_->bottom = 0;
+
+    return this_->status;
+}
+
+
+static GENERIC(wsdeque_buffer) *GENERIC(wsdeque_bufferAlloc)(GENERIC(wsdeque) *this_, size_t capacity)
+{
+    GENERIC(wsdeque_buffer) *buffer = (GENERIC(wsdeque_buffer)*)this_->allocator->alloc(this_->allocator->ctx, sizeof(GENERIC(wsdeque_buffer)));
+    if (buffer == NULL)
+        return NULL;
+
+    buffer->capacity    = capacity;
+    buffer->retired     = NULL;
+    buffer->dataWrapper = (STACK_CANARY_TYPE*)stack_storageAlloc(this_->allocator, GENERIC(stack_allocated_size)(capacity), &buffer->mappedSize);
+    if (buffer->dataWrapper == NULL) {
+        this_->allocator->free(this_->allocator->ctx, buffer);
+        return NULL;
+    }
+    buffer->data = (STACK_TYPE*)(buffer->dataWrapper + STACK_DATA_WRAPPER_LEN);
+
+    #ifdef STACK_USE_POISON
+        memset((char*)buffer->data, STACK_ELEM_POISON, capacity * sizeof(STACK_TYPE));
+    #endif
+
+    #ifdef STACK_USE_DATA_CANARY
+        for (size_t i = 0; i < STACK_DATA_WRAPPER_LEN; ++i) {
+            buffer->dataWrapper[i] = STACK_LEFT_CANARY_POISON;
+            ((STACK_CANARY_TYPE*)(buffer->data + capacity))[i] = STACK_RIGHT_CANARY_POISON;
+        }
+    #endif
+
+    return buffer;
+}
+
+
+static stack_status GENERIC(wsdeque_grow)(GENERIC(wsdeque) *this_, int64_t top, int64_t bottom)
+{
+    GENERIC(wsdeque_buffer) *old = this_->buffer;
+    GENERIC(wsdeque_buffer) *buffer = GENERIC(wsdeque_bufferAlloc)(this_, 2 * old->capacity);
+    if (buffer == NULL) {
+        if (STACK_VERBOSE >= 1)
+            fprintf(this_->logStream, "ERROR: failed to grow work-stealing deque to %zu elems\n", 2 * old->capacity);
+        return __atomic_or_fetch(&this_->status, STACK_BAD_MEM_ALLOC, __ATOMIC_RELAXED);
+    }
+
+    for (int64_t i = top; i < bottom; ++i)                              // thieves could still read the old buffer, so it is retired, not freed
+        __atomic_load(&old->data[i & (old->capacity - 1)], &buffer->data[i & (buffer->capacity - 1)], __ATOMIC_RELAXED);
+    buffer->retired = old;
+
+    __atomic_store_n(&this_->buffer, buffer, __ATOMIC_RELEASE);
+
+    return GENERIC(wsdeque_healthCheck)(this_);
+}
+
+
+static stack_status GENERIC(wsdeque_push)(GENERIC(wsdeque) *this_, STACK_TYPE item)
+{
+    STACK_PTR_VALIDATE(this_);
+
+    int64_t bottom = __atomic_load_n(&this_->bottom, __ATOMIC_RELAXED);
+    int64_t top    = __atomic_load_n(&this_->top,    __ATOMIC_ACQUIRE);
+    GENERIC(wsdeque_buffer) *buffer = this_->buffer;
+
+    if (bottom - top > (int64_t)buffer->capacity - 1) {
+        if (GENERIC(wsdeque_grow)(this_, top, bottom) & STACK_BAD_MEM_ALLOC)
+            return this_->status;
+        buffer = this_->buffer;
+    }
+
+    __atomic_store(&buffer->data[bottom & (buffer->capacity - 1)], &item, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);                            // elem is visible to thieves before bottom
+    __atomic_store_n(&this_->bottom, bottom + 1, __ATOMIC_RELAXED);
+
+    return __atomic_load_n(&this_->status, __ATOMIC_RELAXED);
+}
+
+
+static stack_status GENERIC(wsdeque_pop)(GENERIC(wsdeque) *this_, STACK_TYPE *item, bool *popped)
+{
+    STACK_PTR_VALIDATE(this_);
+
+    int64_t bottom = __atomic_load_n(&this_->bottom, __ATOMIC_RELAXED) - 1;
+    GENERIC(wsdeque_buffer) *buffer = this_->buffer;
+    __atomic_store_n(&this_->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);                            // thieves see the reserved bottom before we read top
+    int64_t top = __atomic_load_n(&this_->top, __ATOMIC_RELAXED);
+
+    bool taken = false;
+    STACK_TYPE value = {};
+    if (top <= bottom) {
+        __atomic_load(&buffer->data[bottom & (buffer->capacity - 1)], &value, __ATOMIC_RELAXED);
+        taken = true;
+        if (top == bottom) {                                            // the last elem, race thieves for it
+            taken = __atomic_compare_exchange_n(&this_->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+            __atomic_store_n(&this_->bottom, bottom + 1, __ATOMIC_RELAXED);
+        }
+    }
+    else {
+        __atomic_store_n(&this_->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+
+    if (popped != NULL)
+        *popped = taken;
+    if (taken && item != NULL)
+        *item = value;
+
+    return __atomic_load_n(&this_->status, __ATOMIC_RELAXED);
+}
+
+
+static stack_status GENERIC(wsdeque_steal)(GENERIC(wsdeque) *this_, STACK_TYPE *item, bool *stolen)
+{
+    STACK_PTR_VALIDATE(this_);
+
+    while (true) {
+        int64_t top = __atomic_load_n(&this_->top, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int64_t bottom = __atomic_load_n(&this_->bottom, __ATOMIC_ACQUIRE);
+
+        if (top >= bottom) {
+            if (stolen != NULL)
+                *stolen = false;
+            break;
+        }
+
+        GENERIC(wsdeque_buffer) *buffer = __atomic_load_n(&this_->buffer, __ATOMIC_ACQUIRE);
+        STACK_TYPE value = {};
+        __atomic_load(&buffer->data[top & (buffer->capacity - 1)], &value, __ATOMIC_RELAXED);
+
+        if (__atomic_compare_exchange_n(&this_->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            if (stolen != NULL)
+                *stolen = true;
+            if (item != NULL)
+                *item = value;
+            break;
+        }
+        stack_cpuRelax();                                               // lost to another thief or to the owner
+    }
+
+    return __atomic_load_n(&this_->status, __ATOMIC_RELAXED);
+}
+
+
+static size_t GENERIC(wsdeque_size)(const GENERIC(wsdeque) *this_)
+{
+    int64_t bottom = __atomic_load_n(&this_->bottom, __ATOMIC_RELAXED);
+    int64_t top    = __atomic_load_n(&this_->top,    __ATOMIC_RELAXED);
+    return bottom > top ? bottom - top : 0;
+}
+
+
+static stack_status GENERIC(wsdeque_healthCheck)(const GENERIC(wsdeque) *this_)
+{
+    STACK_PTR_VALIDATE(this_);
+
+    stack_status status = STACK_OK;
+
+    #ifdef STACK_USE_CANARY
+        for (size_t i = 0; i < STACK_CANARY_WRAPPER_LEN; ++i) {
+            if (this_->leftCanary[i] != STACK_LEFT_CANARY_POISON)
+                status |= STACK_LEFT_STRUCT_CANARY_CORRUPT;
+            if (this_->rightCanary[i] != STACK_RIGHT_CANARY_POISON)
+                status |= STACK_RIGHT_STRUCT_CANARY_CORRUPT;
+        }
+    #endif
+
+    int64_t bottom = __atomic_load_n(&this_->bottom, __ATOMIC_ACQUIRE);     // bottom before top and buffer, so that bottom - top never exceeds capacity
+    int64_t top    = __atomic_load_n(&this_->top,    __ATOMIC_ACQUIRE);
+    const GENERIC(wsdeque_buffer) *buffer = __atomic_load_n(&this_->buffer, __ATOMIC_ACQUIRE);
+
+    if (!ptrValid(buffer) || !ptrValid(buffer->dataWrapper) || !ptrValid(this_->allocator)) {
+        status |= STACK_BAD_DATA_PTR;
+    }
+    else {
+        if (buffer->capacity == 0 || (buffer->capacity & (buffer->capacity - 1)))
+            status |= STACK_BAD_CAPACITY;
+        else if (bottom - top > (int64_t)buffer->capacity)
+            status |= STACK_INTEGRITY_VIOLATED;
+
+        #ifdef STACK_USE_DATA_CANARY                                    // canaries are never written after buffer allocation, so check is race free
+            if (!(status & STACK_BAD_CAPACITY)) {
+                for (size_t i = 0; i < STACK_DATA_WRAPPER_LEN; ++i) {
+                    if (buffer->dataWrapper[i] != STACK_LEFT_CANARY_POISON)
+                        status |= STACK_LEFT_DATA_CANARY_CORRUPT;
+                    if (((const STACK_CANARY_TYPE*)(buffer->data + buffer->capacity))[i] != STACK_RIGHT_CANARY_POISON)
+                        status |= STACK_RIGHT_DATA_CANARY_CORRUPT;
+                }
+            }
+        #endif
+    }
+
+    if (status) {
+        if (STACK_VERBOSE >= 1)
+            fprintf(this_->logStream, "Probles found in work-stealing deque healthcheck, status %d\n\n", status);
+        __atomic_or_fetch(&this_->status, status, __ATOMIC_RELAXED);
+    }
+
+    return __atomic_load_n(&this_->status, __ATOMIC_RELAXED);
+}
+
+
+static stack_status GENERIC(wsdeque_dump)(const GENERIC(wsdeque) *this_)
+{
+    STACK_PTR_VALIDATE(this_);
+    FILE *out = this_->logStream;
+    if (!ptrValid(out)) {
+        fprintf(stderr, "WARNING: Bad log stream provided, outputing to stderr.\n");
+        out = stderr;
+    }
+
+    fprintf(out, "%s\n", STACK_LOG_DELIM);
+    fprintf(out, "| Work-stealing deque [%p] :\n", this_);
+    fprintf(out, "|----------------\n");
+    fprintf(out, "| Current status = %d\n", this_->status);
+    if (this_->status & STACK_BAD_DATA_PTR)
+        fprintf(out, "| Bad buffer ptr \n");
+    if (this_->status & STACK_BAD_MEM_ALLOC)
+        fprintf(out, "| Bad memory allocation \n");
+    if (this_->status & STACK_INTEGRITY_VIOLATED)
+        fprintf(out, "| Deque integrity violated, bottom is too far from top \n");
+    if (this_->status & STACK_LEFT_STRUCT_CANARY_CORRUPT)
+        fprintf(out, "| Left structure canary corrupted \n");
+    if (this_->status & STACK_RIGHT_STRUCT_CANARY_CORRUPT)
+        fprintf(out, "| Right structure canary corrupted \n");
+    if (this_->status & STACK_LEFT_DATA_CANARY_CORRUPT)
+        fprintf(out, "| Left data canary corrupted \n");
+    if (this_->status & STACK_RIGHT_DATA_CANARY_CORRUPT)
+        fprintf(out, "| Right data canary corrupted \n");
+    if (this_->status & STACK_BAD_CAPACITY)
+        fprintf(out, "| Bad capacity, not a power of two \n");
+
+    if (STACK_VERBOSE >= 1 && !(this_->status & (STACK_BAD_DATA_PTR | STACK_BAD_CAPACITY))) {
+        const GENERIC(wsdeque_buffer) *buffer = this_->buffer;
+
+        size_t retired = 0;
+        for (const GENERIC(wsdeque_buffer) *iter = buffer->retired; iter != NULL; iter = iter->retired)
+            ++retired;
+
+        fprintf(out, "|----------------\n");
+        fprintf(out, "| Capacity         = %zu\n", buffer->capacity);
+        fprintf(out, "| Top              = %" PRId64 "\n", this_->top);
+        fprintf(out, "| Bottom           = %" PRId64 "\n", this_->bottom);
+        fprintf(out, "| Data ptr         = %p\n", buffer->data);
+        fprintf(out, "| Retired buffers  = %zu\n", retired);
+        fprintf(out, "|   {\n");
+
+        for (int64_t i = this_->top; i < this_->bottom && i - this_->top < (int64_t)buffer->capacity; ++i)
+            fprintf(out, "| *   " ELEM_PRINTF_FORM "\n", buffer->data[i & (buffer->capacity - 1)]);
+
+        fprintf(out, "|  }\n");
+    }
+    fprintf(out, "%s\n", STACK_LOG_DELIM);
+
+    return this_->status;
+}
@@ -0,0 +1,324 @@
+/**
+ * @file Definitions shared by the C stack and its C++ front-end `gstack.hpp`, independent of debug options
+ */
+
+#ifndef GSTACK_COMMON_H
+#define GSTACK_COMMON_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __x86_64__
+    #include <nmmintrin.h>          /// for crc32 intrinsic, enabled per function and dispatched in runtime
+    #include <wmmintrin.h>          /// for carry-less multiplication intrinsic
+#endif
+
+static const char STACK_LOG_DELIM[] = "===========================";      /// delim for stack logs
+
+#define STACK_LIKELY(cond)   __builtin_expect(!!(cond), 1)                  /// branch hints for the hot paths
+#define STACK_UNLIKELY(cond) __builtin_expect(!!(cond), 0)
+#define STACK_COLD           __attribute__((noinline, cold))               /// keeps diagnostics and reallocations out of inlined push and pop
+
+
+enum stack_status_enum {                        /// ERROR codes for stack
+    STACK_OK                      = 0,               /// All_is_fine status
+
+    STACK_BAD_STRUCT_PTR          = 1<<0,            /// Bad ptr for stack structure provided
+    STACK_BAD_DATA_PTR            = 1<<1,            /// Bad ptr for stack data
+    STACK_BAD_MEM_ALLOC           = 1<<2,            /// Error during memory (re)allocation
+    STACK_INTEGRITY_VIOLATED      = 1<<3,            /// Stack structure intergrity violated
+    STACK_DATA_INTEGRITY_VIOLATED = 1<<4,            /// Stack data intergrity violated
+
+     STACK_LEFT_STRUCT_CANARY_CORRUPT = 1<<7,   /// Stack canary has been modified
+    STACK_RIGHT_STRUCT_CANARY_CORRUPT = 1<<8,   /// could happen if big chank of data
+       STACK_LEFT_DATA_CANARY_CORRUPT = 1<<9,   /// has been carelessly filled with data
+      STACK_RIGHT_DATA_CANARY_CORRUPT = 1<<10,  /// or if stack data has been writen above it
+
+    STACK_BAD_STRUCT_HASH = 1<<13,            /// Bad hash of all stack structure filds
+    STACK_BAD_DATA_HASH   = 1<<14,            /// Bad hash of all the stack data
+    STACK_BAD_CAPACITY    = 1<<15,            /// Stack capacity has been modified and/or is clearly incorrect
+
+    STACK_EMPTY           = 1<<16             /// Pop from empty stack; only returned, never kept in stack status
+};
+
+typedef int stack_status;                   /// stack status is a bitset inside an int
+
+
+typedef unsigned long long STACK_CANARY_TYPE;          /// Type for canaries can be configured
+
+static const STACK_CANARY_TYPE  STACK_LEFT_CANARY_POISON = 0xFEEDFACECAFEBEE9;    /// Poison for left  struct and data canaries
+static const STACK_CANARY_TYPE STACK_RIGHT_CANARY_POISON = 0xFEEDFACECAFEBEE8;    /// Poison for right struct and data canaries
+static const size_t STACK_CANARY_COUNT = 3;                             /// Canaries in each wrapper when canaries are on
+
+static const size_t STACK_SIZE_T_POISON = -13;                          /// poison for all size_t vars
+
+static const char STACK_ELEM_POISON    = (char)0xFA;        /// one-byte poison for in-use structures
+static const char STACK_FREED_POISON   = (char)0xFC;        /// one-byte poison for freed structures
+
+static const uint32_t STACK_CRC32C_POLY   = 0x82F63B78;           /// reflected Castagnoli polynomial, the one `crc32` instruction uses
+static const uint32_t STACK_CRC32C_ONE    = 0x80000000;           /// x^0 mod P in reflected form
+static const uint32_t STACK_CRC32C_X      = 0x40000000;           /// x^1 mod P in reflected form
+static const uint32_t STACK_CRC32C_X_INV  = 0x05EC76F1;           /// x^-1 mod P in reflected form, used to cut elems off the hash
+static const size_t   STACK_CRC32C_STRIPE = 8192;                 /// bytes per stream in the three-stream crc32c kernel
+
+
+/**
+ * @fn static size_t stack_maxCapacity(size_t elemSize, size_t wrapperLen)
+ * @brief biggest capacity whose data, wrapped in `wrapperLen` canaries on each side, has its size fit in size_t
+ * @param elemSize size of one elem
+ * @param wrapperLen number of canaries on each side of the data
+ * @return max capacity
+ */
+static inline size_t stack_maxCapacity(size_t elemSize, size_t wrapperLen)
+{
+    return (STACK_SIZE_T_POISON - 2 * wrapperLen * sizeof(STACK_CANARY_TYPE)) / elemSize;
+}
+
+
+/**
+ * @fn static uint32_t stack_crc32c(uint32_t crc, const void *buf, size_t size)
+ * @brief continues raw (not pre- or post-inverted) crc32c over `size` bytes of `buf`;
+ * raw crc is linear, so hashes of neighbouring ranges could be combined and split;
+ * calls the fastest kernel supported by the host cpu, which is chosen on the first call
+ * @param crc hash of the preceding bytes or 0
+ * @param buf pointer to bytes to be hashed
+ * @param size number of bytes
+ * @return crc32c of preceding bytes followed by `buf`
+ */
+static inline uint32_t stack_crc32c(uint32_t crc, const void *buf, size_t size);
+
+
+/**
+ * @fn static uint32_t stack_crc32cTable(uint32_t crc, const void *buf, size_t size)
+ * @brief portable slice-by-8 crc32c kernel
+ * @see stack_crc32c
+ */
+static inline uint32_t stack_crc32cTable(uint32_t crc, const void *buf, size_t size);
+
+
+/**
+ * @fn static void stack_crc32cInit()
+ * @brief fills slice-by-8 tables and chooses the kernel once, concurrent first callers wait for it;
+ * the kernel is published only after the tables it reads
+ */
+static inline void stack_crc32cInit();
+
+
+/**
+ * @fn static uint32_t stack_crc32cSse42(uint32_t crc, const void *buf, size_t size)
+ * @brief SSE4.2 crc32c kernel hashing 8-byte words
+ * @see stack_crc32c
+ */
+#ifdef __x86_64__
+    static inline uint32_t stack_crc32cSse42(uint32_t crc, const void *buf, size_t size);
+#endif
+
+
+/**
+ * @fn static uint32_t stack_crc32cClmul(uint32_t crc, const void *buf, size_t size)
+ * @brief SSE4.2 crc32c kernel running three independent streams of `STACK_CRC32C_STRIPE` bytes,
+ * which are merged with carry-less multiplication
+ * @see stack_crc32c
+ */
+#ifdef __x86_64__
+    static inline uint32_t stack_crc32cClmul(uint32_t crc, const void *buf, size_t size);
+#endif
+
+
+/**
+ * @fn static uint32_t stack_crc32cMultModP(uint32_t a, uint32_t b)
+ * @brief multiplies two polynomials modulo crc32c polynomial (both in reflected form)
+ * @param a first multiplier
+ * @param b second multiplier
+ * @return a * b mod P
+ */
+static inline uint32_t stack_crc32cMultModP(uint32_t a, uint32_t b);
+
+
+/**
+ * @fn static uint32_t stack_crc32cPowModP(uint32_t a, uint64_t n)
+ * @brief raises polynomial to the `n` power modulo crc32c polynomial
+ * @param a polynomial in reflected form
+ * @param n power
+ * @return a^n mod P
+ */
+static inline uint32_t stack_crc32cPowModP(uint32_t a, uint64_t n);
+
+
+static uint32_t STACK_CRC32C_TABLE[8][256];                     /// slice-by-8 tables, filled by dispatcher
+
+static inline uint32_t stack_crc32cTable(uint32_t crc, const void *buf, size_t size)
+{
+    stack_crc32cInit();                                         // kernel may be called directly, before the dispatcher
+
+    const unsigned char *iter = (const unsigned char*)buf;
+    const unsigned char *end  = iter + size;
+
+    #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        for (; iter + sizeof(uint64_t) <= end; iter += sizeof(uint64_t)) {
+            uint64_t word = 0;
+            memcpy(&word, iter, sizeof(uint64_t));
+            word ^= crc;
+            crc = STACK_CRC32C_TABLE[7][ word        & 0xFF] ^ STACK_CRC32C_TABLE[6][(word >>  8) & 0xFF] ^
+                  STACK_CRC32C_TABLE[5][(word >> 16) & 0xFF] ^ STACK_CRC32C_TABLE[4][(word >> 24) & 0xFF] ^
+                  STACK_CRC32C_TABLE[3][(word >> 32) & 0xFF] ^ STACK_CRC32C_TABLE[2][(word >> 40) & 0xFF] ^
+                  STACK_CRC32C_TABLE[1][(word >> 48) & 0xFF] ^ STACK_CRC32C_TABLE[0][ word >> 56        ];
+        }
+    #endif
+    for (; iter < end; ++iter) {
+        crc = STACK_CRC32C_TABLE[0][(crc ^ *iter) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+
+#ifdef __x86_64__
+__attribute__((target("sse4.2")))
+static inline uint32_t stack_crc32cSse42(uint32_t crc, const void *buf, size_t size)
+{
+    const char *iter = (const char*)buf;
+    const char *end  = iter + size;
+
+    uint64_t crc64 = crc;
+    for (; iter + sizeof(uint64_t) <= end; iter += sizeof(uint64_t)) {
+        uint64_t word = 0;
+        memcpy(&word, iter, sizeof(uint64_t));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+    for (; iter < end; ++iter) {
+        crc = _mm_crc32_u8(crc, *iter);
+    }
+
+    return crc;
+}
+
+
+static uint32_t STACK_CRC32C_STRIPE_SHIFT = 0;                  /// x^(8 * STACK_CRC32C_STRIPE - 32) mod P, filled by dispatcher
+
+__attribute__((target("sse4.2,pclmul")))
+static inline uint32_t stack_crc32cClmul(uint32_t crc, const void *buf, size_t size)
+{
+    const char *iter = (const char*)buf;
+    const __m128i shift = _mm_cvtsi32_si128((int)STACK_CRC32C_STRIPE_SHIFT);
+
+    for (; size >= 3 * STACK_CRC32C_STRIPE; size -= 3 * STACK_CRC32C_STRIPE, iter += 3 * STACK_CRC32C_STRIPE) {
+        uint64_t crc0 = crc;
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+
+        for (size_t i = 0; i < STACK_CRC32C_STRIPE; i += sizeof(uint64_t)) {     // three independent dependency chains hide crc32 latency
+            uint64_t word0 = 0, word1 = 0, word2 = 0;
+            memcpy(&word0, iter + i,                           sizeof(uint64_t));
+            memcpy(&word1, iter + i +     STACK_CRC32C_STRIPE, sizeof(uint64_t));
+            memcpy(&word2, iter + i + 2 * STACK_CRC32C_STRIPE, sizeof(uint64_t));
+            crc0 = _mm_crc32_u64(crc0, word0);
+            crc1 = _mm_crc32_u64(crc1, word1);
+            crc2 = _mm_crc32_u64(crc2, word2);
+        }
+                                                                // crc(A||B) = crc(A) * x^(8|B|) ^ crc(B); clmul product is reduced by crc32 itself,
+                                                                // which multiplies by extra x^32 that is compensated in STACK_CRC32C_STRIPE_SHIFT
+        uint64_t prod = _mm_cvtsi128_si64(_mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crc0), shift, 0));
+        crc0 = _mm_crc32_u64(0, prod << 1) ^ crc1;
+        prod = _mm_cvtsi128_si64(_mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crc0), shift, 0));
+        crc  = (uint32_t)(_mm_crc32_u64(0, prod << 1) ^ crc2);
+    }
+
+    return stack_crc32cSse42(crc, iter, size);
+}
+#endif
+
+
+static inline uint32_t stack_crc32cResolve(uint32_t crc, const void *buf, size_t size);
+
+static uint32_t (*STACK_CRC32C_KERNEL)(uint32_t, const void*, size_t) = stack_crc32cResolve;     /// kernel chosen by dispatcher
+static int STACK_CRC32C_INIT_STATE = 0;                         /// 0 before dispatch, 1 while tables are filled, 2 once they and the kernel are ready
+
+static inline void stack_crc32cInit()
+{
+    if (__atomic_load_n(&STACK_CRC32C_INIT_STATE, __ATOMIC_ACQUIRE) == 2)
+        return;
+
+    int state = 0;                                              // first calls may race from several threads, only one fills the tables
+    if (!__atomic_compare_exchange_n(&STACK_CRC32C_INIT_STATE, &state, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&STACK_CRC32C_INIT_STATE, __ATOMIC_ACQUIRE) != 2)
+            ;
+        return;
+    }
+
+    for (uint32_t n = 0; n < 256; ++n) {
+        uint32_t val = n;
+        for (size_t k = 0; k < 8; ++k)
+            val = (val & 1) ? (val >> 1) ^ STACK_CRC32C_POLY : val >> 1;
+        STACK_CRC32C_TABLE[0][n] = val;
+    }
+    for (uint32_t n = 0; n < 256; ++n) {
+        for (size_t k = 1; k < 8; ++k)                          // crc of byte `n` followed by `k` zero bytes
+            STACK_CRC32C_TABLE[k][n] = (STACK_CRC32C_TABLE[k - 1][n] >> 8) ^ STACK_CRC32C_TABLE[0][STACK_CRC32C_TABLE[k - 1][n] & 0xFF];
+    }
+
+    uint32_t (*kernel)(uint32_t, const void*, size_t) = stack_crc32cTable;
+
+    #ifdef __x86_64__
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.2")) {
+            kernel = stack_crc32cSse42;
+            if (__builtin_cpu_supports("pclmul")) {
+                STACK_CRC32C_STRIPE_SHIFT = stack_crc32cPowModP(STACK_CRC32C_X, 8 * STACK_CRC32C_STRIPE - 32);
+                kernel = stack_crc32cClmul;
+            }
+        }
+    #endif
+
+    __atomic_store_n(&STACK_CRC32C_KERNEL, kernel, __ATOMIC_RELEASE);
+    __atomic_store_n(&STACK_CRC32C_INIT_STATE, 2, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t stack_crc32cResolve(uint32_t crc, const void *buf, size_t size)
+{
+    stack_crc32cInit();
+    return __atomic_load_n(&STACK_CRC32C_KERNEL, __ATOMIC_ACQUIRE)(crc, buf, size);
+}
+
+
+static inline uint32_t stack_crc32c(uint32_t crc, const void *buf, size_t size)
+{
+    return __atomic_load_n(&STACK_CRC32C_KERNEL, __ATOMIC_ACQUIRE)(crc, buf, size);
+}
+
+
+static inline uint32_t stack_crc32cMultModP(uint32_t a, uint32_t b)
+{
+    uint32_t m = STACK_CRC32C_ONE;
+    uint32_t p = 0;
+
+    while (m && a) {                    // schoolbook carry-less multiplication, lowest power is the highest bit
+        if (a & m) {
+            p ^= b;
+            a ^= m;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ STACK_CRC32C_POLY : b >> 1;
+    }
+
+    return p;
+}
+
+
+static inline uint32_t stack_crc32cPowModP(uint32_t a, uint64_t n)
+{
+    uint32_t res = STACK_CRC32C_ONE;
+
+    while (n) {
+        if (n & 1)
+            res = stack_crc32cMultModP(res, a);
+        a = stack_crc32cMultModP(a, a);
+        n >>= 1;
+    }
+
+    return res;
+}
+
+#endif  /* GSTACK_COMMON_H */
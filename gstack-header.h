@@ -26,7 +26,59 @@
                                           ///  could be greater than required; 
                                           ///  for more information read `man 3 malloc_usable_size`
     #define STACK_USE_PTR_SYS_CHECK      
-    #define STACK_VERBOSE 2
+    #ifndef STACK_VERBOSE
+        #define STACK_VERBOSE 2             /// an explicit verbosity, e.g. of quiet benchmarks, wins
+    #endif
+#endif
+
+#define STACK_GROWTH_X2          0          /// capacity is doubled (default)
+#define STACK_GROWTH_X1_5        1          /// capacity grows by 1.5x
+#define STACK_GROWTH_PAGE        2          /// capacity is doubled and rounded up to whole pages once it is bigger than a page
+#define STACK_GROWTH_USABLE_SIZE 3          /// capacity is doubled and rounded up to `malloc_usable_size` of the new data
+
+#ifndef STACK_GROWTH_POLICY
+    #define STACK_GROWTH_POLICY STACK_GROWTH_X2     /// Compile-time growth policy, one of STACK_GROWTH_*
+#endif
+
+#if defined(STACK_USE_GUARD_PAGES) && !defined(__linux__)
+    #undef STACK_USE_GUARD_PAGES               /// guard pages rely on linux `mremap`
+#endif
+
+#if defined(STACK_USE_CANARY) && !defined(STACK_USE_GUARD_PAGES)
+    #define STACK_USE_DATA_CANARY              /// Service flag for data wrapped in canaries, guard pages replace them
+#endif
+
+#if defined(STACK_USE_MMAP) && !defined(__linux__)
+    #undef STACK_USE_MMAP                      /// mmap storage backend relies on linux `mremap`
+#endif
+
+#if defined(STACK_USE_FILE) && !defined(__linux__)
+    #undef STACK_USE_FILE                      /// file-backed stacks rely on linux `mremap`
+#endif
+
+#ifdef STACK_USE_MMAP                          /// Big data is kept in anonymous mappings grown with `mremap` instead of `realloc`
+    #ifndef STACK_MMAP_THRESHOLD
+        #define STACK_MMAP_THRESHOLD      (4ull << 20)   /// data allocations of at least this size are mmapped
+    #endif
+    #ifndef STACK_HUGEPAGE_THRESHOLD
+        #define STACK_HUGEPAGE_THRESHOLD  (32ull << 20)  /// mappings of at least this size are advised to use transparent huge pages
+    #endif
+#endif
+
+#ifndef STACK_INLINE_CAPACITY
+    #define STACK_INLINE_CAPACITY 0                 /// elems stored inside the stack struct before the first heap allocation, 0 turns it off
+#endif
+
+#if defined(__linux__) && !defined(STACK_SHRINK_ADVICE)
+    #define STACK_SHRINK_ADVICE MADV_DONTNEED       /// madvise advice releasing pages of mapped data on shrink, MADV_FREE is lazier
+#endif
+
+#ifdef STACK_USE_DATA_HASH_BLOCKS              /// Data hash is kept per block, checks verify only dirty and some sampled blocks
+    #define STACK_USE_DATA_HASH
+#endif
+
+#if defined(STACK_USE_DATA_HASH) && !defined(STACK_USE_DATA_HASH_BLOCKS)
+    #define STACK_USE_DATA_HASH_WATERMARK           /// Service flag for the single data hash verified only past a watermark
 #endif
 
 
@@ -36,12 +88,19 @@
 #include <string.h>
 #include <math.h>
 
-#include <nmmintrin.h>              /// for crc32 intrinsic
+#ifdef __x86_64__
+    #include <immintrin.h>          /// for SSE2/AVX2 poison scan
+#endif
 #include <inttypes.h>
+#include <time.h>                   /// for time-budgeted healthchecks
 #define __STDC_FORMAT_MACROS    
 
-#ifdef STACK_USE_CAPACITY_SYS_CHECK
-    #include <malloc.h>             /// for sys real capacity checks
+#if defined(STACK_USE_CAPACITY_SYS_CHECK) || defined(STACK_USE_MMAP) || defined(STACK_USE_GUARD_PAGES) || STACK_GROWTH_POLICY == STACK_GROWTH_USABLE_SIZE
+    #define STACK_USE_USABLE_SIZE           /// Service flag for querying real size of the data allocation
+#endif
+
+#if defined(__GLIBC__) || defined(_WIN32)
+    #include <malloc.h>             /// for usable size of blocks of the default allocator
 #endif
 
 #ifdef _WIN32
@@ -51,26 +110,40 @@
     #include <unistd.h>
     #include <sys/mman.h>
 #endif
+#ifdef STACK_USE_FILE
+    #include <fcntl.h>              /// for opening stack files
+    #include <sys/stat.h>
+    #include <stddef.h>             /// for `offsetof` of the commit checksum
+#endif
+#ifdef STACK_USE_GUARD_PAGES
+    #include <signal.h>             /// for turning guard page faults into dumps
+#endif
+#if defined(STACK_USE_ASYNC_CHECK) || defined(STACK_USE_EVENT_LOG)
+    #include <pthread.h>            /// for the background verifier and event flusher threads
+#endif
+
+#ifdef __cplusplus
+    #include <type_traits>          /// for rejecting elem types the stack can't move with realloc
+#endif
 
 #include "pseudo-templates.h"
+#include "gstack-common.h"          /// status codes and hints shared with the C++ front-end
 
 //===========================================
 // Stack options configuration
 
 struct GENERIC(stack);
 
+#ifdef __cplusplus
+    static_assert(std::is_trivially_copyable<STACK_TYPE>::value,
+                  "stack moves elems with realloc and hashes their bytes, use gstack<T> of gstack.hpp for other types");
+#endif
+
 #ifndef STACK_CONST_GUARD
 #define STACK_CONST_GUARD
 
-static const char STACK_LOG_DELIM[] = "===========================";      /// delim for stack logs
-
 static const size_t STACK_STARTING_CAPACITY = 2;                          /// capacity when stack is freshly created
 
-static const double STACK_EXPAND_FACTOR = 2;                              /// stack reallocate expand factor
-static const double STACK_SHRINKAGE_FACTOR = 3;                           /// stack reallocate shrink factor
-
-static STACK_TYPE STACK_REFERENCE_POISONED_ELEM;                          /// reference to a poisoned stack elem for easy copm; filled in constructor       //TODO maybe fill in compilation
-
 
 //===========================================
 // Debug options configuration
@@ -83,45 +156,277 @@ static STACK_TYPE STACK_REFERENCE_POISONED_ELEM;                          /// re
     static const void    *STACK_BAD_PTR_MASK = (void*)0xDEADC0DE;       /// mask for checking if ptr is invalid (comp ptr>>4 with MASK)
 #endif
 
-static const size_t STACK_SIZE_T_POISON = -13;                          /// poison for all size_t vars
+#ifdef STACK_USE_DATA_HASH_BLOCKS
+    static const size_t STACK_DATA_HASH_BLOCK_SIZE    = 4096;         /// bytes of data covered by one block hash (at least one elem)
+    static const size_t STACK_DATA_HASH_SAMPLE_BLOCKS = 1;            /// clean blocks verified by each healthcheck in addition to the dirty ones
+#endif
 
-#ifdef STACK_USE_POISON
-    static const char STACK_ELEM_POISON    = 0xFA;           /// one-byte poison for in-use structures
-    static const char STACK_FREED_POISON   = 0xFC;           /// one-byte poison for freed structures
+#ifdef STACK_USE_DATA_HASH_WATERMARK
+    static const size_t STACK_DATA_HASH_RESCAN_SIZE   = 4096;         /// bytes of the verified prefix rehashed by each healthcheck (at least one elem)
 #endif
 
-typedef unsigned long long STACK_CANARY_TYPE;          /// Type for canaries can be configured
 #ifdef STACK_USE_CANARY   
-    static const STACK_CANARY_TYPE  STACK_LEFT_CANARY_POISON = 0xFEEDFACECAFEBEE9;    /// Poison for left  struct and data canaries
-    static const STACK_CANARY_TYPE STACK_RIGHT_CANARY_POISON = 0xFEEDFACECAFEBEE8;    /// Poison for right struct and data canaries
-    static const size_t STACK_CANARY_WRAPPER_LEN  = 3;                  /// Len of all canary wrappers
+    static const size_t STACK_CANARY_WRAPPER_LEN  = STACK_CANARY_COUNT; /// Len of all canary wrappers
     
     // static const ULL STACK_BAD_CANARY_MASK = 0b1111000000;           /// Mask for all status codes associated with a bad canary
 #else
     static const size_t STACK_CANARY_WRAPPER_LEN = 0;                   /// Service value for turned off canaries
 #endif
+
+#ifdef STACK_USE_DATA_CANARY
+    static const size_t STACK_DATA_WRAPPER_LEN = STACK_CANARY_WRAPPER_LEN;      /// Len of data canary wrappers
+#else
+    static const size_t STACK_DATA_WRAPPER_LEN = 0;                             /// Service value for data without canaries
+#endif
    
-enum stack_status_enum {                        /// ERROR codes for stack
-    STACK_OK                      = 0,               /// All_is_fine status
-
-    STACK_BAD_STRUCT_PTR          = 1<<0,            /// Bad ptr for stack structure provided
-    STACK_BAD_DATA_PTR            = 1<<1,            /// Bad ptr for stack data
-    STACK_BAD_MEM_ALLOC           = 1<<2,            /// Error during memory (re)allocation
-    STACK_INTEGRITY_VIOLATED      = 1<<3,            /// Stack structure intergrity violated
-    STACK_DATA_INTEGRITY_VIOLATED = 1<<4,            /// Stack data intergrity violated
-
-     STACK_LEFT_STRUCT_CANARY_CORRUPT = 1<<7,   /// Stack canary has been modified
-    STACK_RIGHT_STRUCT_CANARY_CORRUPT = 1<<8,   /// could happen if big chank of data
-       STACK_LEFT_DATA_CANARY_CORRUPT = 1<<9,   /// has been carelessly filled with data
-      STACK_RIGHT_DATA_CANARY_CORRUPT = 1<<10,  /// or if stack data has been writen above it
-
-    STACK_BAD_STRUCT_HASH = 1<<13,            /// Bad hash of all stack structure filds
-    STACK_BAD_DATA_HASH   = 1<<14,            /// Bad hash of all the stack data
-    STACK_BAD_CAPACITY    = 1<<15             /// Stack capacity has been modified and/or is clearly incorrect
+
+enum stack_check_mode {                         /// Cadence of healthchecks run by push, pop, top and get
+    STACK_CHECK_ALWAYS  = 0,                        /// check on every operation
+    STACK_CHECK_EVERY_N = 1,                        /// check on every `period`-th operation
+    STACK_CHECK_SAMPLED = 2,                        /// check random operations with probability `rate`
+    STACK_CHECK_BUDGET  = 3,                        /// check while checks took less than `budgetNs` of cpu time during the last second
 };
 
+/**
+ * @struct stack_check_policy
+ * @brief per-stack healthcheck cadence; both checks of a single operation are either run or skipped
+ */
+struct stack_check_policy
+{
+    /// @brief cadence mode
+    enum stack_check_mode mode;
+    /// @brief number of operations per check for `STACK_CHECK_EVERY_N`
+    size_t period;
+    /// @brief probability of checking an operation for `STACK_CHECK_SAMPLED`
+    double rate;
+    /// @brief cpu time per second allowed for checks for `STACK_CHECK_BUDGET`
+    uint64_t budgetNs;
+} typedef stack_check_policy;
+
+static const stack_check_policy STACK_CHECK_POLICY_ALWAYS = {STACK_CHECK_ALWAYS, 1, 1, 0};     /// default policy of a fresh stack
+
+static const uint64_t STACK_CHECK_BUDGET_WINDOW_NS = 1000000000;                              /// window for `STACK_CHECK_BUDGET` accounting
+
+/**
+ * @struct stack_allocator
+ * @brief backend for malloc'ed stack data, a stack could be given one on construction;
+ *        every function gets `ctx` as the first argument
+ */
+struct stack_allocator
+{
+    /// @brief allocates `size` bytes with unspecified contents, returns NULL on failure
+    void  *(*alloc)(void *ctx, size_t size);
+    /// @brief resizes block keeping its contents, returns NULL on failure, then block is untouched
+    void  *(*realloc)(void *ctx, void *ptr, size_t size);
+    /// @brief frees block
+    void   (*free)(void *ctx, void *ptr);
+    /// @brief real size of the block, could be bigger than requested; NULL if backend doesn't know it
+    size_t (*usableSize)(void *ctx, void *ptr);
+    /// @brief state of the backend
+    void  *ctx;
+    /// @brief storage outlives the stack: it's not poisoned on free and never moved into mmapped, guarded or inline storage;
+    ///        `ctx` is then the `stack_file` the storage is mapped from
+    bool   persistent;
+} typedef stack_allocator;
+
+static const size_t STACK_ARENA_HEADER_SIZE = 16;                   /// header before every arena block, keeps payload 16-byte aligned
+static const size_t STACK_ARENA_MIN_BLOCK   = 64;                   /// smallest arena size class including header
+static const size_t STACK_ARENA_CLASS_COUNT = 11;                   /// size classes are powers of two from 64B to 64KB, bigger blocks are malloc'ed
+static const size_t STACK_ARENA_CHUNK_SIZE  = 1 << 20;              /// arena blocks are carved from chunks of this size
+
+/// @brief per-thread state of the arena allocator
+struct stack_arena {
+    char *bump;                                     /// next free byte of the current chunk
+    char *bumpEnd;                                  /// end of the current chunk
+    void *freeList[STACK_ARENA_CLASS_COUNT];        /// blocks freed by this thread, linked through their first word
+} typedef stack_arena;
+
+#if defined(STACK_USE_PTR_SYS_CHECK) && defined(__unix__)
+    #define STACK_USE_PTR_CACHE                                         /// Service flag for the cache of pages `msync` found mapped
+
+    static const size_t STACK_PTR_CACHE_SIZE = 16;                      /// page intervals remembered by each thread
+
+    /// @brief per-thread intervals of pages known to be mapped, dropped when epoch changes
+    struct stack_ptr_cache {
+        uint64_t epoch;                                 /// `STACK_PTR_CACHE_EPOCH` intervals are valid for
+        size_t   count;                                 /// intervals in use
+        size_t   next;                                  /// interval to be replaced next when full
+        size_t   begin[STACK_PTR_CACHE_SIZE];           /// first byte of the interval
+        size_t   end[STACK_PTR_CACHE_SIZE];             /// byte after the interval
+    } typedef stack_ptr_cache;
+#endif
+
+#ifdef STACK_USE_FILE
+    static const char     STACK_FILE_MAGIC[8]      = "gstack1";        /// first bytes of every stack file
+    static const uint32_t STACK_FILE_VERSION       = 1;                /// layout version of the file header
+    static const size_t   STACK_FILE_HEADER_SIZE   = 1 << 16;          /// data wrapper starts at this offset, multiple of any page size
+    static const size_t   STACK_FILE_COMMIT_BLOCKS = 1024;             /// committed data is hashed in at most that many blocks
+
+    /// @brief state of the stack at a sync, the last consistent one is restored on reopen
+    struct stack_file_commit {
+        uint64_t sequence;                              /// 0 for a slot never written, the newest commit has the biggest one
+        uint64_t len;                                   /// elems committed
+        uint64_t blockLen;                              /// elems per hashed block, the last block could be shorter
+        uint32_t blockHashes[STACK_FILE_COMMIT_BLOCKS]; /// crc32c of every committed block
+        uint32_t crc;                                   /// crc32c of the fields above, torn write of the slot breaks it
+    } typedef stack_file_commit;
+
+    /// @brief first `STACK_FILE_HEADER_SIZE` bytes of a stack file
+    struct stack_file_header {
+        char     magic[8];                              /// `STACK_FILE_MAGIC`
+        uint32_t version;                               /// `STACK_FILE_VERSION`
+        uint32_t elemSize;                              /// sizeof(STACK_TYPE) of the stack that created the file
+        uint64_t wrapperSize;                           /// bytes of every data canary wrapper, depends on debug options
+        stack_file_commit commits[2];                   /// commits are written in turns, so a torn one leaves the other intact
+    } typedef stack_file_header;
+
+    /// @brief open stack file, `ctx` of its persistent allocator
+    struct stack_file {
+        int             fd;
+        char           *base;                           /// mapping of the whole file, NULL while unmapped
+        size_t          size;                           /// size of the file and of the mapping
+        size_t          slot;                           /// slot of the commit the stack was reopened with or last synced to
+        stack_allocator allocator;                      /// hands out the data part of the mapping
+    } typedef stack_file;
+#endif
+
+#ifdef STACK_USE_GUARD_PAGES
+    static const size_t STACK_GUARD_REGISTRY_SIZE = 1024;               /// max count of live stacks whose guard page faults are diagnosed
+
+    /// @brief live stack with guard pages, looked up by the SIGSEGV handler
+    struct stack_guard_entry {
+        void *stack;                                    /// stack or NULL for a free slot
+        char *leftGuard;                                /// page right before the data
+        char *rightGuard;                               /// page right after the data
+        void (*fault)(void *stack, int status);          /// marks the stack with `stack_status` bits and dumps it
+    } typedef stack_guard_entry;
+#endif
+
+#ifdef STACK_USE_ASYNC_CHECK
+    static const size_t STACK_VERIFIER_CAPACITY = 64;                   /// max count of stacks watched by one verifier
+
+    /// @brief seqlock shared by a watched stack and its verifier
+    struct stack_watch {
+        uint64_t version;                               /// even when the stack is consistent, odd while the owner changes it
+        size_t   depth;                                 /// nesting of write scopes, touched by the owner only
+        int      reading;                               /// set while the verifier reads stack memory, data is not freed meanwhile
+        int      status;                                /// `stack_status` bits found by the verifier
+        void    *stack;                                 /// watched stack or NULL for a free slot
+        bool   (*verify)(void *stack, struct stack_watch *watch, int *status);      /// checks a snapshot, `false` if it was torn
+        void   (*callback)(void *stack, int status, void *ctx);                     /// called from the verifier thread on problems
+        void    *ctx;                                   /// passed to `callback`
+    } typedef stack_watch;
+
+    /// @brief background thread verifying snapshots of watched stacks
+    struct stack_verifier {
+        pthread_t       thread;
+        pthread_mutex_t lock;                           /// guards `watches`, held through a verification pass
+        uint64_t        intervalNs;                     /// pause between verification passes
+        bool            running;
+        uint64_t        passes;                         /// consistent snapshots verified
+        uint64_t        skips;                          /// snapshots dropped as the stack was changed meanwhile
+        stack_watch     watches[STACK_VERIFIER_CAPACITY];
+    } typedef stack_verifier;
+#endif
+
+#ifdef STACK_USE_EVENT_LOG
+    #ifndef STACK_EVENT_RING_LEN
+        #define STACK_EVENT_RING_LEN 1024               /// events in the ring of every logging thread, power of two
+    #endif
+    #if STACK_EVENT_RING_LEN <= 0 || (STACK_EVENT_RING_LEN & (STACK_EVENT_RING_LEN - 1)) != 0
+        #error "STACK_EVENT_RING_LEN must be a power of two, ring indices are masked with it"
+    #endif
+    static const size_t   STACK_EVENT_STRING_CACHE = 1024;                  /// call site strings remembered as written by a flusher
+    static const uint64_t STACK_EVENT_FILE_MAGIC   = 0x3154564b54534700;    /// "\0GSTKVT1" opening an event file
+
+    enum stack_event_tag {                      /// kinds of records in an event file, each starts with a 64bit tag
+        STACK_EVENT_TAG_EVENT   = 1,                /// followed by `stack_event`
+        STACK_EVENT_TAG_STRING  = 2,                /// followed by 64bit key, 64bit length and the string bytes
+        STACK_EVENT_TAG_DROPPED = 3,                /// followed by 64bit count of events dropped on full rings
+    };
+
+    /// @brief fixed size record of a single log event; strings must be static, in files pointers are only keys of string records
+    struct stack_event {
+        uint64_t    timeNs;                         /// monotonic time of the event
+        const void *stack;
+        const char *message;
+        const char *func;                           /// call site
+        const char *file;
+        uint64_t    len;
+        uint64_t    capacity;
+        uint32_t    line;
+        int         status;                         /// `stack_status` bits at the time of the event
+    } typedef stack_event;
+
+    /// @brief single producer single consumer ring of one logging thread, reused by other threads after the owner exits
+    struct stack_event_ring {
+        alignas(64) uint64_t head;                  /// events written, touched by the owner thread only
+        alignas(64) uint64_t tail;                  /// events read, touched by the flusher only
+        uint64_t dropped;                           /// events lost on a full ring, written by the owner thread
+        uint64_t droppedReported;                   /// part of `dropped` already written to a file
+        int      owned;                             /// 1 while a thread logs into the ring
+        struct stack_event_ring *next;              /// list of all rings, rings are never freed
+        stack_event events[STACK_EVENT_RING_LEN];
+    } typedef stack_event_ring;
+
+    /// @brief drains rings of all threads to a binary event file
+    struct stack_event_flusher {
+        pthread_t   thread;
+        FILE       *out;
+        uint64_t    intervalNs;                     /// pause between drains, 0 for no thread and manual `stack_eventFlush`
+        bool        running;
+        uint64_t    written;                        /// events written to `out`
+        const char *strings[STACK_EVENT_STRING_CACHE];      /// open addressing set of strings already in `out`
+    } typedef stack_event_flusher;
+#endif
+
+#ifdef STACK_USE_STATS
+    static const size_t STACK_LATENCY_BUCKETS = 32;     /// bucket `i` counts operations that took [2^i, 2^(i+1)) ns, the last one also longer ones
+
+    enum stack_stats_op {                       /// operations with latency histograms
+        STACK_STATS_PUSH,
+        STACK_STATS_POP,
+        STACK_STATS_PUSH_N,
+        STACK_STATS_POP_N,
+        STACK_STATS_TOP,
+        STACK_STATS_GET,
+        STACK_STATS_OP_COUNT,
+    };
+
+    enum stack_stats_phase {                    /// timed phases of healthcheck
+        STACK_STATS_PHASE_STRUCT_HASH,
+        STACK_STATS_PHASE_CANARIES,                 /// struct and data canaries
+        STACK_STATS_PHASE_SYS_CAPACITY,
+        STACK_STATS_PHASE_DATA_HASH,
+        STACK_STATS_PHASE_POISON,
+        STACK_STATS_PHASE_COUNT,
+    };
+
+    /// @brief per-stack performance counters, owned by the thread that owns the stack
+    struct stack_stats {
+        uint64_t pushes;                            /// elems pushed
+        uint64_t pops;                              /// elems popped
+        uint64_t reallocations;                     /// data resizes by `stack_reallocate`
+        uint64_t bytesCopied;                       /// bytes copied by reallocations, moves of `realloc` count as copies, `mremap` doesn't
+        uint64_t peakLen;
+        uint64_t peakCapacity;
+        uint64_t healthChecks;
+        uint64_t phaseNs[STACK_STATS_PHASE_COUNT];                          /// time spent in every healthcheck phase
+        uint64_t latency[STACK_STATS_OP_COUNT][STACK_LATENCY_BUCKETS];      /// log2 histograms of operation latency
+    } typedef stack_stats;
+
+    /// @brief scope timer adding elapsed time to a counter or to a histogram
+    struct stack_stats_timer {
+        uint64_t *target;                           /// phase counter or histogram
+        uint64_t  start;
+        bool      histogram;
+    } typedef stack_stats_timer;
+#endif
+
 #endif  /* STACK_CONST_GUARD */
 
+static STACK_TYPE GENERIC(STACK_REFERENCE_POISONED_ELEM);                 /// reference to a poisoned stack elem for easy copm, one per STACK_TYPE; filled in constructor       //TODO maybe fill in compilation
+
 #ifndef STACK_VERBOSE
     #define STACK_VERBOSE 0                 /// Service value for stack verbosity if not stated otherwise is 0
 #endif
@@ -131,8 +436,6 @@ enum stack_status_enum {                        /// ERROR codes for stack
 #endif
 
  
-typedef int stack_status;                   /// stack status is a bitset inside an int
- 
 
 //===========================================
 // Advanced debug functions
@@ -171,7 +474,7 @@ static bool ptrValid(const void* ptr);
 
 /**
  * @fn static uint64_t stack_calculateDataHash(const stack *this_)
- * @brief calculates stack data hash bytewise
+ * @brief calculates hash of the live stack data `[0, len)` from scratch
  * @param this_ pointer to const stack struct
  * @return uint64_t hash value
  */
@@ -180,6 +483,165 @@ static bool ptrValid(const void* ptr);
 #endif
 
 
+/**
+ * @fn static uint32_t stack_crc32cCut(uint32_t hash, const STACK_TYPE *elems, size_t count)
+ * @brief cuts `count` elems off the end of the hashed range
+ * @param hash raw crc32c of some range ending with `elems`
+ * @param elems pointer to the last `count` elems of the range
+ * @param count number of elems to cut off
+ * @return raw crc32c of the range without `elems`
+ */
+#ifdef STACK_USE_DATA_HASH
+    static uint32_t GENERIC(stack_crc32cCut)(uint32_t hash, const STACK_TYPE *elems, size_t count);
+#endif
+
+
+/**
+ * @fn static void stack_dataHashPush(stack *this_, size_t count)
+ * @brief updates data hash in O(count) after `count` elems were placed on top of the stack and len was increased
+ * @param this_ pointer to stack struct
+ * @param count number of pushed elems
+ */
+#ifdef STACK_USE_DATA_HASH
+    static void GENERIC(stack_dataHashPush)(GENERIC(stack) *this_, size_t count);
+#endif
+
+
+/**
+ * @fn static void stack_dataHashPop(stack *this_, size_t count)
+ * @brief updates data hash in O(count) after len was decreased by `count`, while removed elems are still in place
+ * @param this_ pointer to stack struct
+ * @param count number of removed elems
+ */
+#ifdef STACK_USE_DATA_HASH
+    static void GENERIC(stack_dataHashPop)(GENERIC(stack) *this_, size_t count);
+#endif
+
+
+/**
+ * @fn static size_t stack_blockLen()
+ * @brief calculates number of elems covered by one data block hash
+ * @return elems per block
+ */
+#ifdef STACK_USE_DATA_HASH_BLOCKS
+    static size_t GENERIC(stack_blockLen)();
+#endif
+
+
+/**
+ * @fn static size_t stack_blockCount(size_t len)
+ * @brief calculates number of data blocks needed for `len` elems
+ * @param len number of elems
+ * @return number of blocks
+ */
+#ifdef STACK_USE_DATA_HASH_BLOCKS
+    static size_t GENERIC(stack_blockCount)(size_t len);
+#endif
+
+
+/**
+ * @fn static void stack_markBlockDirty(const stack *this_, size_t pos)
+ * @brief marks the block containing elem `pos` for verification by the next healthcheck
+ * @param this_ pointer to stack struct
+ * @param pos position of the elem
+ */
+#ifdef STACK_USE_DATA_HASH_BLOCKS
+    static void GENERIC(stack_markBlockDirty)(const GENERIC(stack) *this_, size_t pos);
+#endif
+
+
+/**
+ * @fn static bool stack_verifyBlock(const stack *this_, size_t block)
+ * @brief recalculates hash of the live part of the block and compares it with the stored one
+ * @param this_ pointer to stack struct
+ * @param block index of the block
+ * @return `true` if block is intact, `false` otherwise
+ */
+#ifdef STACK_USE_DATA_HASH_BLOCKS
+    static bool GENERIC(stack_verifyBlock)(const GENERIC(stack) *this_, size_t block);
+#endif
+
+
+/**
+ * @fn static void stack_lowerWatermark(const stack *this_, size_t pos)
+ * @brief moves the verified prefix down to `pos` elems in O(verifiedLen - pos),
+ * elems from `pos` up are verified by the next healthcheck; call it while they are still unchanged
+ * @param this_ pointer to stack struct
+ * @param pos new length of the verified prefix, ignored if it is not lower than the current one
+ */
+#ifdef STACK_USE_DATA_HASH_WATERMARK
+    static void GENERIC(stack_lowerWatermark)(const GENERIC(stack) *this_, size_t pos);
+#endif
+
+
+/**
+ * @fn static bool stack_verifyWatermark(const stack *this_)
+ * @brief verifies data hash by hashing only elems past the verified prefix and moves the prefix up to len;
+ * also rehashes the next `STACK_DATA_HASH_RESCAN_SIZE` bytes of the prefix, so that stray writes below it are found
+ * @param this_ pointer to stack struct
+ * @return `true` if data is intact, `false` otherwise
+ */
+#ifdef STACK_USE_DATA_HASH_WATERMARK
+    static bool GENERIC(stack_verifyWatermark)(const GENERIC(stack) *this_);
+#endif
+
+
+/**
+ * @fn static size_t stack_findNotPoisoned(const void *buf, size_t size, char poison)
+ * @brief finds the first byte of `buf` that is not equal to `poison`;
+ * calls the widest kernel supported by the host cpu, which is chosen on the first call
+ * @param buf pointer to bytes to be checked
+ * @param size number of bytes
+ * @param poison one-byte poison
+ * @return offset of the first bad byte or `size` if all of them are poisoned
+ */
+#ifdef STACK_USE_POISON
+    static size_t stack_findNotPoisoned(const void *buf, size_t size, char poison);
+#endif
+
+
+/**
+ * @fn static size_t stack_findNotPoisonedScalar(const void *buf, size_t size, char poison)
+ * @brief portable poison scan kernel comparing 8-byte words
+ * @see stack_findNotPoisoned
+ */
+#ifdef STACK_USE_POISON
+    static size_t stack_findNotPoisonedScalar(const void *buf, size_t size, char poison);
+#endif
+
+
+/**
+ * @fn static size_t stack_findNotPoisonedSse2(const void *buf, size_t size, char poison)
+ * @brief SSE2 poison scan kernel
+ * @see stack_findNotPoisoned
+ */
+#if defined(STACK_USE_POISON) && defined(__x86_64__)
+    static size_t stack_findNotPoisonedSse2(const void *buf, size_t size, char poison);
+#endif
+
+
+/**
+ * @fn static size_t stack_findNotPoisonedAvx2(const void *buf, size_t size, char poison)
+ * @brief AVX2 poison scan kernel
+ * @see stack_findNotPoisoned
+ */
+#if defined(STACK_USE_POISON) && defined(__x86_64__)
+    static size_t stack_findNotPoisonedAvx2(const void *buf, size_t size, char poison);
+#endif
+
+
+/**
+ * @fn static bool stack_isRangePoisoned(const STACK_TYPE *elems, size_t count)
+ * @brief check if `count` stack elems are all filled with one-byte poison
+ * @param elems pointer to the first elem
+ * @param count number of elems
+ * @return `true` if poisoned, `false` otherwise
+ */
+#ifdef STACK_USE_POISON
+    static bool GENERIC(stack_isRangePoisoned)(const STACK_TYPE *elems, size_t count);
+#endif
+
+
 /**
  * @fn static bool stack_isPoisoned(const STACK_TYPE *elem)
  * @brief check if stack elem is filled with one-byte poison
@@ -192,19 +654,19 @@ static bool ptrValid(const void* ptr);
 
 
 /**
- * @fn static size_t stack_getRealCapacity(void* ptr);
- * @brief gets real capacity from the allocator
- * @param ptr to allocated data
- * @return real capacity
+ * @fn static size_t stack_getRealCapacity(const stack *this_);
+ * @brief gets real capacity of the stack data from the allocator or from the inline storage size
+ * @param this_ pointer to stack
+ * @return real capacity or STACK_SIZE_T_POISON if it is unknown
  */
 #ifdef STACK_USE_CAPACITY_SYS_CHECK
-    static size_t GENERIC(stack_getRealCapacity)(void* ptr);
+    static size_t GENERIC(stack_getRealCapacity)(const GENERIC(stack) *this_);
 #endif
 
 
 /// macros for accessing Left and Right data canary wrapper from inside of a func with defined `this_`
 #define  LEFT_CANARY_WRAPPER (this_->dataWrapper)
-#define RIGHT_CANARY_WRAPPER ((STACK_CANARY_TYPE*)((char*)this_->dataWrapper + STACK_CANARY_WRAPPER_LEN * sizeof(STACK_CANARY_TYPE) + this_->capacity * sizeof(STACK_TYPE)))
+#define RIGHT_CANARY_WRAPPER ((STACK_CANARY_TYPE*)((char*)this_->dataWrapper + STACK_DATA_WRAPPER_LEN * sizeof(STACK_CANARY_TYPE) + this_->capacity * sizeof(STACK_TYPE)))
 
 
 /**
@@ -214,12 +676,18 @@ static bool ptrValid(const void* ptr);
  * @param out `FILE*` stream to log to
  * @param message c-style string to log with stack
  */
-#define STACK_LOG_TO_STREAM(this_, out, message)                                                    \
-{                                                                                                    \
-    fprintf(out, "%s\n| %s\n", STACK_LOG_DELIM, message);                                             \
-    fprintf(out, "| called from func %s on line %d of file %s\n", __func__, __LINE__, __FILE__);       \
-    GENERIC(stack_dumpToStream)(this_, out);                                                            \
-}
+#ifdef STACK_USE_EVENT_LOG
+    #define STACK_LOG_TO_STREAM(this_, out, message)                                                            \
+    {                                                                                                            \
+        (void)(out);                                                                                              \
+        stack_eventLog(this_, this_->status, this_->len, this_->capacity, message, __func__, __FILE__, __LINE__);  \
+    }
+#else
+    #define STACK_LOG_TO_STREAM(this_, out, message)                                                    \
+    {                                                                                                    \
+        GENERIC(stack_log)(this_, out, message, __func__, __LINE__, __FILE__);                            \
+    }
+#endif
 
 
 /**
@@ -228,7 +696,15 @@ static bool ptrValid(const void* ptr);
  * @param this_ pointer to stack structure
  * @return stack_status 
  */
-#ifndef NDEBUG
+#if !defined(NDEBUG) && defined(STACK_USE_EVENT_LOG)
+    #define STACK_HEALTH_CHECK(this_) ({                                                                                \
+        if (GENERIC(stack_healthCheck)(this_)) {                                                                         \
+            stack_eventLog(this_, this_->status, this_->len, this_->capacity,                                             \
+                           "Probles found in healthcheck", __func__, __FILE__, __LINE__);                                  \
+        }                                                                                                                  \
+        this_->status;                                                                                                      \
+    })
+#elif !defined(NDEBUG)
     #define STACK_HEALTH_CHECK(this_) ({                                                                                \
         if (GENERIC(stack_healthCheck)(this_)) {                                                                         \
             fprintf(this_->logStream, "Probles found in healthcheck run from %s on line %zu\n\n", __func__, __LINE__);    \
@@ -240,6 +716,39 @@ static bool ptrValid(const void* ptr);
 #endif
 
 
+/**
+ * @fn STACK_OP_BEGIN_CHECK(this_)
+ * @brief macro to decide by the stack check policy if the current operation is checked
+ * and to run the opening healthcheck if so
+ * @param this_ pointer to stack structure
+ * @return stack_status
+ */
+/**
+ * @fn STACK_OP_END_CHECK(this_)
+ * @brief macro to run the closing healthcheck if the current operation is checked
+ * @param this_ pointer to stack structure
+ * @return stack_status
+ */
+#ifndef NDEBUG
+    #define STACK_TIMED_HEALTH_CHECK_(this_) ({                                                     \
+        uint64_t checkStart_ = GENERIC(stack_checkClock)(this_);                                     \
+        stack_status checkStatus_ = STACK_HEALTH_CHECK(this_);                                        \
+        GENERIC(stack_checkSpent)(this_, checkStart_);                                                 \
+        checkStatus_;                                                                                   \
+    })
+    #define STACK_OP_BEGIN_CHECK(this_) ({                                                              \
+        GENERIC(stack_checkDue)(this_) ? STACK_TIMED_HEALTH_CHECK_(this_)                               \
+                                       : this_->status;                                                 \
+    })
+    #define STACK_OP_END_CHECK(this_) ({                                                                    \
+        this_->checkScheduled ? STACK_TIMED_HEALTH_CHECK_(this_) : this_->status;                            \
+    })
+#else
+    #define STACK_OP_BEGIN_CHECK(this_) ({false;})
+    #define STACK_OP_END_CHECK(this_)   ({false;})
+#endif
+
+
 /**
  * @fn STACK_PTR_VALIDATE(this__)
  * @brief macro to run ptr checks inside stack_* functions that return `stack_status`
@@ -258,6 +767,45 @@ static bool ptrValid(const void* ptr);
     #define STACK_PTR_VALIDATE(this__) {}
 #endif
 
+
+/**
+ * @fn STACK_WRITE_SCOPE(this_)
+ * @brief macro opening a write scope of a watched stack till the end of the block,
+ *        it is the only cost of background checks on the hot path
+ * @param this_ pointer to stack structure
+ */
+#ifdef STACK_USE_ASYNC_CHECK
+    #define STACK_WRITE_SCOPE(this_)                                                                        \
+        stack_watch *stackWriteScope_ __attribute__((cleanup(stack_writeEnd))) = stack_writeBegin(this_->watch)
+#else
+    #define STACK_WRITE_SCOPE(this_) {}
+#endif
+
+
+/**
+ * @fn STACK_STATS_OP_SCOPE(this_, op)
+ * @brief macro timing the rest of the block into the latency histogram of `op`
+ * @param this_ pointer to stack structure
+ * @param op `stack_stats_op`
+ */
+/**
+ * @fn STACK_STATS_PHASE_SCOPE(this_, phase)
+ * @brief macro adding time of the rest of the block to the healthcheck `phase`
+ * @param this_ pointer to stack structure
+ * @param phase `stack_stats_phase`
+ */
+#ifdef STACK_USE_STATS
+    #define STACK_STATS_OP_SCOPE(this_, op)                                                                 \
+        stack_stats_timer stackStatsOp_ __attribute__((cleanup(stack_statsTimerEnd))) =                       \
+            {this_->stats.latency[op], stack_clockNs(false), true}
+    #define STACK_STATS_PHASE_SCOPE(this_, phase)                                                           \
+        stack_stats_timer stackStatsPhase_ __attribute__((cleanup(stack_statsTimerEnd))) =                    \
+            {&this_->stats.phaseNs[phase], stack_clockNs(false), false}
+#else
+    #define STACK_STATS_OP_SCOPE(this_, op)       {}
+    #define STACK_STATS_PHASE_SCOPE(this_, phase) {}
+#endif
+
 /**
  * @fn STACK_RECALCULATE_DATA_HASH(this_)
  * @brief recalculates data hash if defined `STACK_USE_DATA_HASH`
@@ -265,7 +813,7 @@ static bool ptrValid(const void* ptr);
  */
 #ifdef STACK_USE_DATA_HASH
     #define STACK_RECALCULATE_DATA_HASH(this_) {         \
-        this_->dataHash = stack_calculateDataHash(this_); \
+        this_->dataHash = GENERIC(stack_calculateDataHash)(this_); \
     }
 #else
     #define STACK_RECALCULATE_DATA_HASH(this_) {}
@@ -277,82 +825,806 @@ static bool ptrValid(const void* ptr);
 
 
 /**
- * @addtogroup Auxiliary_funcs
- * @{
- * @fn static size_t stack_expandFactorCalc(size_t capacity)
- * @brief calculates expanded capacity of the stack
- * @param capacity current capacity to expand from  
- * @return new capacity
+ * @fn static size_t stack_pageSize()
+ * @brief gets system page size once and caches it
+ * @return page size in bytes
  */
-static size_t GENERIC(stack_expandFactorCalc)(size_t capacity);
+static size_t stack_pageSize();
 
 
 /**
- * @fn static size_t stack_shrinkageFactorCalc(size_t capacity)
- * @brief calculates shrinked capacity of the stack
- * @param capacity current capacity to shrink from
- * @return new capacity
+ * @fn static void stack_cpuRelax()
+ * @brief hints cpu that the thread is spinning
  */
-static size_t GENERIC(stack_shrinkageFactorCalc)(size_t capacity);
+static void stack_cpuRelax();
 
 
 /**
- * @fn static size_t stack_allocated_size(size_t capacity)
- * @brief calculates allocated data size by the stacks capacity
- * @param capacity to get allocated size from
- * @return allocated size
- * @}
+ * @fn static void stack_ptrCacheInvalidate()
+ * @brief drops pages cached as mapped by `ptrValid` in all threads;
+ *        called on stack data reallocations and frees, call it after unmapping memory of own stacks
  */
-static size_t GENERIC(stack_allocated_size)(size_t capacity);
+static void stack_ptrCacheInvalidate();
 
 
-//===========================================
-// Stack structure
+#ifdef STACK_USE_PTR_CACHE
+/**
+ * @fn static bool stack_ptrCacheFind(size_t addr)
+ * @brief looks for the address in the cache of the calling thread
+ * @param addr address to look for
+ * @return `true` if page of the address is known to be mapped
+ */
+static bool stack_ptrCacheFind(size_t addr);
+
 
 /**
- * @addtogroup Stack_struct
- * @{
- * @stuct stack
- * @brief generalized stack structure with additional debug features
+ * @fn static void stack_ptrCacheAdd(size_t page)
+ * @brief remembers the page as mapped, extends an adjacent interval if there is one
+ * @param page address of the page start
  */
-struct GENERIC(stack)                
-{
-    /// @brief left canary array
-    #ifdef STACK_USE_CANARY
-        STACK_CANARY_TYPE leftCanary[STACK_CANARY_WRAPPER_LEN];
-    #endif
-    
-    /// @brief ptr to all allocated memory including capacity * sizeof(STACK_TYPE) of data and 2 data wrapper
-    STACK_CANARY_TYPE *dataWrapper;
-    /// @brief ptr to the stack data
-    STACK_TYPE *data;                                   //TODO use macro instead of `data`
-    /// @brief capacity of the stack
-    size_t capacity;
-    /// @brief current lenght of the stack
-    size_t len;
+static void stack_ptrCacheAdd(size_t page);
+#endif
 
-    /// @brief bitset of stack statuses
-    mutable stack_status status;
 
-    /// @brief outp stream for stack logging
-    FILE *logStream;                                    //TODO move logStream to static var
-    
-    /// @brief hash value of stack structure fields
-    #ifdef STACK_USE_STRUCT_HASH
-        uint64_t structHash;
-    #endif
+/**
+ * @addtogroup Allocators
+ * @{
+ * @fn static void *stack_mallocAlloc(void *ctx, size_t size)
+ * @brief default allocator over libc `calloc`, `realloc` and `free`
+ * @see stack_allocator
+ */
+static void *stack_mallocAlloc(void *ctx, size_t size);
+static void *stack_mallocRealloc(void *ctx, void *ptr, size_t size);
+static void  stack_mallocFree(void *ctx, void *ptr);
+#if defined(__GLIBC__) || defined(_WIN32)
+static size_t stack_mallocUsableSize(void *ctx, void *ptr);
+#endif
 
-    /// @brief hash value of bitewise stack data
-    #ifdef STACK_USE_DATA_HASH
-        uint64_t dataHash;
-    #endif
-    
-    /// @brief right canary array
-    #ifdef STACK_USE_CANARY
-        STACK_CANARY_TYPE rightCanary[STACK_CANARY_WRAPPER_LEN];
-    #endif
 
-} typedef GENERIC(stack);
+/**
+ * @fn static void *stack_arenaAlloc(void *ctx, size_t size)
+ * @brief per-thread arena allocator: blocks of power of two size classes are bumped from chunks
+ *        and reused through per-thread free lists without any locks; a block freed by another thread
+ *        joins the free list of that thread, chunks are never returned to the system
+ * @see stack_allocator
+ * @}
+ */
+static void *stack_arenaAlloc(void *ctx, size_t size);
+static void *stack_arenaRealloc(void *ctx, void *ptr, size_t size);
+static void  stack_arenaFree(void *ctx, void *ptr);
+static size_t stack_arenaUsableSize(void *ctx, void *ptr);
+
+
+#ifdef STACK_USE_FILE
+/**
+ * @fn static void *stack_fileAlloc(void *ctx, size_t size)
+ * @brief persistent allocator of a stack file: the only block is the data part of a `MAP_SHARED` mapping
+ *        of the whole file, the file is resized with `ftruncate` and remapped with `mremap`;
+ *        freeing unmaps the file and keeps it open, so the stack could be cleared
+ * @see stack_allocator
+ * @see stack_file
+ */
+static void *stack_fileAlloc(void *ctx, size_t size);
+static void *stack_fileRealloc(void *ctx, void *ptr, size_t size);
+static void  stack_fileFree(void *ctx, void *ptr);
+static size_t stack_fileUsableSize(void *ctx, void *ptr);
+#endif
+
+
+/**
+ * @fn static size_t stack_arenaClass(size_t size)
+ * @brief finds the least arena size class fitting `size` bytes and the header
+ * @param size size in bytes
+ * @return class index, `STACK_ARENA_CLASS_COUNT` if block is too big for the arena
+ */
+static size_t stack_arenaClass(size_t size);
+
+
+/**
+ * @fn static void *stack_storageAlloc(const stack_allocator *allocator, size_t size, size_t *mappedSize)
+ * @brief allocates storage for stack data with `allocator`, big storage is mmapped with `STACK_USE_MMAP`,
+ *        any storage is mmapped between two `PROT_NONE` pages with `STACK_USE_GUARD_PAGES`
+ * @param allocator backend for not mmapped storage
+ * @param size size in bytes
+ * @param mappedSize returns size of the mapping or 0 if storage is allocated by `allocator`
+ * @return ptr to the storage or NULL on failure
+ */
+static void *stack_storageAlloc(const stack_allocator *allocator, size_t size, size_t *mappedSize);
+
+
+/**
+ * @fn static void *stack_storageRealloc(const stack_allocator *allocator, void *storage, size_t *mappedSize, size_t oldSize, size_t newSize)
+ * @brief resizes storage; mappings are resized with `mremap` without copying,
+ *        storage is moved between allocator and mmap when it crosses `STACK_MMAP_THRESHOLD`
+ * @param allocator backend storage was allocated with
+ * @param storage storage to resize
+ * @param mappedSize size of the mapping or 0, updated on success
+ * @param oldSize size in use by the storage
+ * @param newSize new size in bytes
+ * @return ptr to resized storage or NULL on failure, then old storage is untouched
+ */
+static void *stack_storageRealloc(const stack_allocator *allocator, void *storage, size_t *mappedSize, size_t oldSize, size_t newSize);
+
+
+/**
+ * @fn static void stack_storageFree(const stack_allocator *allocator, void *storage, size_t mappedSize)
+ * @brief frees storage allocated with `stack_storageAlloc`
+ * @param allocator backend storage was allocated with
+ * @param storage storage to free
+ * @param mappedSize size of the mapping or 0
+ */
+static void stack_storageFree(const stack_allocator *allocator, void *storage, size_t mappedSize);
+
+
+#ifdef STACK_USE_FILE
+/**
+ * @fn static stack_file *stack_fileOpen(const char *path)
+ * @brief opens or creates stack file, doesn't map it yet
+ * @param path path to the file
+ * @return malloc'ed file with its persistent allocator or NULL on failure
+ */
+static stack_file *stack_fileOpen(const char *path);
+
+
+/**
+ * @fn static bool stack_fileMap(stack_file *file, size_t size)
+ * @brief resizes unmapped file and maps all of it
+ * @param file open file
+ * @param size size of the file in bytes including the header
+ * @return `false` on failure, then file stays unmapped
+ */
+static bool stack_fileMap(stack_file *file, size_t size);
+
+
+/**
+ * @fn static void stack_fileRelease(stack_file *file)
+ * @brief unmaps and closes file, frees `file`; the file on disk keeps its last commits
+ * @param file open file
+ */
+static void stack_fileRelease(stack_file *file);
+
+
+/**
+ * @fn static void stack_fileHeaderInit(stack_file *file, size_t elemSize, size_t wrapperSize)
+ * @brief writes header of a new file, both commit slots are empty
+ * @param file mapped file
+ * @param elemSize sizeof(STACK_TYPE)
+ * @param wrapperSize bytes of every data canary wrapper
+ */
+static void stack_fileHeaderInit(stack_file *file, size_t elemSize, size_t wrapperSize);
+
+
+/**
+ * @fn static bool stack_fileHeaderValid(const stack_file *file, size_t elemSize, size_t wrapperSize)
+ * @brief checks that mapped file is a stack file of the same elem size and data layout
+ * @param file mapped file
+ * @param elemSize sizeof(STACK_TYPE)
+ * @param wrapperSize bytes of every data canary wrapper
+ * @return `true` if data of the file could be adopted
+ */
+static bool stack_fileHeaderValid(const stack_file *file, size_t elemSize, size_t wrapperSize);
+
+
+/**
+ * @fn static uint32_t stack_fileCommitCrc(const stack_file_commit *commit)
+ * @brief checksum of all commit fields but `crc`
+ * @param commit commit slot
+ * @return crc32c
+ */
+static uint32_t stack_fileCommitCrc(const stack_file_commit *commit);
+
+
+/**
+ * @fn static bool stack_fileCommit(stack_file *file, const void *data, size_t len, size_t elemSize)
+ * @brief makes the first `len` elems durable: syncs the mapping, then writes block hashes into the older
+ *        commit slot and syncs the header; a crash at any point leaves one consistent commit
+ * @param file mapped file
+ * @param data stack data inside the mapping
+ * @param len elems to commit
+ * @param elemSize sizeof(STACK_TYPE)
+ * @return `false` if `msync` failed, then the previous commit stays the newest
+ */
+static bool stack_fileCommit(stack_file *file, const void *data, size_t len, size_t elemSize);
+
+
+/**
+ * @fn static size_t stack_fileVerifiedLen(const stack_file_commit *commit, const void *data, size_t capacity, size_t elemSize)
+ * @brief finds how many committed elems are still intact; elems below the first block with a wrong hash
+ *        are exactly the committed ones
+ * @param commit commit with a valid `crc`
+ * @param data stack data inside the mapping
+ * @param capacity elems the mapping holds
+ * @param elemSize sizeof(STACK_TYPE)
+ * @return len of the intact prefix of the commit
+ */
+static size_t stack_fileVerifiedLen(const stack_file_commit *commit, const void *data, size_t capacity, size_t elemSize);
+
+
+/**
+ * @fn static bool stack_fileRecover(stack_file *file, const void *data, size_t capacity, size_t elemSize, size_t *len)
+ * @brief picks the newest commit with a valid checksum, so a torn commit falls back to the previous one,
+ *        and cuts it to its intact prefix
+ * @param file mapped file
+ * @param data stack data inside the mapping
+ * @param capacity elems the mapping holds
+ * @param elemSize sizeof(STACK_TYPE)
+ * @param len returns len to reopen the stack with
+ * @return `false` if there is no valid commit, `true` and sets `*len` otherwise
+ */
+static bool stack_fileRecover(stack_file *file, const void *data, size_t capacity, size_t elemSize, size_t *len);
+#endif
+
+
+#ifdef STACK_USE_GUARD_PAGES
+/**
+ * @fn static void stack_guardSet(void *stack, char *leftGuard, char *rightGuard, void (*fault)(void *stack, int status))
+ * @brief adds stack to the guard page registry or updates its guards, installs SIGSEGV handler once
+ * @param stack stack to register
+ * @param leftGuard page right before the data
+ * @param rightGuard page right after the data
+ * @param fault marks the stack and dumps it when a guard page of the stack faults
+ */
+static void stack_guardSet(void *stack, char *leftGuard, char *rightGuard, void (*fault)(void *stack, int status));
+
+
+/**
+ * @fn static void stack_guardRemove(void *stack)
+ * @brief removes stack from the guard page registry
+ * @param stack stack to remove
+ */
+static void stack_guardRemove(void *stack);
+
+
+/**
+ * @fn static void stack_guardHandler(int sig, siginfo_t *info, void *context)
+ * @brief SIGSEGV handler, dumps a stack which guard page was hit, then lets the previous handler take the fault
+ */
+static void stack_guardHandler(int sig, siginfo_t *info, void *context);
+
+
+#endif
+
+
+#ifdef STACK_USE_ASYNC_CHECK
+/**
+ * @fn static bool stack_verifierStart(stack_verifier *verifier, uint64_t intervalNs)
+ * @brief starts background verifier thread
+ * @param verifier pointer to memory for the verifier, it must not move until stopped
+ * @param intervalNs pause between passes over watched stacks, bounds detection latency
+ * @return `true` on success
+ */
+static bool stack_verifierStart(stack_verifier *verifier, uint64_t intervalNs);
+
+
+/**
+ * @fn static void stack_verifierStop(stack_verifier *verifier)
+ * @brief stops and joins verifier thread, stacks must be unwatched before
+ * @param verifier pointer to verifier
+ */
+static void stack_verifierStop(stack_verifier *verifier);
+
+
+/**
+ * @fn static void *stack_verifierLoop(void *verifier)
+ * @brief body of verifier thread, verifies every watched stack once per interval
+ * @param verifier pointer to verifier
+ * @return NULL
+ */
+static void *stack_verifierLoop(void *verifier);
+
+
+/**
+ * @fn static stack_watch *stack_writeBegin(stack_watch *watch)
+ * @brief opens a write scope of the owner, makes version odd in the outermost one
+ * @param watch watch of the stack or NULL
+ * @return `watch`
+ */
+static stack_watch *stack_writeBegin(stack_watch *watch);
+
+
+/**
+ * @fn static void stack_writeEnd(stack_watch **watch)
+ * @brief closes a write scope of the owner, makes version even in the outermost one; cleanup of `STACK_WRITE_SCOPE`
+ * @param watch pointer to watch of the stack or to NULL
+ */
+static void stack_writeEnd(stack_watch **watch);
+
+
+/**
+ * @fn static void stack_watchWait(stack_watch *watch)
+ * @brief waits until the verifier stops reading stack memory, called inside a write scope before data is freed
+ * @param watch watch of the stack or NULL
+ */
+static void stack_watchWait(stack_watch *watch);
+#endif
+
+
+#ifdef STACK_USE_EVENT_LOG
+/**
+ * @fn static stack_event_ring *stack_eventRing()
+ * @brief gets ring of the calling thread, takes a released one or allocates a new one on the first call
+ * @return ring or NULL if allocation failed
+ */
+static stack_event_ring *stack_eventRing();
+
+
+/**
+ * @fn static void stack_eventRingKeyCreate()
+ * @brief creates thread specific key releasing rings of exiting threads, run once
+ */
+static void stack_eventRingKeyCreate();
+
+
+/**
+ * @fn static void stack_eventRingRelease(void *ring)
+ * @brief releases ring of an exiting thread for reuse, it is drained by flushers meanwhile
+ * @param ring ring of the thread
+ */
+static void stack_eventRingRelease(void *ring);
+
+
+/**
+ * @fn static void stack_eventLog(const void *stack, int status, size_t len, size_t capacity, const char *message, const char *func, const char *file, uint32_t line)
+ * @brief writes event to the ring of the calling thread without locks and I/O, drops it if the ring is full
+ * @param stack logged stack
+ * @param status `stack_status` bits
+ * @param len len of the stack
+ * @param capacity capacity of the stack
+ * @param message static c-style string
+ * @param func static name of the calling function
+ * @param file static name of the calling file
+ * @param line calling line
+ */
+static void stack_eventLog(const void *stack, int status, size_t len, size_t capacity, const char *message, const char *func, const char *file, uint32_t line);
+
+
+/**
+ * @fn static bool stack_eventFlusherStart(stack_event_flusher *flusher, FILE *out, uint64_t intervalNs)
+ * @brief opens binary event file in `out` and starts a thread draining rings into it
+ * @param flusher pointer to memory for the flusher, it must not move until stopped
+ * @param out binary stream, owned by the caller
+ * @param intervalNs pause between drains, 0 for no thread
+ * @return `true` on success
+ */
+static bool stack_eventFlusherStart(stack_event_flusher *flusher, FILE *out, uint64_t intervalNs);
+
+
+/**
+ * @fn static void stack_eventFlusherStop(stack_event_flusher *flusher)
+ * @brief stops and joins flusher thread, drains rings for the last time and flushes `out`
+ * @param flusher pointer to flusher
+ */
+static void stack_eventFlusherStop(stack_event_flusher *flusher);
+
+
+/**
+ * @fn static void *stack_eventFlusherLoop(void *flusher)
+ * @brief body of flusher thread
+ * @param flusher pointer to flusher
+ * @return NULL
+ */
+static void *stack_eventFlusherLoop(void *flusher);
+
+
+/**
+ * @fn static void stack_eventWriteString(stack_event_flusher *flusher, const char *string)
+ * @brief writes string record to the flusher file unless the string has already been written there
+ * @param flusher pointer to flusher
+ * @param string static c-style string or NULL
+ */
+static void stack_eventWriteString(stack_event_flusher *flusher, const char *string);
+
+
+/**
+ * @fn static size_t stack_eventFlush(stack_event_flusher *flusher)
+ * @brief drains rings of all threads into the flusher file, only one flusher drains at a time
+ * @param flusher pointer to flusher
+ * @return count of written events
+ */
+static size_t stack_eventFlush(stack_event_flusher *flusher);
+
+
+/**
+ * @fn static const char *stack_eventString(const uint64_t *keys, char * const *strings, size_t count, const void *key)
+ * @brief finds string of an event file by its key
+ * @param keys keys of decoded string records
+ * @param strings decoded strings
+ * @param count count of decoded strings
+ * @param key pointer stored in an event
+ * @return string or "?" if the file has no such string
+ */
+static const char *stack_eventString(const uint64_t *keys, char * const *strings, size_t count, const void *key);
+
+
+/**
+ * @fn static bool stack_eventDecode(FILE *in, FILE *out)
+ * @brief renders binary event file as text logs
+ * @param in binary event file
+ * @param out text stream
+ * @return `false` if `in` is not an event file or is truncated
+ */
+static bool stack_eventDecode(FILE *in, FILE *out);
+#endif
+
+
+/**
+ * @fn static void stack_statusToStream(int status, FILE *out)
+ * @brief prints description of every set `stack_status` bit
+ * @param status bitset of stack status
+ * @param out stream to print to
+ */
+static void stack_statusToStream(int status, FILE *out);
+
+
+#ifdef STACK_USE_STATS
+/**
+ * @fn static void stack_statsTimerEnd(stack_stats_timer *timer)
+ * @brief adds time elapsed since `timer->start` to its target; cleanup of `STACK_STATS_*_SCOPE`
+ * @param timer pointer to timer
+ */
+static void stack_statsTimerEnd(stack_stats_timer *timer);
+
+
+/**
+ * @fn static size_t stack_statsBucket(uint64_t ns)
+ * @brief gets latency histogram bucket of a duration
+ * @param ns duration
+ * @return bucket index
+ */
+static size_t stack_statsBucket(uint64_t ns);
+
+
+/**
+ * @fn static uint64_t stack_statsPercentile(const uint64_t *histogram, double q)
+ * @brief estimates a latency percentile from the histogram
+ * @param histogram latency histogram of `STACK_LATENCY_BUCKETS` buckets
+ * @param q percentile from 0 to 1
+ * @return upper bound of the bucket holding the percentile in ns, 0 for an empty histogram
+ */
+static uint64_t stack_statsPercentile(const uint64_t *histogram, double q);
+
+
+/**
+ * @fn static void stack_statsToStream(const stack_stats *stats, FILE *out)
+ * @brief prints counters, check phase times and latency percentiles
+ * @param stats pointer to stats
+ * @param out stream to print to
+ */
+static void stack_statsToStream(const stack_stats *stats, FILE *out);
+#endif
+
+
+#ifdef STACK_USE_GUARD_PAGES
+/**
+ * @fn static void stack_guardRegister(const stack *this_)
+ * @brief registers current guard pages of the stack
+ * @param this_ pointer to stack
+ */
+static void GENERIC(stack_guardRegister)(const GENERIC(stack) *this_);
+
+
+/**
+ * @fn static void stack_guardFault(void *stack, int status)
+ * @brief sets diagnosis of a guard page fault and dumps the stack
+ * @param stack faulted stack
+ * @param status `STACK_LEFT_DATA_CANARY_CORRUPT` or `STACK_RIGHT_DATA_CANARY_CORRUPT`
+ */
+static void GENERIC(stack_guardFault)(void *stack, int status);
+#endif
+
+
+#ifdef STACK_USE_ASYNC_CHECK
+/**
+ * @fn static stack_status stack_verifierWatch(stack *this_, stack_verifier *verifier, void (*callback)(void *stack, int status, void *ctx), void *ctx)
+ * @brief makes verifier check snapshots of the stack in background; called by the owner thread of the stack
+ * @param this_ pointer to stack
+ * @param verifier running verifier
+ * @param callback called from the verifier thread with found `stack_status` bits or NULL
+ * @param ctx passed to `callback`
+ * @return bitset of stack status, `STACK_BAD_MEM_ALLOC` if verifier is full
+ */
+static stack_status GENERIC(stack_verifierWatch)(GENERIC(stack) *this_, stack_verifier *verifier, void (*callback)(void *stack, int status, void *ctx), void *ctx);
+
+
+/**
+ * @fn static stack_status stack_verifierUnwatch(stack *this_, stack_verifier *verifier)
+ * @brief stops background checks of the stack, waits for the current pass; must be called before the stack memory is reused
+ * @param this_ pointer to stack
+ * @param verifier verifier the stack is watched by
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(stack_verifierUnwatch)(GENERIC(stack) *this_, stack_verifier *verifier);
+
+
+/**
+ * @fn static bool stack_verifySnapshot(void *stack, stack_watch *watch, int *status)
+ * @brief copies stack struct and data under the seqlock, then runs healthcheck on the private copy
+ * @param stack pointer to the watched stack
+ * @param watch watch of the stack
+ * @param status returns `stack_status` of the snapshot
+ * @return `false` if the stack was changed during copying and snapshot is dropped
+ */
+static bool GENERIC(stack_verifySnapshot)(void *stack, stack_watch *watch, int *status);
+#endif
+
+
+#ifdef STACK_USE_USABLE_SIZE
+/**
+ * @fn static size_t stack_storageUsableSize(const stack_allocator *allocator, void *storage, size_t mappedSize)
+ * @brief gets real size of the storage, it could be bigger than requested one
+ * @param allocator backend storage was allocated with
+ * @param storage storage allocated with `stack_storageAlloc`
+ * @param mappedSize size of the mapping or 0
+ * @return size in bytes or 0 if allocator doesn't know it
+ */
+static size_t stack_storageUsableSize(const stack_allocator *allocator, void *storage, size_t mappedSize);
+#endif
+
+
+/**
+ * @fn static uint64_t stack_clockNs(bool cpu)
+ * @brief reads current time
+ * @param cpu `true` for cpu time of the calling thread, `false` for monotonic time
+ * @return time in ns
+ */
+static uint64_t stack_clockNs(bool cpu);
+
+
+/**
+ * @fn static bool stack_checkDue(stack *this_)
+ * @brief advances the stack check policy by one operation and keeps struct hash of the cadence state,
+ * unless it was already stale
+ * @param this_ pointer to stack
+ * @return `true` if the operation should be checked
+ */
+static bool GENERIC(stack_checkDue)(GENERIC(stack) *this_);
+
+
+/**
+ * @fn static bool stack_checkCadence(stack *this_)
+ * @brief steps the cadence state of the policy mode
+ * @param this_ pointer to stack
+ * @return `true` if the operation should be checked
+ */
+static bool GENERIC(stack_checkCadence)(GENERIC(stack) *this_);
+
+
+/**
+ * @fn static uint64_t stack_checkClock(const stack *this_)
+ * @brief reads cpu time before a check if the policy accounts it
+ * @param this_ pointer to stack
+ * @return time in ns or 0
+ */
+static uint64_t GENERIC(stack_checkClock)(const GENERIC(stack) *this_);
+
+
+/**
+ * @fn static void stack_checkSpent(stack *this_, uint64_t start)
+ * @brief accounts cpu time spent by a check since `start` if the policy needs it
+ * @param this_ pointer to stack
+ * @param start value returned by `stack_checkClock` before the check
+ */
+static void GENERIC(stack_checkSpent)(GENERIC(stack) *this_, uint64_t start);
+
+
+/**
+ * @addtogroup Auxiliary_funcs
+ * @{
+ * @fn static size_t stack_expandFactorCalc(size_t capacity)
+ * @brief calculates expanded capacity of the stack according to `STACK_GROWTH_POLICY`
+ * @param capacity current capacity to expand from  
+ * @return new capacity
+ */
+static size_t GENERIC(stack_expandFactorCalc)(size_t capacity);
+
+
+/**
+ * @fn static size_t stack_shrinkageFactorCalc(size_t capacity)
+ * @brief calculates shrinked capacity of the stack, inverse of one `STACK_GROWTH_POLICY` step
+ * @param capacity current capacity to shrink from
+ * @return new capacity
+ */
+static size_t GENERIC(stack_shrinkageFactorCalc)(size_t capacity);
+
+
+/**
+ * @fn static size_t stack_capacityStep()
+ * @brief calculates least capacity step that keeps right data canary aligned
+ * @return step in elems
+ */
+static size_t GENERIC(stack_capacityStep)();
+
+
+/**
+ * @fn static size_t stack_alignCapacity(size_t capacity)
+ * @brief rounds capacity up, so that right data canary stays aligned; at least 1
+ * @param capacity requested capacity
+ * @return aligned capacity
+ */
+static size_t GENERIC(stack_alignCapacity)(size_t capacity);
+
+
+/**
+ * @fn static size_t stack_inlineCapacity()
+ * @brief calculates capacity of the inline storage, `STACK_INLINE_CAPACITY` rounded down to the capacity step
+ * @return capacity in elems
+ */
+static size_t GENERIC(stack_inlineCapacity)();
+
+
+/**
+ * @fn static size_t stack_allocated_size(size_t capacity)
+ * @brief calculates allocated data size by the stacks capacity
+ * @param capacity to get allocated size from
+ * @return allocated size
+ * @}
+ */
+static size_t GENERIC(stack_allocated_size)(size_t capacity);
+
+
+//===========================================
+// Stack structure
+
+/**
+ * @addtogroup Stack_struct
+ * @{
+ * @stuct stack
+ * @brief generalized stack structure with additional debug features
+ */
+struct GENERIC(stack)                
+{
+    /// @brief left canary array
+    #ifdef STACK_USE_CANARY
+        STACK_CANARY_TYPE leftCanary[STACK_CANARY_WRAPPER_LEN];
+    #endif
+    
+    /// @brief ptr to all allocated memory including capacity * sizeof(STACK_TYPE) of data and 2 data wrapper
+    STACK_CANARY_TYPE *dataWrapper;
+    /// @brief ptr to the stack data
+    STACK_TYPE *data;                                   //TODO use macro instead of `data`
+    /// @brief capacity of the stack
+    size_t capacity;
+    /// @brief current lenght of the stack
+    size_t len;
+    /// @brief size of the data mapping, 0 if data is malloc'ed or inline
+    size_t mappedSize;
+    /// @brief backend for malloc'ed data
+    const stack_allocator *allocator;
+    /// @brief capacity backed by memory, pages of mapped data above it were released with madvise
+    size_t residentCapacity;
+    /// @brief capacity allocated at once by the first push that overflows the inline storage, 0 if none
+    size_t deferredCapacity;
+    /// @brief number of data reallocations, views taken before the last one are invalid
+    size_t generation;
+
+    /// @brief bitset of stack statuses
+    mutable stack_status status;
+
+    /// @brief outp stream for stack logging
+    FILE *logStream;                                    //TODO move logStream to static var
+
+    /// @brief cadence of healthchecks run by operations
+    stack_check_policy checkPolicy;
+    /// @brief if healthchecks of the current operation are run
+    bool checkScheduled;
+    /// @brief operations left before the next check for `STACK_CHECK_EVERY_N`
+    size_t checkCountdown;
+    /// @brief xorshift state for `STACK_CHECK_SAMPLED`
+    uint64_t checkRandState;
+    /// @brief start of the current accounting window for `STACK_CHECK_BUDGET`
+    uint64_t checkWindowStart;
+    /// @brief cpu time spent in checks during the current window for `STACK_CHECK_BUDGET`
+    uint64_t checkWindowSpent;
+    
+    /// @brief hash value of stack structure fields
+    #ifdef STACK_USE_STRUCT_HASH
+        uint64_t structHash;
+    #endif
+
+    /// @brief crc32c of bitewise live stack data, updated incrementally by push and pop;
+    ///        xor of all block hashes in `STACK_USE_DATA_HASH_BLOCKS` mode
+    #ifdef STACK_USE_DATA_HASH
+        uint64_t dataHash;
+    #endif
+
+    /// @brief crc32c of the live part of every data block
+    #ifdef STACK_USE_DATA_HASH_BLOCKS
+        uint32_t *blockHashes;
+    #endif
+
+    /// @brief bitset of blocks that were changed or handed out since their last verification
+    #ifdef STACK_USE_DATA_HASH_BLOCKS
+        uint64_t *dirtyBlocks;
+    #endif
+
+    /// @brief next clean block to be verified by sampling
+    #ifdef STACK_USE_DATA_HASH_BLOCKS
+        mutable size_t sampleCursor;
+    #endif
+
+    /// @brief index of the first block that failed verification or STACK_SIZE_T_POISON
+    #ifdef STACK_USE_DATA_HASH_BLOCKS
+        mutable size_t badBlock;
+    #endif
+
+    /// @brief elems `[0, verifiedLen)` were verified by a healthcheck and weren't handed out since
+    #ifdef STACK_USE_DATA_HASH_WATERMARK
+        mutable size_t verifiedLen;
+    #endif
+
+    /// @brief crc32c of the verified prefix
+    #ifdef STACK_USE_DATA_HASH_WATERMARK
+        mutable uint64_t verifiedHash;
+    #endif
+
+    /// @brief elems of the verified prefix rehashed so far by the rotating rescan
+    #ifdef STACK_USE_DATA_HASH_WATERMARK
+        mutable size_t rescanLen;
+    #endif
+
+    /// @brief crc32c of the rescanned part of the prefix
+    #ifdef STACK_USE_DATA_HASH_WATERMARK
+        mutable uint64_t rescanHash;
+    #endif
+
+    /// @brief seqlock with the background verifier, NULL if the stack isn't watched
+    #ifdef STACK_USE_ASYNC_CHECK
+        stack_watch *watch;
+    #endif
+
+    /// @brief counters and latency histograms, not covered by the struct hash
+    #ifdef STACK_USE_STATS
+        mutable stack_stats stats;
+    #endif
+
+    /// @brief data wrapper for up to `STACK_INLINE_CAPACITY` elems used until the first heap allocation;
+    ///        placed last, so that overflow of inline data hits the right struct canary
+    STACK_CANARY_TYPE inlineWrapper[2 * STACK_DATA_WRAPPER_LEN + (STACK_INLINE_CAPACITY * sizeof(STACK_TYPE) + sizeof(STACK_CANARY_TYPE) - 1) / sizeof(STACK_CANARY_TYPE)
+                                    + (STACK_DATA_WRAPPER_LEN == 0 && STACK_INLINE_CAPACITY == 0)];        // no zero-length arrays
+    
+    /// @brief right canary array
+    #ifdef STACK_USE_CANARY
+        STACK_CANARY_TYPE rightCanary[STACK_CANARY_WRAPPER_LEN];
+    #endif
+
+} typedef GENERIC(stack);
+
+
+/**
+ * @stuct stack_view
+ * @brief read-only view of live elems `[begin, end)` checked by a single healthcheck when taken;
+ *        any reallocation of the data, clear and pops below `end` invalidate it
+ */
+struct GENERIC(stack_view)
+{
+    /// @brief bottom elem
+    const STACK_TYPE *begin;
+    /// @brief past the top elem
+    const STACK_TYPE *end;
+    /// @brief stack the view was taken from
+    const GENERIC(stack) *stack;
+    /// @brief generation of the stack data when the view was taken
+    size_t generation;
+} typedef GENERIC(stack_view);
+
+
+/**
+ * @fn STACK_VIEW_FOREACH(view, elem)
+ * @brief loops `elem` over pointers to elems of `view` from bottom to top; plain pointer loop, so it could be vectorized
+ * @param view stack_view
+ * @param elem name of the loop variable
+ */
+#define STACK_VIEW_FOREACH(view, elem) \
+    for (__typeof__((view).begin) elem = (view).begin; elem != (view).end; ++elem)
+
+/**
+ * @fn STACK_VIEW_FOREACH_REVERSE(view, elem)
+ * @brief loops `elem` over pointers to elems of `view` from top to bottom
+ * @param view stack_view
+ * @param elem name of the loop variable
+ */
+#define STACK_VIEW_FOREACH_REVERSE(view, elem) \
+    for (__typeof__((view).begin) elem = (view).end; elem != (view).begin && (--elem, true);)
 
 
 /**
@@ -364,6 +1636,110 @@ struct GENERIC(stack)
 static stack_status GENERIC(stack_ctor)(GENERIC(stack) *this_);
 
 
+/**
+ * @fn static stack_status stack_ctorCapacity(stack *this_, size_t capacity)
+ * @brief stack constructor with a capacity hint, so that the first `capacity` pushes don't reallocate
+ * @param this_ pointer to memory allocated for stack structure
+ * @param capacity initial capacity
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(stack_ctorCapacity)(GENERIC(stack) *this_, size_t capacity);
+
+
+/**
+ * @fn static stack_status stack_ctorAllocator(stack *this_, size_t capacity, const stack_allocator *allocator)
+ * @brief stack constructor with a capacity hint and a backend for data, e.g. `&STACK_ALLOCATOR_ARENA`;
+ *        allocator must outlive the stack, mmapped data ignores it; capacity that fits the inline storage
+ *        doesn't allocate, such stack must not be moved in memory
+ * @param this_ pointer to memory allocated for stack structure
+ * @param capacity initial capacity
+ * @param allocator backend for data or NULL for `STACK_ALLOCATOR_MALLOC`
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(stack_ctorAllocator)(GENERIC(stack) *this_, size_t capacity, const stack_allocator *allocator);
+
+
+/**
+ * @fn static stack_status stack_ctorDeferred(stack *this_, size_t capacity, const stack_allocator *allocator)
+ * @brief allocation-free stack constructor; data starts in the inline storage and storage for `capacity` elems
+ *        is allocated at once by the first push that doesn't fit it
+ * @param this_ pointer to memory allocated for stack structure
+ * @param capacity capacity to allocate on the first overflow of the inline storage
+ * @param allocator backend for data or NULL for `STACK_ALLOCATOR_MALLOC`
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(stack_ctorDeferred)(GENERIC(stack) *this_, size_t capacity, const stack_allocator *allocator);
+
+
+/**
+ * @fn static stack_status stack_ctorStorage(stack *this_, size_t capacity, const stack_allocator *allocator, bool deferred)
+ * @brief common part of the constructors, data is inline if `capacity` fits it or if allocation is `deferred`
+ * @see stack_ctorAllocator
+ * @see stack_ctorDeferred
+ */
+static stack_status GENERIC(stack_ctorStorage)(GENERIC(stack) *this_, size_t capacity, const stack_allocator *allocator, bool deferred);
+
+
+#ifdef STACK_USE_DATA_HASH_BLOCKS
+/**
+ * @fn static bool stack_resizeBlocks(stack *this_, size_t newCapacity)
+ * @brief resizes block hash tables for `newCapacity`, new blocks are empty; failed shrink leaves them just bigger than needed
+ * @param this_ pointer to stack
+ * @param newCapacity capacity the tables should cover
+ * @return `false` if the tables couldn't grow
+ */
+static bool GENERIC(stack_resizeBlocks)(GENERIC(stack) *this_, size_t newCapacity);
+#endif
+
+
+/**
+ * @fn static bool stack_isInline(const stack *this_)
+ * @brief checks if stack data is in the inline storage
+ * @param this_ pointer to stack
+ * @return `true` if data is inline
+ */
+static bool GENERIC(stack_isInline)(const GENERIC(stack) *this_);
+
+
+/**
+ * @fn static stack_status stack_reserve(stack *this_, size_t capacity)
+ * @brief grows stack capacity to at least `capacity` with a single reallocation; never shrinks
+ * @param this_ pointer to stack
+ * @param capacity required capacity
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(stack_reserve)(GENERIC(stack) *this_, size_t capacity);
+
+
+/**
+ * @fn static stack_status stack_trim(stack *this_)
+ * @brief returns memory above the current len to the system, meant to be called when stack is idle;
+ *        mapped data keeps its capacity and only releases pages, malloc'ed data is shrinked to fit
+ * @param this_ pointer to stack
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(stack_trim)(GENERIC(stack) *this_);
+
+
+/**
+ * @fn static stack_status stack_shrinkToFit(stack *this_)
+ * @brief shrinks stack capacity to its len
+ * @param this_ pointer to stack
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(stack_shrinkToFit)(GENERIC(stack) *this_);
+
+
+/**
+ * @fn static stack_status stack_setCheckPolicy(stack *this_, stack_check_policy policy)
+ * @brief sets cadence of healthchecks run by push, pop, top and get
+ * @param this_ pointer to stack
+ * @param policy new policy
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(stack_setCheckPolicy)(GENERIC(stack) *this_, stack_check_policy policy);
+
+
 /**
  * @fn static stack_status stack_dtor(stack *this_)
  * @brief stack destructor
@@ -380,7 +1756,7 @@ static stack_status GENERIC(stack_dtor)(GENERIC(stack) *this_);
  * @param item elem to be pushed
  * @return bitset of stack status
  */
-static stack_status GENERIC(stack_push)(GENERIC(stack) *this_, STACK_TYPE item);
+static inline stack_status GENERIC(stack_push)(GENERIC(stack) *this_, STACK_TYPE item);
 
 
 /**
@@ -390,7 +1766,42 @@ static stack_status GENERIC(stack_push)(GENERIC(stack) *this_, STACK_TYPE item);
  * @param item pointer to var to write to or NULL if value should be discarded
  * @return bitset of stack status
  */
-static stack_status GENERIC(stack_pop) (GENERIC(stack) *this_, STACK_TYPE *item);
+static inline stack_status GENERIC(stack_pop) (GENERIC(stack) *this_, STACK_TYPE *item);
+
+
+/**
+ * @fn static stack_status stack_pushN(stack *this_, const STACK_TYPE *items, size_t count)
+ * @brief pushes `count` elems of `items` into stack with a single reallocation and hash update;
+ * `items[0]` is pushed first
+ * @param items pointer to array of elems to be pushed, could point into the live elems of the stack itself
+ * @param items pointer to array of elems to be pushed
+ * @param count number of elems
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(stack_pushN)(GENERIC(stack) *this_, const STACK_TYPE *items, size_t count);
+
+
+/**
+ * @fn static stack_status stack_popN(stack *this_, STACK_TYPE *items, size_t count, size_t *popped)
+ * @brief pops up to `count` top elems from stack with a single copy and hash update;
+ * elems are written in stack order, so the former top elem is the last one
+ * @param this_ pointer to stack
+ * @param items pointer to array of at least `count` elems to write to or NULL if values should be discarded
+ * @param count max number of elems to pop
+ * @param popped pointer to var for the number of popped elems or NULL
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(stack_popN)(GENERIC(stack) *this_, STACK_TYPE *items, size_t count, size_t *popped);
+
+
+/**
+ * @fn static stack_status stack_dropN(stack *this_, size_t count)
+ * @brief discards up to `count` top elems
+ * @param this_ pointer to stack
+ * @param count max number of elems to discard
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(stack_dropN)(GENERIC(stack) *this_, size_t count);
 
 
 /**
@@ -414,6 +1825,25 @@ static stack_status GENERIC(stack_top) (GENERIC(stack) *this_, STACK_TYPE **item
 static stack_status GENERIC(stack_get) (GENERIC(stack) *this_, size_t pos, STACK_TYPE **item);
 
 
+/**
+ * @fn static stack_status stack_getView(stack *this_, stack_view *view)
+ * @brief runs a single healthcheck and gives view of all live elems, scans over it cost no more checks
+ * @param this_ pointer to stack
+ * @param view pointer to view to fill, it is empty and invalid if the check fails
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(stack_getView)(GENERIC(stack) *this_, GENERIC(stack_view) *view);
+
+
+/**
+ * @fn static bool stack_viewValid(const stack_view *view)
+ * @brief checks that the stack hasn't reallocated, been cleared or popped below the view end since the view was taken
+ * @param view pointer to view
+ * @return `true` if elems of the view could still be read
+ */
+static bool GENERIC(stack_viewValid)(const GENERIC(stack_view) *view);
+
+
 /**
  * @fn static stack_status stack_healthCheck(stack *this_)
  * @brief checks stacks state and logs every problem
@@ -445,6 +1875,43 @@ static stack_status GENERIC(stack_dump)(const GENERIC(stack) *this_);
 static stack_status GENERIC(stack_clear)(const GENERIC(stack) *this_);
 
 
+#ifdef STACK_USE_FILE
+/**
+ * @fn static stack_status stack_open(stack *this_, const char *path, size_t capacity)
+ * @brief stack constructor over a file mapped with `MAP_SHARED`; a new file is created with `capacity`,
+ *        an existing one is adopted without reading it: the stack reopens with the last synced len,
+ *        rolled back to the longest intact prefix if committed elems were overwritten or torn;
+ *        free elems are poisoned again and the stack is healthchecked; destroy it with `stack_close`
+ * @param this_ pointer to memory allocated for stack structure
+ * @param path path to the file
+ * @param capacity initial capacity of a new file, ignored for an existing one
+ * @return bitset of stack status, `STACK_BAD_MEM_ALLOC` if the file couldn't be opened or mapped,
+ *         `STACK_DATA_INTEGRITY_VIOLATED` if it isn't a stack file of this type or has no valid commit
+ */
+static stack_status GENERIC(stack_open)(GENERIC(stack) *this_, const char *path, size_t capacity);
+
+
+/**
+ * @fn static stack_status stack_sync(stack *this_)
+ * @brief healthchecks stack and commits its len and data to the file, so reopen after a crash restores them;
+ *        costs `msync` of dirty pages and crc32c of the live data; does nothing for stacks not backed by a file
+ * @param this_ pointer to stack
+ * @return bitset of stack status, additionally `STACK_BAD_MEM_ALLOC` if the file couldn't be synced;
+ *         corrupt stack isn't committed
+ */
+static stack_status GENERIC(stack_sync)(GENERIC(stack) *this_);
+
+
+/**
+ * @fn static stack_status stack_close(stack *this_)
+ * @brief syncs file-backed stack and destroys it, the file keeps the data
+ * @param this_ pointer to stack opened with `stack_open`
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(stack_close)(GENERIC(stack) *this_);
+#endif
+
+
 /**
  * @fn static stack_status stack_dumpToStream(const stack *this_, FILE *out)
  * @brief dumps stack structure and data into `out`
@@ -455,12 +1922,80 @@ static stack_status GENERIC(stack_clear)(const GENERIC(stack) *this_);
 static stack_status GENERIC(stack_dumpToStream)(const GENERIC(stack) *this_, FILE *out);
 
 
+#ifndef STACK_USE_EVENT_LOG
 /**
- * @fn static stack_status stack_reallocate(stack *this_, const size_t newCapacity)
- * @brief reallocates memory for stack data
+ * @fn static void stack_log(const stack *this_, FILE *out, const char *message, const char *func, int line, const char *file)
+ * @brief logs message, the place it was logged from and stack dump to `out`, body of `STACK_LOG_TO_STREAM`
+ * @param this_ pointer to stack
+ * @param out stream for logs
+ * @param message c-style string to log
+ * @param func, line, file place of the log
+ */
+STACK_COLD
+static void GENERIC(stack_log)(const GENERIC(stack) *this_, FILE *out, const char *message, const char *func, int line, const char *file);
+#endif
+
+
+#ifdef STACK_USE_STATS
+/**
+ * @fn static stack_status stack_statsSnapshot(const stack *this_, stack_stats *stats)
+ * @brief copies counters and histograms of the stack
+ * @param this_ pointer to stack
+ * @param stats pointer to copy to
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(stack_statsSnapshot)(const GENERIC(stack) *this_, stack_stats *stats);
+
+
+/**
+ * @fn static stack_status stack_statsReset(stack *this_)
+ * @brief zeroes counters and histograms, peaks start from the current len and capacity
+ * @param this_ pointer to stack
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(stack_statsReset)(GENERIC(stack) *this_);
+#endif
+
+
+/**
+ * @fn static stack_status stack_release(stack *this_, size_t capacity)
+ * @brief releases memory of elems above capacity, with madvise if data is mapped and not poisoned, with realloc otherwise
+ * @param this_ pointer to stack
+ * @param capacity capacity that stays resident, at least len
+ * @return bitset of stack status
+ */
+static stack_status GENERIC(stack_release)(GENERIC(stack) *this_, size_t capacity);
+
+
+#ifdef AUTO_SHRINK
+/**
+ * @fn static void stack_autoShrink(stack *this_)
+ * @brief releases half of the resident capacity once len drops to a quarter of it (for x2 growth),
+ *        so there are at least as many ops between two releases as elems released
+ * @param this_ pointer to stack
+ */
+static void GENERIC(stack_autoShrink)(GENERIC(stack) *this_);
+#endif
+
+
+/**
+ * @fn static stack_status stack_reallocate(stack *this_, size_t newCapacity)
+ * @brief reallocates memory for stack data; with `STACK_GROWTH_USABLE_SIZE` growing capacity could exceed `newCapacity`;
+ *        data moves out of the inline storage on growth and back into it on shrink to the inline capacity
  * @param this_ pointer to stack
  * @param newCapacity new capacity to reallocate to
  * @return bitset of stack status
  */
-static stack_status GENERIC(stack_reallocate)(GENERIC(stack) *this_, const size_t newCapacity);
+static stack_status GENERIC(stack_reallocate)(GENERIC(stack) *this_, size_t newCapacity);
+
+
+/**
+ * @fn static stack_status stack_grow(stack *this_, size_t required)
+ * @brief grows capacity by the growth policy till it fits `required` elems, out of line so push stays small
+ * @param this_ pointer to stack
+ * @param required number of elems that must fit
+ * @return bitset of stack status
+ */
+STACK_COLD
+static stack_status GENERIC(stack_grow)(GENERIC(stack) *this_, size_t required);
 
@@ -7,6 +7,67 @@
 #ifndef STACK_FUNC_GUARD
 #define STACK_FUNC_GUARD
 
+static uint64_t STACK_PTR_CACHE_EPOCH = 0;              /// bumped when any stack data could get unmapped
+
+#ifdef STACK_USE_PTR_CACHE
+    static thread_local stack_ptr_cache STACK_PTR_CACHE = {};
+
+
+    static bool stack_ptrCacheFind(size_t addr)
+    {
+        uint64_t epoch = __atomic_load_n(&STACK_PTR_CACHE_EPOCH, __ATOMIC_ACQUIRE);
+        if (STACK_PTR_CACHE.epoch != epoch) {
+            STACK_PTR_CACHE.epoch = epoch;
+            STACK_PTR_CACHE.count = 0;
+            STACK_PTR_CACHE.next  = 0;
+            return false;
+        }
+
+        for (size_t i = 0; i < STACK_PTR_CACHE.count; ++i) {
+            if (STACK_PTR_CACHE.begin[i] <= addr && addr < STACK_PTR_CACHE.end[i])
+                return true;
+        }
+
+        return false;
+    }
+
+
+    static void stack_ptrCacheAdd(size_t page)
+    {
+        size_t pageEnd = page + stack_pageSize();
+
+        for (size_t i = 0; i < STACK_PTR_CACHE.count; ++i) {
+            if (STACK_PTR_CACHE.end[i] == page) {
+                STACK_PTR_CACHE.end[i] = pageEnd;
+                return;
+            }
+            if (STACK_PTR_CACHE.begin[i] == pageEnd) {
+                STACK_PTR_CACHE.begin[i] = page;
+                return;
+            }
+        }
+
+        size_t i = STACK_PTR_CACHE.count;
+        if (STACK_PTR_CACHE.count < STACK_PTR_CACHE_SIZE) {
+            STACK_PTR_CACHE.count++;
+        }
+        else {
+            i = STACK_PTR_CACHE.next;
+            STACK_PTR_CACHE.next = (STACK_PTR_CACHE.next + 1) % STACK_PTR_CACHE_SIZE;
+        }
+
+        STACK_PTR_CACHE.begin[i] = page;
+        STACK_PTR_CACHE.end[i]   = pageEnd;
+    }
+#endif
+
+
+static void stack_ptrCacheInvalidate()
+{
+    __atomic_add_fetch(&STACK_PTR_CACHE_EPOCH, 1, __ATOMIC_RELEASE);
+}
+
+
 static bool ptrValid(const void* ptr)         
 {
     if (ptr == NULL) {
@@ -21,9 +82,16 @@ static bool ptrValid(const void* ptr)
     
     #ifdef STACK_USE_PTR_SYS_CHECK
         #ifdef __unix__
-            size_t page_size = sysconf(_SC_PAGESIZE);
+            if (stack_ptrCacheFind((size_t)ptr))
+                return true;
+
+            size_t page_size = stack_pageSize();
             void *base = (void *)((((size_t)ptr) / page_size) * page_size);
-            return msync(base, page_size, MS_ASYNC) == 0;
+            if (msync(base, page_size, MS_ASYNC) != 0)
+                return false;
+
+            stack_ptrCacheAdd((size_t)base);
+            return true;
          #else 
             #ifdef _WIN32
                 MEMORY_BASIC_INFORMATION mbi = {};
@@ -60,371 +128,2786 @@ static bool ptrValid(const void* ptr)
     }
 #endif
 
-#endif /* STACK_FUNC_GUARD */
-
 
 #ifdef STACK_USE_POISON
-    static bool GENERIC(stack_isPoisoned)(const STACK_TYPE *elem)                       
+    static size_t stack_findNotPoisonedScalar(const void *buf, size_t size, char poison)
     {
-        assert(ptrValid(elem));
-        return !memcmp(elem, &STACK_REFERENCE_POISONED_ELEM, sizeof(STACK_TYPE));
+        const char *begin = (const char*)buf;
+        size_t i = 0;
+
+        uint64_t ref = 0;
+        memset(&ref, poison, sizeof(uint64_t));
+
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+            uint64_t word = 0;
+            memcpy(&word, begin + i, sizeof(uint64_t));
+            if (word != ref)
+                break;
+        }
+        for (; i < size; ++i) {
+            if (begin[i] != poison)
+                return i;
+        }
+
+        return size;
     }
-#endif
 
 
-#ifdef STACK_USE_CAPACITY_SYS_CHECK
-    static size_t GENERIC(stack_getRealCapacity)(void *ptr) 
+    #ifdef __x86_64__
+    static size_t stack_findNotPoisonedSse2(const void *buf, size_t size, char poison)
     {
-        if (!ptrValid(ptr)) {
-            fprintf(stderr, "WARNING: getRealCapacity got a bad pointer!\n");
-            return STACK_SIZE_T_POISON;
+        const char *begin = (const char*)buf;
+        const __m128i ref = _mm_set1_epi8(poison);
+        size_t i = 0;
+
+        for (; i + 4 * sizeof(__m128i) <= size; i += 4 * sizeof(__m128i)) {       // fast path for long runs of poison
+            __m128i eq = _mm_and_si128(
+                _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(begin + i)),                       ref),
+                              _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(begin + i +     sizeof(__m128i))), ref)),
+                _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(begin + i + 2 * sizeof(__m128i))), ref),
+                              _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(begin + i + 3 * sizeof(__m128i))), ref)));
+            if (_mm_movemask_epi8(eq) != 0xFFFF)
+                break;
+        }
+        for (; i + sizeof(__m128i) <= size; i += sizeof(__m128i)) {
+            unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(begin + i)), ref));
+            if (mask != 0xFFFF)
+                return i + __builtin_ctz(~mask);
         }
-        size_t allocatedSize = 0;
+
+        return i + stack_findNotPoisonedScalar(begin + i, size - i, poison);
+    }
+
+
+    __attribute__((target("avx2")))
+    static size_t stack_findNotPoisonedAvx2(const void *buf, size_t size, char poison)
+    {
+        const char *begin = (const char*)buf;
+        const __m256i ref = _mm256_set1_epi8(poison);
+        size_t i = 0;
+
+        for (; i + 4 * sizeof(__m256i) <= size; i += 4 * sizeof(__m256i)) {       // fast path for long runs of poison
+            __m256i eq = _mm256_and_si256(
+                _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(begin + i)),                       ref),
+                                 _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(begin + i +     sizeof(__m256i))), ref)),
+                _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(begin + i + 2 * sizeof(__m256i))), ref),
+                                 _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(begin + i + 3 * sizeof(__m256i))), ref)));
+            if ((unsigned)_mm256_movemask_epi8(eq) != 0xFFFFFFFF)
+                break;
+        }
+        for (; i + sizeof(__m256i) <= size; i += sizeof(__m256i)) {
+            unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(begin + i)), ref));
+            if (mask != 0xFFFFFFFF)
+                return i + __builtin_ctz(~mask);
+        }
+
+        return i + stack_findNotPoisonedSse2(begin + i, size - i, poison);
+    }
+    #endif
+
+
+    static size_t stack_findNotPoisonedResolve(const void *buf, size_t size, char poison);
+
+    static size_t (*STACK_POISON_SCAN_KERNEL)(const void*, size_t, char) = stack_findNotPoisonedResolve;     /// kernel chosen by dispatcher
+
+    static size_t stack_findNotPoisonedResolve(const void *buf, size_t size, char poison)
+    {
+        size_t (*kernel)(const void*, size_t, char) = stack_findNotPoisonedScalar;
+
+        #ifdef __x86_64__
+            __builtin_cpu_init();
+            kernel = __builtin_cpu_supports("avx2") ? stack_findNotPoisonedAvx2 : stack_findNotPoisonedSse2;
+        #endif
+
+        __atomic_store_n(&STACK_POISON_SCAN_KERNEL, kernel, __ATOMIC_RELEASE);
+        return kernel(buf, size, poison);
+    }
+
+
+    static size_t stack_findNotPoisoned(const void *buf, size_t size, char poison)
+    {
+        return __atomic_load_n(&STACK_POISON_SCAN_KERNEL, __ATOMIC_ACQUIRE)(buf, size, poison);
+    }
+#endif
+
+
+static size_t stack_pageSize()
+{
+    static size_t pageSize = 0;
+
+    if (pageSize == 0) {
         #ifdef __unix__
-            allocatedSize = malloc_usable_size(ptr);
+            pageSize = sysconf(_SC_PAGESIZE);
         #else
-            #ifdef _WIN32
-                allocatedSize = _msize(ptr); 
-            #else
-                fprintf(stderr, "WARNING: your OS is unsupported, real capacity check is skipped!\n");
-                return STACK_SIZE_T_POISON;              
-            #endif
+            pageSize = 4096;
         #endif
+    }
+
+    return pageSize;
+}
+
+
+static void stack_cpuRelax()
+{
+    #ifdef __x86_64__
+        _mm_pause();
+    #elif defined(__aarch64__)
+        __asm__ __volatile__("yield");
+    #endif
+}
+
+
+static void *stack_mallocAlloc(void *ctx, size_t size)
+{
+    (void)ctx;
+    return calloc(size, sizeof(char));
+}
+
+
+static void *stack_mallocRealloc(void *ctx, void *ptr, size_t size)
+{
+    (void)ctx;
+    return realloc(ptr, size);
+}
+
 
-        return (allocatedSize - 2 * STACK_CANARY_WRAPPER_LEN * sizeof(STACK_CANARY_TYPE)) / sizeof(STACK_TYPE);
+static void stack_mallocFree(void *ctx, void *ptr)
+{
+    (void)ctx;
+    free(ptr);
+}
+
+
+#if defined(__GLIBC__) || defined(_WIN32)
+    static size_t stack_mallocUsableSize(void *ctx, void *ptr)
+    {
+        (void)ctx;
+        #ifdef _WIN32
+            return _msize(ptr);
+        #else
+            return malloc_usable_size(ptr);
+        #endif
     }
 #endif
 
 
-//===========================================
-// Auxiliary stack functions
+static const stack_allocator STACK_ALLOCATOR_MALLOC = {            /// default allocator of stack data
+    stack_mallocAlloc,
+    stack_mallocRealloc,
+    stack_mallocFree,
+#if defined(__GLIBC__) || defined(_WIN32)
+    stack_mallocUsableSize,
+#else
+    NULL,
+#endif
+    NULL,
+    false
+};
 
 
-static size_t GENERIC(stack_expandFactorCalc)(size_t capacity)          
+static thread_local stack_arena STACK_ARENA = {};
+
+
+static size_t stack_arenaClass(size_t size)
 {
-    #ifdef STACK_USE_CANARY
-        if (capacity <= 1)
-            return 2 * sizeof(STACK_CANARY_TYPE);
+    if (size > STACK_ARENA_MIN_BLOCK << (STACK_ARENA_CLASS_COUNT - 1))
+        return STACK_ARENA_CLASS_COUNT;
 
-        size_t newCapacity = (((size_t)(capacity * STACK_EXPAND_FACTOR) - 1) / sizeof(STACK_CANARY_TYPE) + 1) * sizeof(STACK_CANARY_TYPE);        // formula for least denominator of sizeof(STACK_CANARY_TYPE), that is > new capacity
-        if (newCapacity <= capacity)
-            return capacity + 1;
-        return newCapacity;
-    #else
-        if (capacity <= 1)
-            return 2;
-        size_t newCapacity = capacity * STACK_EXPAND_FACTOR;
-        if (newCapacity <= capacity)
-            return capacity + 1;
-        return newCapacity;
-    #endif 
+    size += STACK_ARENA_HEADER_SIZE;
+    if (size <= STACK_ARENA_MIN_BLOCK)
+        return 0;
+
+    size_t cls = 64 - __builtin_clzll(size - 1) - __builtin_ctzll(STACK_ARENA_MIN_BLOCK);     // log2 of size rounded up to a power of two
+    return cls < STACK_ARENA_CLASS_COUNT ? cls : STACK_ARENA_CLASS_COUNT;
 }
 
 
-static size_t GENERIC(stack_shrinkageFactorCalc)(size_t capacity)
+static void *stack_arenaAlloc(void *ctx, size_t size)
 {
-    #ifdef STACK_USE_CANARY
-        if (capacity <= 1)          
-            return 2 * sizeof(STACK_CANARY_TYPE);
-        size_t newCapacity = (size_t)(capacity * STACK_SHRINKAGE_FACTOR) / sizeof(STACK_CANARY_TYPE) * sizeof(STACK_CANARY_TYPE);               // formula for greatest denominator of sizeof(STACK_CANARY_TYPE), that is < new capacity
-        if (newCapacity >= capacity)
-            return capacity - 1;
-        return newCapacity;
-    #else
-        if (capacity <= 1)
-            return 2;
-        size_t newCapacity = capacity * STACK_SHRINKAGE_FACTOR;
-        if (newCapacity >= capacity)
-            return capacity - 1;
-        return newCapacity;
-    #endif
+    (void)ctx;
+    size_t cls = stack_arenaClass(size);
+
+    if (cls == STACK_ARENA_CLASS_COUNT) {                               // [class][size][payload] straight from malloc
+        size_t *header = (size_t*)malloc(size + STACK_ARENA_HEADER_SIZE);
+        if (header == NULL)
+            return NULL;
+
+        header[0] = cls;
+        header[1] = size;
+        return (char*)header + STACK_ARENA_HEADER_SIZE;
+    }
+
+    void *block = STACK_ARENA.freeList[cls];
+    if (block != NULL) {                                                // header is kept from the first use
+        STACK_ARENA.freeList[cls] = *(void**)block;
+        return block;
+    }
+
+    size_t blockSize = STACK_ARENA_MIN_BLOCK << cls;
+    if ((size_t)(STACK_ARENA.bumpEnd - STACK_ARENA.bump) < blockSize) {    // the tail of the old chunk is abandoned
+        char *chunk = (char*)malloc(STACK_ARENA_CHUNK_SIZE);             // never freed, blocks could live in other threads
+        if (chunk == NULL)
+            return NULL;
+
+        STACK_ARENA.bump    = chunk;
+        STACK_ARENA.bumpEnd = chunk + STACK_ARENA_CHUNK_SIZE;
+    }
+
+    size_t *header = (size_t*)STACK_ARENA.bump;
+    STACK_ARENA.bump += blockSize;
+
+    header[0] = cls;
+    header[1] = blockSize - STACK_ARENA_HEADER_SIZE;
+    return (char*)header + STACK_ARENA_HEADER_SIZE;
 }
 
 
-static size_t GENERIC(stack_allocated_size)(size_t capacity) 
+static void *stack_arenaRealloc(void *ctx, void *ptr, size_t size)
 {
-    return (capacity * sizeof(STACK_TYPE) + 2 * STACK_CANARY_WRAPPER_LEN * sizeof(STACK_CANARY_TYPE));
+    if (ptr == NULL)
+        return stack_arenaAlloc(ctx, size);
+
+    size_t *header = (size_t*)((char*)ptr - STACK_ARENA_HEADER_SIZE);
+    size_t cls     = stack_arenaClass(size);
+
+    if (cls == header[0] && cls != STACK_ARENA_CLASS_COUNT)             // still the best class for the block
+        return ptr;
+
+    if (cls == STACK_ARENA_CLASS_COUNT && header[0] == STACK_ARENA_CLASS_COUNT) {
+        size_t *newHeader = (size_t*)realloc(header, size + STACK_ARENA_HEADER_SIZE);
+        if (newHeader == NULL)
+            return NULL;
+
+        newHeader[1] = size;
+        return (char*)newHeader + STACK_ARENA_HEADER_SIZE;
+    }
+
+    void *newPtr = stack_arenaAlloc(ctx, size);
+    if (newPtr == NULL)
+        return NULL;
+
+    memcpy(newPtr, ptr, fmin(header[1], size));
+    stack_arenaFree(ctx, ptr);
+    return newPtr;
 }
 
 
-//===========================================
-// Stack implementation
+static void stack_arenaFree(void *ctx, void *ptr)
+{
+    (void)ctx;
+    if (ptr == NULL)
+        return;
+
+    size_t *header = (size_t*)((char*)ptr - STACK_ARENA_HEADER_SIZE);
+    if (header[0] == STACK_ARENA_CLASS_COUNT) {
+        free(header);
+        return;
+    }
+
+    *(void**)ptr = STACK_ARENA.freeList[header[0]];
+    STACK_ARENA.freeList[header[0]] = ptr;
+}
 
 
-static stack_status GENERIC(stack_ctor)(GENERIC(stack) *this_)
+static size_t stack_arenaUsableSize(void *ctx, void *ptr)
 {
-    STACK_PTR_VALIDATE(this_);
+    (void)ctx;
+    return ((size_t*)((char*)ptr - STACK_ARENA_HEADER_SIZE))[1];
+}
 
-    this_->capacity = STACK_SIZE_T_POISON;
-    this_->len      = STACK_SIZE_T_POISON;
-    this_->logStream = stdout;          //TODO
-    
-    this_->dataWrapper = (STACK_CANARY_TYPE*)calloc(GENERIC(stack_allocated_size)(STACK_STARTING_CAPACITY), sizeof(char));
 
-    if (!this_->dataWrapper) {
-        #ifdef STACK_USE_PTR_POISON
-            this_->dataWrapper = (STACK_CANARY_TYPE*)STACK_DEAD_STRUCT_PTR;
-            this_->data        =  (STACK_TYPE*)STACK_DEAD_STRUCT_PTR;
-        #endif
+static const stack_allocator STACK_ALLOCATOR_ARENA = {             /// lock-free per-thread arena for many short-lived small stacks
+    stack_arenaAlloc,
+    stack_arenaRealloc,
+    stack_arenaFree,
+    stack_arenaUsableSize,
+    NULL,
+    false
+};
 
-        this_->status = STACK_BAD_MEM_ALLOC;
-        return this_->status;
+
+#ifdef STACK_USE_FILE
+    static void *stack_fileAlloc(void *ctx, size_t size)
+    {
+        stack_file *file = (stack_file*)ctx;
+        if (file->base != NULL)                                         // file holds a single block
+            return NULL;
+
+        if (!stack_fileMap(file, STACK_FILE_HEADER_SIZE + size))
+            return NULL;
+        return file->base + STACK_FILE_HEADER_SIZE;
     }
 
-    this_->data = (STACK_TYPE*)(this_->dataWrapper + STACK_CANARY_WRAPPER_LEN);
-    this_->capacity = STACK_STARTING_CAPACITY;
-    this_->len = 0;
-    this_->status = STACK_OK;
 
-    #ifdef STACK_USE_CANARY
-       for (size_t i = 0; i < STACK_CANARY_WRAPPER_LEN; ++i) {
-             LEFT_CANARY_WRAPPER[i] =  STACK_LEFT_CANARY_POISON;
-            RIGHT_CANARY_WRAPPER[i] = STACK_RIGHT_CANARY_POISON;
-            this_-> leftCanary[i]   =  STACK_LEFT_CANARY_POISON;
-            this_->rightCanary[i]   = STACK_RIGHT_CANARY_POISON;
+    static void *stack_fileRealloc(void *ctx, void *ptr, size_t size)
+    {
+        stack_file *file = (stack_file*)ctx;
+        size_t newSize = STACK_FILE_HEADER_SIZE + size;
+        (void)ptr;
+
+        if (newSize > file->size && ftruncate(file->fd, newSize) != 0)     // file grows before the mapping and shrinks after it
+            return NULL;
+
+        char *base = (char*)mremap(file->base, file->size, newSize, MREMAP_MAYMOVE);
+        bool  undo = base == MAP_FAILED && newSize > file->size;
+        bool  cut  = base != MAP_FAILED && newSize < file->size;
+        if ((undo || cut) && ftruncate(file->fd, undo ? file->size : newSize) != 0) {
+            // file left bigger than the mapping is harmless, reopen poisons its tail as free elems
         }
-    #endif  
+        if (base == MAP_FAILED)
+            return NULL;
 
-    #ifdef STACK_USE_POISON
-        memset((char*)(&STACK_REFERENCE_POISONED_ELEM), STACK_ELEM_POISON, sizeof(STACK_TYPE));
-        memset((char*)this_->data, STACK_ELEM_POISON, this_->capacity * sizeof(STACK_TYPE));
-    #endif
+        file->base = base;
+        file->size = newSize;
+        return base + STACK_FILE_HEADER_SIZE;
+    }
 
-    #ifdef STACK_USE_DATA_HASH
-        this_->dataHash = GENERIC(stack_calculateDataHash)(this_);
-    #endif
 
-    #ifdef STACK_USE_STRUCT_HASH
-        this_->structHash = GENERIC(stack_calculateStructHash)(this_);
-    #endif
+    static void stack_fileFree(void *ctx, void *ptr)
+    {
+        stack_file *file = (stack_file*)ctx;
+        (void)ptr;
 
-    return STACK_HEALTH_CHECK(this_);
-}   
+        munmap(file->base, file->size);
+        file->base = NULL;
+    }
 
 
-static stack_status GENERIC(stack_dtor)(GENERIC(stack) *this_)           
-{
-    STACK_PTR_VALIDATE(this_);          
+    static size_t stack_fileUsableSize(void *ctx, void *ptr)
+    {
+        (void)ptr;
+        return ((stack_file*)ctx)->size - STACK_FILE_HEADER_SIZE;
+    }
 
-    STACK_HEALTH_CHECK(this_);
 
-    #ifdef STACK_USE_CAPACITY_SYS_CHECK
-        size_t newCapacity = GENERIC(stack_getRealCapacity)(this_->dataWrapper);
-        if (newCapacity != STACK_SIZE_T_POISON)
-            this_->capacity = newCapacity;
-    #endif
+    static stack_file *stack_fileOpen(const char *path)
+    {
+        stack_file *file = (stack_file*)calloc(1, sizeof(stack_file));
+        if (file == NULL)
+            return NULL;
+
+        file->fd = open(path, O_RDWR | O_CREAT, 0644);
+        struct stat info = {};
+        if (file->fd < 0 || fstat(file->fd, &info) != 0) {
+            if (file->fd >= 0)
+                close(file->fd);
+            free(file);
+            return NULL;
+        }
 
-    #ifdef STACK_USE_POISON
-        memset((char*)this_->dataWrapper, STACK_FREED_POISON, GENERIC(stack_allocated_size)(this_->capacity));
-    #endif
+        file->base = NULL;
+        file->size = info.st_size;
+        file->slot = 0;
+        file->allocator = {stack_fileAlloc, stack_fileRealloc, stack_fileFree, stack_fileUsableSize, file, true};
+        return file;
+    }
 
 
-    this_->capacity = STACK_SIZE_T_POISON;
-    this_->len      = STACK_SIZE_T_POISON;
+    static bool stack_fileMap(stack_file *file, size_t size)
+    {
+        assert(ptrValid(file));
+        assert(file->base == NULL);
 
-    if (!ptrValid(this_->dataWrapper)) {
-        fprintf(this_->logStream, "ERROR: pointer to the data is invalid!\n");      //TODO think if dtor should be silent here too?
-        return STACK_BAD_DATA_PTR;
+        if (ftruncate(file->fd, size) != 0)
+            return false;
+
+        char *base = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+        if (base == MAP_FAILED)
+            return false;
+
+        file->base = base;
+        file->size = size;
+        return true;
     }
 
-    free(this_->dataWrapper);
-    
-    #ifdef STACK_USE_PTR_POISON
-        this_->dataWrapper = (STACK_CANARY_TYPE*)STACK_FREED_PTR;
-        this_->data        = (STACK_TYPE*)STACK_FREED_PTR;
+
+    static void stack_fileRelease(stack_file *file)
+    {
+        assert(ptrValid(file));
+
+        if (file->base != NULL)
+            munmap(file->base, file->size);
+        close(file->fd);
+        free(file);
+    }
+
+
+    static void stack_fileHeaderInit(stack_file *file, size_t elemSize, size_t wrapperSize)
+    {
+        stack_file_header *header = (stack_file_header*)file->base;
+
+        memset((char*)header, 0, sizeof(stack_file_header));
+        memcpy(header->magic, STACK_FILE_MAGIC, sizeof(STACK_FILE_MAGIC));
+        header->version     = STACK_FILE_VERSION;
+        header->elemSize    = elemSize;
+        header->wrapperSize = wrapperSize;
+        file->slot = 1;                                                 // the first commit goes to slot 0
+    }
+
+
+    static bool stack_fileHeaderValid(const stack_file *file, size_t elemSize, size_t wrapperSize)
+    {
+        if (file->size < STACK_FILE_HEADER_SIZE + 2 * wrapperSize)
+            return false;
+
+        const stack_file_header *header = (const stack_file_header*)file->base;
+        return memcmp(header->magic, STACK_FILE_MAGIC, sizeof(STACK_FILE_MAGIC)) == 0 && header->version == STACK_FILE_VERSION &&
+               header->elemSize == elemSize && header->wrapperSize == wrapperSize;
+    }
+
+
+    static uint32_t stack_fileCommitCrc(const stack_file_commit *commit)
+    {
+        return stack_crc32c(0, commit, offsetof(stack_file_commit, crc));
+    }
+
+
+    static bool stack_fileCommit(stack_file *file, const void *data, size_t len, size_t elemSize)
+    {
+        assert(ptrValid(file));
+
+        stack_file_header *header = (stack_file_header*)file->base;
+        stack_file_commit *newest = &header->commits[file->slot];
+        stack_file_commit  commit = {};
+
+        commit.sequence = newest->sequence + 1;
+        commit.len      = len;
+        commit.blockLen = len > STACK_FILE_COMMIT_BLOCKS ? (len + STACK_FILE_COMMIT_BLOCKS - 1) / STACK_FILE_COMMIT_BLOCKS : 1;
+        for (size_t begin = 0, block = 0; begin < len; begin += commit.blockLen, ++block) {
+            size_t end = begin + commit.blockLen < len ? begin + commit.blockLen : len;
+            commit.blockHashes[block] = stack_crc32c(0, (const char*)data + begin * elemSize, (end - begin) * elemSize);
+        }
+        commit.crc = stack_fileCommitCrc(&commit);
+
+        if (msync(file->base, file->size, MS_SYNC) != 0)               // data is durable before the commit refers to it
+            return false;
+
+        size_t slot = 1 - file->slot;
+        memcpy((char*)&header->commits[slot], &commit, sizeof(stack_file_commit));
+        if (msync(file->base, STACK_FILE_HEADER_SIZE, MS_SYNC) != 0)
+            return false;
+
+        file->slot = slot;
+        return true;
+    }
+
+
+    static size_t stack_fileVerifiedLen(const stack_file_commit *commit, const void *data, size_t capacity, size_t elemSize)
+    {
+        for (size_t begin = 0, block = 0; begin < commit->len; begin += commit->blockLen, ++block) {
+            size_t end = begin + commit->blockLen < commit->len ? begin + commit->blockLen : commit->len;
+            if (end > capacity || commit->blockHashes[block] != stack_crc32c(0, (const char*)data + begin * elemSize, (end - begin) * elemSize))
+                return begin;
+        }
+        return commit->len;
+    }
+
+
+    static bool stack_fileRecover(stack_file *file, const void *data, size_t capacity, size_t elemSize, size_t *len)
+    {
+        const stack_file_header *header = (const stack_file_header*)file->base;
+
+        bool found = false;
+        for (size_t slot = 0; slot < 2; ++slot) {                      // torn commit falls back to the previous one
+            const stack_file_commit *commit = &header->commits[slot];
+            if (commit->sequence == 0 || commit->blockLen == 0 || commit->crc != stack_fileCommitCrc(commit) ||
+                (commit->len + commit->blockLen - 1) / commit->blockLen > STACK_FILE_COMMIT_BLOCKS)
+                continue;
+
+            if (!found || commit->sequence > header->commits[file->slot].sequence)
+                file->slot = slot;
+            found = true;
+        }
+
+        if (found)                                                      // elems overwritten after the sync cut the commit
+            *len = stack_fileVerifiedLen(&header->commits[file->slot], data, capacity, elemSize);
+        return found;
+    }
+#endif
+
+
+#ifdef STACK_USE_MMAP
+    static void *stack_storageMap(size_t size, size_t *mappedSize)
+    {
+        size = (size + stack_pageSize() - 1) / stack_pageSize() * stack_pageSize();
+
+        void *storage = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (storage == MAP_FAILED)
+            return NULL;
+
+        #ifdef MADV_HUGEPAGE
+            if (size >= STACK_HUGEPAGE_THRESHOLD)
+                madvise(storage, size, MADV_HUGEPAGE);
+        #endif
+
+        *mappedSize = size;
+        return storage;
+    }
+#endif
+
+
+#ifdef STACK_USE_GUARD_PAGES
+    static stack_guard_entry STACK_GUARD_REGISTRY[STACK_GUARD_REGISTRY_SIZE] = {};
+    static bool              STACK_GUARD_REGISTRY_LOCK = false;
+    static bool              STACK_GUARD_HANDLER_INSTALLED = false;
+    static struct sigaction  STACK_GUARD_OLD_ACTION = {};
+
+
+    static void stack_guardHandler(int sig, siginfo_t *info, void *context)
+    {
+        char *addr = (char*)info->si_addr;
+
+        for (size_t i = 0; i < STACK_GUARD_REGISTRY_SIZE; ++i) {
+            void *stack = __atomic_load_n(&STACK_GUARD_REGISTRY[i].stack, __ATOMIC_ACQUIRE);
+            if (stack == NULL)
+                continue;
+
+            int status = STACK_OK;
+            if (addr >= STACK_GUARD_REGISTRY[i].leftGuard && addr < STACK_GUARD_REGISTRY[i].leftGuard + stack_pageSize())
+                status = STACK_LEFT_DATA_CANARY_CORRUPT;
+            if (addr >= STACK_GUARD_REGISTRY[i].rightGuard && addr < STACK_GUARD_REGISTRY[i].rightGuard + stack_pageSize())
+                status = STACK_RIGHT_DATA_CANARY_CORRUPT;
+
+            if (status != STACK_OK) {
+                STACK_GUARD_REGISTRY[i].fault(stack, status);
+                sigaction(SIGSEGV, &STACK_GUARD_OLD_ACTION, NULL);      // faulting store is retried and kills the process
+                return;
+            }
+        }
+
+        if (STACK_GUARD_OLD_ACTION.sa_flags & SA_SIGINFO) {            // not ours, chain to the previous handler
+            STACK_GUARD_OLD_ACTION.sa_sigaction(sig, info, context);
+        }
+        else if (STACK_GUARD_OLD_ACTION.sa_handler != SIG_DFL && STACK_GUARD_OLD_ACTION.sa_handler != SIG_IGN) {
+            STACK_GUARD_OLD_ACTION.sa_handler(sig);
+        }
+        else {
+            sigaction(SIGSEGV, &STACK_GUARD_OLD_ACTION, NULL);
+        }
+    }
+
+
+    static void stack_guardSet(void *stack, char *leftGuard, char *rightGuard, void (*fault)(void *stack, int status))
+    {
+        while (__atomic_test_and_set(&STACK_GUARD_REGISTRY_LOCK, __ATOMIC_ACQUIRE))
+            ;
+
+        if (!STACK_GUARD_HANDLER_INSTALLED) {
+            struct sigaction action = {};
+            action.sa_sigaction = stack_guardHandler;
+            action.sa_flags     = SA_SIGINFO | SA_ONSTACK;
+            sigemptyset(&action.sa_mask);
+            sigaction(SIGSEGV, &action, &STACK_GUARD_OLD_ACTION);
+            STACK_GUARD_HANDLER_INSTALLED = true;
+        }
+
+        stack_guard_entry *slot = NULL;
+        for (size_t i = 0; i < STACK_GUARD_REGISTRY_SIZE && slot == NULL; ++i) {
+            if (STACK_GUARD_REGISTRY[i].stack == stack)
+                slot = &STACK_GUARD_REGISTRY[i];
+        }
+        for (size_t i = 0; i < STACK_GUARD_REGISTRY_SIZE && slot == NULL; ++i) {
+            if (STACK_GUARD_REGISTRY[i].stack == NULL)
+                slot = &STACK_GUARD_REGISTRY[i];
+        }
+
+        if (slot != NULL) {                                             // stacks over the limit still fault, just without a dump
+            __atomic_store_n(&slot->stack, NULL, __ATOMIC_RELEASE);
+            slot->leftGuard  = leftGuard;
+            slot->rightGuard = rightGuard;
+            slot->fault      = fault;
+            __atomic_store_n(&slot->stack, stack, __ATOMIC_RELEASE);
+        }
+
+        __atomic_clear(&STACK_GUARD_REGISTRY_LOCK, __ATOMIC_RELEASE);
+    }
+
+
+    static void stack_guardRemove(void *stack)
+    {
+        while (__atomic_test_and_set(&STACK_GUARD_REGISTRY_LOCK, __ATOMIC_ACQUIRE))
+            ;
+
+        for (size_t i = 0; i < STACK_GUARD_REGISTRY_SIZE; ++i) {
+            if (STACK_GUARD_REGISTRY[i].stack == stack)
+                __atomic_store_n(&STACK_GUARD_REGISTRY[i].stack, NULL, __ATOMIC_RELEASE);
+        }
+
+        __atomic_clear(&STACK_GUARD_REGISTRY_LOCK, __ATOMIC_RELEASE);
+    }
+#endif
+
+
+static void *stack_storageAlloc(const stack_allocator *allocator, size_t size, size_t *mappedSize)
+{
+    *mappedSize = 0;
+
+    if (allocator->persistent)                                          // file mappings are placed by their allocator
+        return allocator->alloc(allocator->ctx, size);
+
+    #ifdef STACK_USE_GUARD_PAGES                                       // [PROT_NONE page][data][PROT_NONE page]
+        size_t page = stack_pageSize();
+        size = (size + page - 1) / page * page;
+
+        char *base = (char*)mmap(NULL, size + 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+            return NULL;
+
+        mprotect(base, page, PROT_NONE);
+        mprotect(base + page + size, page, PROT_NONE);
+
+        *mappedSize = size;
+        return base + page;
+    #endif
+
+    #ifdef STACK_USE_MMAP
+        if (size >= STACK_MMAP_THRESHOLD)
+            return stack_storageMap(size, mappedSize);
+    #endif
+
+    return allocator->alloc(allocator->ctx, size);
+}
+
+
+static void *stack_storageRealloc(const stack_allocator *allocator, void *storage, size_t *mappedSize, size_t oldSize, size_t newSize)
+{
+    stack_ptrCacheInvalidate();                                         // old pages could be unmapped by any branch
+
+    if (allocator->persistent)
+        return allocator->realloc(allocator->ctx, storage, newSize);
+
+    #ifdef STACK_USE_GUARD_PAGES
+        size_t page = stack_pageSize();
+        size_t newMappedSize = (newSize + page - 1) / page * page;
+        if (newMappedSize == *mappedSize)
+            return storage;
+
+        char *base = (char*)storage - page;
+        mprotect(base, *mappedSize + 2 * page, PROT_READ | PROT_WRITE);       // mremap needs a single mapping with the same protection
+
+        char *newBase = (char*)mremap(base, *mappedSize + 2 * page, newMappedSize + 2 * page, MREMAP_MAYMOVE);
+        if (newBase == MAP_FAILED) {
+            mprotect(base, page, PROT_NONE);
+            mprotect(base + page + *mappedSize, page, PROT_NONE);
+            return NULL;
+        }
+
+        mprotect(newBase, page, PROT_NONE);
+        mprotect(newBase + page + newMappedSize, page, PROT_NONE);
+
+        *mappedSize = newMappedSize;
+        (void)allocator;
+        (void)oldSize;
+        return newBase + page;
+    #endif
+
+    #ifdef STACK_USE_MMAP
+        if (*mappedSize == 0 && newSize >= STACK_MMAP_THRESHOLD) {                  // allocator -> mmap, the last copy
+            size_t newMappedSize = 0;
+            void *newStorage = stack_storageMap(newSize, &newMappedSize);
+            if (newStorage == NULL)
+                return NULL;
+
+            memcpy(newStorage, storage, fmin(oldSize, newSize));
+            allocator->free(allocator->ctx, storage);
+            *mappedSize = newMappedSize;
+            return newStorage;
+        }
+
+        if (*mappedSize != 0 && newSize < STACK_MMAP_THRESHOLD / 2) {               // mmap -> allocator, threshold / 2 avoids ping-pong
+            void *newStorage = allocator->alloc(allocator->ctx, newSize);
+            if (newStorage == NULL)
+                return NULL;
+
+            memcpy(newStorage, storage, fmin(oldSize, newSize));
+            munmap(storage, *mappedSize);
+            *mappedSize = 0;
+            return newStorage;
+        }
+
+        if (*mappedSize != 0) {                                                     // kernel moves page tables, data isn't copied
+            size_t newMappedSize = (newSize + stack_pageSize() - 1) / stack_pageSize() * stack_pageSize();
+            if (newMappedSize == *mappedSize)
+                return storage;
+
+            void *newStorage = mremap(storage, *mappedSize, newMappedSize, MREMAP_MAYMOVE);
+            if (newStorage == MAP_FAILED)
+                return NULL;
+
+            #ifdef MADV_HUGEPAGE
+                if (newMappedSize >= STACK_HUGEPAGE_THRESHOLD && *mappedSize < STACK_HUGEPAGE_THRESHOLD)
+                    madvise(newStorage, newMappedSize, MADV_HUGEPAGE);
+            #endif
+
+            *mappedSize = newMappedSize;
+            return newStorage;
+        }
+    #else
+        (void)mappedSize;
+        (void)oldSize;
+    #endif
+
+    return allocator->realloc(allocator->ctx, storage, newSize);
+}
+
+
+static void stack_storageFree(const stack_allocator *allocator, void *storage, size_t mappedSize)
+{
+    stack_ptrCacheInvalidate();
+
+    if (allocator->persistent) {
+        allocator->free(allocator->ctx, storage);
+        return;
+    }
+
+    #ifdef STACK_USE_GUARD_PAGES
+        munmap((char*)storage - stack_pageSize(), mappedSize + 2 * stack_pageSize());
+        (void)allocator;
+        return;
+    #endif
+
+    #ifdef STACK_USE_MMAP
+        if (mappedSize != 0) {
+            munmap(storage, mappedSize);
+            return;
+        }
+    #else
+        (void)mappedSize;
+    #endif
+
+    allocator->free(allocator->ctx, storage);
+}
+
+
+#ifdef STACK_USE_USABLE_SIZE
+    static size_t stack_storageUsableSize(const stack_allocator *allocator, void *storage, size_t mappedSize)
+    {
+        if (mappedSize != 0)
+            return mappedSize;
+
+        if (allocator->usableSize == NULL)
+            return 0;
+
+        return allocator->usableSize(allocator->ctx, storage);
+    }
+#endif
+
+
+static uint64_t stack_clockNs(bool cpu)
+{
+    #ifdef __unix__
+        struct timespec now = {};
+        clock_gettime(cpu ? CLOCK_THREAD_CPUTIME_ID : CLOCK_MONOTONIC, &now);
+        return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    #else
+        return (uint64_t)clock() * (1000000000 / CLOCKS_PER_SEC);
+    #endif
+}
+
+
+#ifdef STACK_USE_ASYNC_CHECK
+    static bool stack_verifierStart(stack_verifier *verifier, uint64_t intervalNs)
+    {
+        assert(ptrValid(verifier));
+
+        memset((char*)verifier, 0, sizeof(stack_verifier));
+        verifier->intervalNs = intervalNs;
+        verifier->running    = true;
+
+        if (pthread_mutex_init(&verifier->lock, NULL) != 0)
+            return false;
+        if (pthread_create(&verifier->thread, NULL, stack_verifierLoop, verifier) != 0) {
+            pthread_mutex_destroy(&verifier->lock);
+            return false;
+        }
+        return true;
+    }
+
+
+    static void stack_verifierStop(stack_verifier *verifier)
+    {
+        assert(ptrValid(verifier));
+
+        __atomic_store_n(&verifier->running, false, __ATOMIC_RELEASE);
+        pthread_join(verifier->thread, NULL);
+        pthread_mutex_destroy(&verifier->lock);
+    }
+
+
+    static void *stack_verifierLoop(void *arg)
+    {
+        stack_verifier *verifier = (stack_verifier*)arg;
+
+        while (__atomic_load_n(&verifier->running, __ATOMIC_ACQUIRE)) {
+            pthread_mutex_lock(&verifier->lock);
+            for (size_t i = 0; i < STACK_VERIFIER_CAPACITY; ++i) {
+                stack_watch *watch = &verifier->watches[i];
+                if (watch->stack == NULL)
+                    continue;
+
+                int status = 0;
+                if (!watch->verify(watch->stack, watch, &status)) {
+                    __atomic_add_fetch(&verifier->skips, 1, __ATOMIC_RELAXED);
+                    continue;
+                }
+                __atomic_add_fetch(&verifier->passes, 1, __ATOMIC_RELAXED);
+
+                if (status) {
+                    __atomic_or_fetch(&watch->status, status, __ATOMIC_RELAXED);
+                    if (watch->callback != NULL)
+                        watch->callback(watch->stack, status, watch->ctx);
+                }
+            }
+            pthread_mutex_unlock(&verifier->lock);
+
+            struct timespec pause = {(time_t)(verifier->intervalNs / 1000000000), (long)(verifier->intervalNs % 1000000000)};
+            nanosleep(&pause, NULL);
+        }
+
+        return NULL;
+    }
+
+
+    static stack_watch *stack_writeBegin(stack_watch *watch)
+    {
+        if (watch != NULL && watch->depth++ == 0) {
+            __atomic_store_n(&watch->version, watch->version + 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_RELEASE);                    // odd version is visible before any change
+        }
+        return watch;
+    }
+
+
+    static void stack_writeEnd(stack_watch **watch)
+    {
+        if (*watch != NULL && --(*watch)->depth == 0)
+            __atomic_store_n(&(*watch)->version, (*watch)->version + 1, __ATOMIC_RELEASE);
+    }
+
+
+    static void stack_watchWait(stack_watch *watch)
+    {
+        if (watch == NULL)
+            return;
+
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);                        // pairs with the verifier: either it sees odd version or we see it reading
+        while (__atomic_load_n(&watch->reading, __ATOMIC_ACQUIRE))
+            stack_cpuRelax();
+    }
+#endif
+
+
+#ifdef STACK_USE_EVENT_LOG
+    static stack_event_ring *STACK_EVENT_RINGS = NULL;                          /// list of rings of all threads that ever logged
+    static thread_local stack_event_ring *STACK_EVENT_LOCAL_RING = NULL;
+    static pthread_key_t   STACK_EVENT_RING_KEY;                                /// releases rings of exiting threads
+    static pthread_once_t  STACK_EVENT_RING_KEY_ONCE = PTHREAD_ONCE_INIT;
+    static pthread_mutex_t STACK_EVENT_DRAIN_LOCK    = PTHREAD_MUTEX_INITIALIZER;   /// rings have a single consumer
+
+
+    static void stack_eventRingKeyCreate()
+    {
+        pthread_key_create(&STACK_EVENT_RING_KEY, stack_eventRingRelease);
+    }
+
+
+    static stack_event_ring *stack_eventRing()
+    {
+        if (STACK_EVENT_LOCAL_RING != NULL)
+            return STACK_EVENT_LOCAL_RING;
+
+        stack_event_ring *ring = __atomic_load_n(&STACK_EVENT_RINGS, __ATOMIC_ACQUIRE);
+        for (; ring != NULL; ring = ring->next) {
+            int released = 0;
+            if (__atomic_compare_exchange_n(&ring->owned, &released, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                break;
+        }
+
+        if (ring == NULL) {
+            ring = (stack_event_ring*)aligned_alloc(alignof(stack_event_ring), sizeof(stack_event_ring));
+            if (ring == NULL)
+                return NULL;
+            memset((char*)ring, 0, sizeof(stack_event_ring));
+            ring->owned = 1;
+
+            ring->next = __atomic_load_n(&STACK_EVENT_RINGS, __ATOMIC_RELAXED);
+            while (!__atomic_compare_exchange_n(&STACK_EVENT_RINGS, &ring->next, ring, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+                ;
+        }
+
+        pthread_once(&STACK_EVENT_RING_KEY_ONCE, stack_eventRingKeyCreate);
+        pthread_setspecific(STACK_EVENT_RING_KEY, ring);
+        STACK_EVENT_LOCAL_RING = ring;
+        return ring;
+    }
+
+
+    static void stack_eventRingRelease(void *ring)
+    {
+        __atomic_store_n(&((stack_event_ring*)ring)->owned, 0, __ATOMIC_RELEASE);
+    }
+
+
+    static void stack_eventLog(const void *stack, int status, size_t len, size_t capacity, const char *message, const char *func, const char *file, uint32_t line)
+    {
+        stack_event_ring *ring = stack_eventRing();
+        if (ring == NULL)
+            return;
+
+        uint64_t head = ring->head;
+        if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == STACK_EVENT_RING_LEN) {
+            __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);     // never waits for the flusher
+            return;
+        }
+
+        stack_event *event = &ring->events[head & (STACK_EVENT_RING_LEN - 1)];
+        event->timeNs   = stack_clockNs(false);
+        event->stack    = stack;
+        event->message  = message;
+        event->func     = func;
+        event->file     = file;
+        event->len      = len;
+        event->capacity = capacity;
+        event->line     = line;
+        event->status   = status;
+
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    }
+
+
+    static bool stack_eventFlusherStart(stack_event_flusher *flusher, FILE *out, uint64_t intervalNs)
+    {
+        assert(ptrValid(flusher));
+        assert(ptrValid(out));
+
+        memset((char*)flusher, 0, sizeof(stack_event_flusher));
+        flusher->out        = out;
+        flusher->intervalNs = intervalNs;
+
+        if (fwrite(&STACK_EVENT_FILE_MAGIC, sizeof(STACK_EVENT_FILE_MAGIC), 1, out) != 1)
+            return false;
+
+        if (intervalNs == 0)
+            return true;
+
+        flusher->running = true;
+        if (pthread_create(&flusher->thread, NULL, stack_eventFlusherLoop, flusher) != 0) {
+            flusher->running = false;
+            return false;
+        }
+        return true;
+    }
+
+
+    static void stack_eventFlusherStop(stack_event_flusher *flusher)
+    {
+        assert(ptrValid(flusher));
+
+        if (flusher->intervalNs != 0 && __atomic_load_n(&flusher->running, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&flusher->running, false, __ATOMIC_RELAXED);
+            pthread_join(flusher->thread, NULL);
+        }
+        stack_eventFlush(flusher);
+        fflush(flusher->out);
+    }
+
+
+    static void *stack_eventFlusherLoop(void *flusher_)
+    {
+        stack_event_flusher *flusher = (stack_event_flusher*)flusher_;
+
+        while (__atomic_load_n(&flusher->running, __ATOMIC_RELAXED)) {
+            stack_eventFlush(flusher);
+
+            struct timespec pause = {(time_t)(flusher->intervalNs / 1000000000), (long)(flusher->intervalNs % 1000000000)};
+            nanosleep(&pause, NULL);
+        }
+
+        return NULL;
+    }
+
+
+    static void stack_eventWriteString(stack_event_flusher *flusher, const char *string)
+    {
+        if (string == NULL)                                             // NULL marks empty slots of the cache, its key needs no record
+            return;
+
+        size_t slot = ((uintptr_t)string >> 3) & (STACK_EVENT_STRING_CACHE - 1);
+        for (size_t probe = 0; probe < STACK_EVENT_STRING_CACHE; ++probe, slot = (slot + 1) & (STACK_EVENT_STRING_CACHE - 1)) {
+            if (flusher->strings[slot] == string)
+                return;
+            if (flusher->strings[slot] == NULL) {
+                flusher->strings[slot] = string;
+                break;
+            }
+        }                                                               // a full cache only makes strings written again
+
+        uint64_t record[3] = {STACK_EVENT_TAG_STRING, (uint64_t)(uintptr_t)string, strlen(string)};
+        fwrite(record, sizeof(record), 1, flusher->out);
+        fwrite(string, 1, record[2], flusher->out);
+    }
+
+
+    static size_t stack_eventFlush(stack_event_flusher *flusher)
+    {
+        assert(ptrValid(flusher));
+
+        size_t written = 0;
+        pthread_mutex_lock(&STACK_EVENT_DRAIN_LOCK);
+
+        for (stack_event_ring *ring = __atomic_load_n(&STACK_EVENT_RINGS, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+            uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+            for (uint64_t tail = ring->tail; tail != head; ++tail) {
+                stack_event event = ring->events[tail & (STACK_EVENT_RING_LEN - 1)];
+                stack_eventWriteString(flusher, event.message);
+                stack_eventWriteString(flusher, event.func);
+                stack_eventWriteString(flusher, event.file);
+
+                uint64_t tag = STACK_EVENT_TAG_EVENT;
+                fwrite(&tag,   sizeof(tag),   1, flusher->out);
+                fwrite(&event, sizeof(event), 1, flusher->out);
+                ++written;
+            }
+            __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+
+            uint64_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+            if (dropped != ring->droppedReported) {
+                uint64_t record[2] = {STACK_EVENT_TAG_DROPPED, dropped - ring->droppedReported};
+                fwrite(record, sizeof(record), 1, flusher->out);
+                ring->droppedReported = dropped;
+            }
+        }
+
+        pthread_mutex_unlock(&STACK_EVENT_DRAIN_LOCK);
+        __atomic_add_fetch(&flusher->written, written, __ATOMIC_RELAXED);
+        return written;
+    }
+
+
+    static const char *stack_eventString(const uint64_t *keys, char * const *strings, size_t count, const void *key)
+    {
+        if (key == NULL)
+            return "(null)";
+        for (size_t i = count; i-- > 0;)                                // the latest record of the key wins
+            if (keys[i] == (uint64_t)(uintptr_t)key)
+                return strings[i];
+        return "?";
+    }
+
+
+    static bool stack_eventDecode(FILE *in, FILE *out)
+    {
+        assert(ptrValid(in));
+        assert(ptrValid(out));
+
+        uint64_t magic = 0;
+        if (fread(&magic, sizeof(magic), 1, in) != 1 || magic != STACK_EVENT_FILE_MAGIC)
+            return false;
+
+        size_t    stringsCount = 0;
+        size_t    stringsCap   = 0;
+        uint64_t *keys         = NULL;
+        char    **strings      = NULL;
+        bool      ok           = true;
+
+        uint64_t tag = 0;
+        while (ok && fread(&tag, sizeof(tag), 1, in) == 1) {
+            switch (tag) {
+                case STACK_EVENT_TAG_STRING: {
+                    uint64_t record[2] = {};
+                    char *string = NULL;
+                    ok = fread(record, sizeof(record), 1, in) == 1 && (string = (char*)calloc(record[1] + 1, 1)) != NULL
+                      && fread(string, 1, record[1], in) == record[1];
+                    if (ok && stringsCount == stringsCap) {
+                        stringsCap = stringsCap ? stringsCap * 2 : 64;
+                        uint64_t *newKeys    = (uint64_t*)realloc(keys, stringsCap * sizeof(uint64_t));
+                        keys = newKeys ? newKeys : keys;
+                        char    **newStrings = (char**)realloc(strings, stringsCap * sizeof(char*));
+                        strings = newStrings ? newStrings : strings;
+                        ok = newKeys != NULL && newStrings != NULL;
+                    }
+                    if (!ok) {
+                        free(string);
+                        break;
+                    }
+                    keys[stringsCount]    = record[0];
+                    strings[stringsCount] = string;
+                    ++stringsCount;
+                    break;
+                }
+                case STACK_EVENT_TAG_EVENT: {
+                    stack_event event = {};
+                    ok = fread(&event, sizeof(event), 1, in) == 1;
+                    if (!ok)
+                        break;
+
+                    fprintf(out, "%s\n| %s\n", STACK_LOG_DELIM, stack_eventString(keys, strings, stringsCount, event.message));
+                    fprintf(out, "| called from func %s on line %u of file %s\n", stack_eventString(keys, strings, stringsCount, event.func), event.line, stack_eventString(keys, strings, stringsCount, event.file));
+                    fprintf(out, "| at %" PRIu64 " ns\n", event.timeNs);
+                    fprintf(out, "%s\n", STACK_LOG_DELIM);
+                    fprintf(out, "| Stack [%p] :\n", event.stack);
+                    fprintf(out, "|----------------\n");
+                    fprintf(out, "| Current status = %d\n", event.status);
+                    stack_statusToStream(event.status, out);
+                    fprintf(out, "|----------------\n");
+                    fprintf(out, "| Capacity         = %" PRIu64 "\n", event.capacity);
+                    fprintf(out, "| Len              = %" PRIu64 "\n", event.len);
+                    fprintf(out, "%s\n\n", STACK_LOG_DELIM);
+                    break;
+                }
+                case STACK_EVENT_TAG_DROPPED: {
+                    uint64_t count = 0;
+                    ok = fread(&count, sizeof(count), 1, in) == 1;
+                    if (ok)
+                        fprintf(out, "%s\n| %" PRIu64 " events dropped on a full ring\n%s\n\n", STACK_LOG_DELIM, count, STACK_LOG_DELIM);
+                    break;
+                }
+                default:
+                    ok = false;
+            }
+        }
+
+        for (size_t i = 0; i < stringsCount; ++i)
+            free(strings[i]);
+        free(strings);
+        free(keys);
+        return ok;
+    }
+#endif
+
+
+static void stack_statusToStream(int status, FILE *out)
+{
+    if (status & STACK_BAD_STRUCT_PTR)
+        fprintf(out, "| Bad self ptr \n");
+    if (status & STACK_BAD_MEM_ALLOC)
+        fprintf(out, "| Bad memory allocation \n");
+    if (status & STACK_INTEGRITY_VIOLATED)
+        fprintf(out, "| Stack integrity violated \n");
+    if (status & STACK_DATA_INTEGRITY_VIOLATED)
+        fprintf(out, "| Data integrity violated \n");
+    if (status & STACK_LEFT_STRUCT_CANARY_CORRUPT)
+        fprintf(out, "| Left structure canary corrupted \n");
+    if (status & STACK_RIGHT_STRUCT_CANARY_CORRUPT)
+        fprintf(out, "| Right structure canary corrupted \n");
+    if (status & STACK_LEFT_DATA_CANARY_CORRUPT)
+        fprintf(out, "| Left data canary corrupted \n");
+    if (status & STACK_RIGHT_DATA_CANARY_CORRUPT)
+        fprintf(out, "| Right data canary corrupted \n");
+    if (status & STACK_BAD_STRUCT_HASH)
+        fprintf(out, "| Bad structure hash, stack may be corrupted \n");
+    if (status & STACK_BAD_DATA_HASH)
+        fprintf(out, "| Bad data hash, stack data may be corrupted \n");
+    if (status & STACK_BAD_CAPACITY)
+        fprintf(out, "| Bad capacity, capacity value differs from the allocated one\n");
+    if (status & STACK_EMPTY)
+        fprintf(out, "| Stack is empty \n");
+}
+
+
+#ifdef STACK_USE_STATS
+    static void stack_statsTimerEnd(stack_stats_timer *timer)
+    {
+        uint64_t elapsed = stack_clockNs(false) - timer->start;
+        if (timer->histogram)
+            ++timer->target[stack_statsBucket(elapsed)];
+        else
+            *timer->target += elapsed;
+    }
+
+
+    static size_t stack_statsBucket(uint64_t ns)
+    {
+        if (ns == 0)
+            return 0;
+
+        size_t bucket = 63 - __builtin_clzll(ns);
+        return bucket < STACK_LATENCY_BUCKETS ? bucket : STACK_LATENCY_BUCKETS - 1;
+    }
+
+
+    static uint64_t stack_statsPercentile(const uint64_t *histogram, double q)
+    {
+        assert(ptrValid(histogram));
+
+        uint64_t total = 0;
+        for (size_t i = 0; i < STACK_LATENCY_BUCKETS; ++i)
+            total += histogram[i];
+        if (total == 0)
+            return 0;
+
+        uint64_t rank = (uint64_t)ceil(q * total);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < STACK_LATENCY_BUCKETS; ++i) {
+            seen += histogram[i];
+            if (seen >= rank && seen != 0)
+                return 2ull << i;
+        }
+        return 2ull << (STACK_LATENCY_BUCKETS - 1);
+    }
+
+
+    static void stack_statsToStream(const stack_stats *stats, FILE *out)
+    {
+        static const char *opNames[STACK_STATS_OP_COUNT] = {"push", "pop", "pushN", "popN", "top", "get"};
+        static const char *phaseNames[STACK_STATS_PHASE_COUNT] = {"struct hash", "canaries", "sys capacity", "data hash", "poison"};
+
+        fprintf(out, "|----------------\n");
+        fprintf(out, "| Pushes           = %" PRIu64 "\n", stats->pushes);
+        fprintf(out, "| Pops             = %" PRIu64 "\n", stats->pops);
+        fprintf(out, "| Reallocations    = %" PRIu64 "\n", stats->reallocations);
+        fprintf(out, "| Bytes copied     = %" PRIu64 "\n", stats->bytesCopied);
+        fprintf(out, "| Peak len         = %" PRIu64 "\n", stats->peakLen);
+        fprintf(out, "| Peak capacity    = %" PRIu64 "\n", stats->peakCapacity);
+        fprintf(out, "| Healthchecks     = %" PRIu64 "\n", stats->healthChecks);
+
+        for (size_t phase = 0; phase < STACK_STATS_PHASE_COUNT; ++phase) {
+            if (stats->phaseNs[phase] != 0)
+                fprintf(out, "|   %-14s = %" PRIu64 " ns\n", phaseNames[phase], stats->phaseNs[phase]);
+        }
+
+        for (size_t op = 0; op < STACK_STATS_OP_COUNT; ++op) {
+            uint64_t count = 0;
+            for (size_t i = 0; i < STACK_LATENCY_BUCKETS; ++i)
+                count += stats->latency[op][i];
+            if (count == 0)
+                continue;
+
+            fprintf(out, "| %-6s latency   = %" PRIu64 " ops, p50 < %" PRIu64 " ns, p99 < %" PRIu64 " ns, max < %" PRIu64 " ns\n", opNames[op], count,
+                    stack_statsPercentile(stats->latency[op], 0.5), stack_statsPercentile(stats->latency[op], 0.99),
+                    stack_statsPercentile(stats->latency[op], 1));
+        }
+    }
+#endif
+
+#endif /* STACK_FUNC_GUARD */
+
+
+#ifdef STACK_USE_POISON
+    static bool GENERIC(stack_isPoisoned)(const STACK_TYPE *elem)                       
+    {
+        assert(ptrValid(elem));
+        return !memcmp(elem, &GENERIC(STACK_REFERENCE_POISONED_ELEM), sizeof(STACK_TYPE));
+    }
+
+
+    static bool GENERIC(stack_isRangePoisoned)(const STACK_TYPE *elems, size_t count)
+    {
+        assert(count == 0 || ptrValid(elems));
+        return stack_findNotPoisoned(elems, count * sizeof(STACK_TYPE), STACK_ELEM_POISON) == count * sizeof(STACK_TYPE);
+    }
+#endif
+
+
+#ifdef STACK_USE_DATA_HASH
+    static uint32_t GENERIC(stack_crc32cCut)(uint32_t hash, const STACK_TYPE *elems, size_t count)
+    {
+        static const uint32_t elemFactor = stack_crc32cPowModP(STACK_CRC32C_X_INV, 8 * sizeof(STACK_TYPE));    // x^(-8 * sizeof(STACK_TYPE)), the usual single-pop case
+
+        uint32_t factor = (count == 1) ? elemFactor : stack_crc32cPowModP(elemFactor, count);
+        uint32_t tail   = stack_crc32c(0, elems, count * sizeof(STACK_TYPE));
+
+        return stack_crc32cMultModP(hash ^ tail, factor);               // crc(A) = (crc(A||B) ^ crc(B)) * x^(-8|B|)
+    }
+
+
+    static void GENERIC(stack_dataHashPush)(GENERIC(stack) *this_, size_t count)
+    {
+        assert(ptrValid(this_));
+
+        #ifdef STACK_USE_DATA_HASH_BLOCKS
+            size_t blockLen = GENERIC(stack_blockLen)();
+            for (size_t pos = this_->len - count; pos < this_->len; ) {
+                size_t block = pos / blockLen;
+                size_t part  = fmin(this_->len - pos, (block + 1) * blockLen - pos);
+
+                uint32_t hash = this_->blockHashes[block];
+                this_->blockHashes[block] = stack_crc32c(hash, &this_->data[pos], part * sizeof(STACK_TYPE));
+                this_->dataHash ^= hash ^ this_->blockHashes[block];
+                GENERIC(stack_markBlockDirty)(this_, pos);
+
+                pos += part;
+            }
+        #else
+            this_->dataHash = stack_crc32c((uint32_t)this_->dataHash, &this_->data[this_->len - count], count * sizeof(STACK_TYPE));
+        #endif
+    }
+
+
+    static void GENERIC(stack_dataHashPop)(GENERIC(stack) *this_, size_t count)
+    {
+        assert(ptrValid(this_));
+
+        #ifdef STACK_USE_DATA_HASH_BLOCKS
+            size_t blockLen = GENERIC(stack_blockLen)();
+            for (size_t pos = this_->len; pos < this_->len + count; ) {         // every part is the tail of its block
+                size_t block = pos / blockLen;
+                size_t part  = fmin(this_->len + count - pos, (block + 1) * blockLen - pos);
+
+                uint32_t hash = this_->blockHashes[block];
+                this_->blockHashes[block] = GENERIC(stack_crc32cCut)(hash, &this_->data[pos], part);
+                this_->dataHash ^= hash ^ this_->blockHashes[block];
+                GENERIC(stack_markBlockDirty)(this_, pos);
+
+                pos += part;
+            }
+        #else
+            bool verified = this_->verifiedLen == this_->len + count && this_->verifiedHash == this_->dataHash;
+            this_->dataHash = GENERIC(stack_crc32cCut)((uint32_t)this_->dataHash, &this_->data[this_->len], count);
+            if (verified) {                                             // usual pop right after a check, the prefix hash is at hand
+                this_->verifiedLen  = this_->len;
+                this_->verifiedHash = this_->dataHash;
+                if (this_->rescanLen > this_->verifiedLen) {
+                    this_->rescanLen  = 0;
+                    this_->rescanHash = 0;
+                }
+            }
+            else {
+                GENERIC(stack_lowerWatermark)(this_, this_->len);
+            }
+        #endif
+    }
+#endif
+
+
+#ifdef STACK_USE_DATA_HASH_BLOCKS
+    static size_t GENERIC(stack_blockLen)()
+    {
+        return sizeof(STACK_TYPE) < STACK_DATA_HASH_BLOCK_SIZE ? STACK_DATA_HASH_BLOCK_SIZE / sizeof(STACK_TYPE) : 1;
+    }
+
+
+    static size_t GENERIC(stack_blockCount)(size_t len)
+    {
+        return (len + GENERIC(stack_blockLen)() - 1) / GENERIC(stack_blockLen)();
+    }
+
+
+    static void GENERIC(stack_markBlockDirty)(const GENERIC(stack) *this_, size_t pos)
+    {
+        size_t block = pos / GENERIC(stack_blockLen)();
+        this_->dirtyBlocks[block / 64] |= 1ull << (block % 64);
+    }
+
+
+    static bool GENERIC(stack_verifyBlock)(const GENERIC(stack) *this_, size_t block)
+    {
+        size_t blockLen = GENERIC(stack_blockLen)();
+        size_t begin    = block * blockLen;
+        size_t end      = fmin(begin + blockLen, this_->len);
+
+        return this_->blockHashes[block] == stack_crc32c(0, &this_->data[begin], (end - begin) * sizeof(STACK_TYPE));
+    }
+#endif
+
+
+#ifdef STACK_USE_DATA_HASH_WATERMARK
+    static void GENERIC(stack_lowerWatermark)(const GENERIC(stack) *this_, size_t pos)
+    {
+        if (this_->verifiedLen > this_->capacity) {                     // corrupt watermark, the next check hashes everything
+            this_->verifiedLen  = 0;
+            this_->verifiedHash = 0;
+        }
+        else if (pos < this_->verifiedLen) {
+            this_->verifiedHash = GENERIC(stack_crc32cCut)((uint32_t)this_->verifiedHash, &this_->data[pos], this_->verifiedLen - pos);
+            this_->verifiedLen  = pos;
+        }
+
+        if (this_->rescanLen > this_->verifiedLen) {
+            this_->rescanLen  = 0;
+            this_->rescanHash = 0;
+        }
+    }
+
+
+    static bool GENERIC(stack_verifyWatermark)(const GENERIC(stack) *this_)
+    {
+        size_t len = this_->len < this_->capacity ? this_->len : this_->capacity;     // in case structure is corrupt and len > capacity
+        if (this_->verifiedLen > len || this_->rescanLen > this_->verifiedLen) {     // len was changed behind our back
+            this_->verifiedLen  = 0;
+            this_->verifiedHash = 0;
+            this_->rescanLen    = 0;
+            this_->rescanHash   = 0;
+        }
+
+        bool intact = true;
+        uint64_t hash = stack_crc32c((uint32_t)this_->verifiedHash, &this_->data[this_->verifiedLen], (len - this_->verifiedLen) * sizeof(STACK_TYPE));
+        if (this_->dataHash != hash) {
+            intact = false;
+        }
+        else {
+            this_->verifiedLen  = len;
+            this_->verifiedHash = hash;
+        }
+
+        size_t rescanLen = STACK_DATA_HASH_RESCAN_SIZE / sizeof(STACK_TYPE) ? STACK_DATA_HASH_RESCAN_SIZE / sizeof(STACK_TYPE) : 1;
+        rescanLen = fmin(rescanLen, this_->verifiedLen - this_->rescanLen);
+        this_->rescanHash = stack_crc32c((uint32_t)this_->rescanHash, &this_->data[this_->rescanLen], rescanLen * sizeof(STACK_TYPE));
+        this_->rescanLen += rescanLen;
+        if (this_->rescanLen == this_->verifiedLen) {                   // whole prefix is rehashed, next round starts from the bottom
+            intact = intact && this_->rescanHash == this_->verifiedHash;
+            this_->rescanLen  = 0;
+            this_->rescanHash = 0;
+        }
+
+        return intact;
+    }
+#endif
+
+
+#ifdef STACK_USE_CAPACITY_SYS_CHECK
+    static size_t GENERIC(stack_getRealCapacity)(const GENERIC(stack) *this_) 
+    {
+        if (GENERIC(stack_isInline)(this_))
+            return GENERIC(stack_inlineCapacity)();
+
+        if (!ptrValid(this_->dataWrapper) || !ptrValid(this_->allocator)) {
+            fprintf(stderr, "WARNING: getRealCapacity got a bad pointer!\n");
+            return STACK_SIZE_T_POISON;
+        }
+
+        size_t allocatedSize = stack_storageUsableSize(this_->allocator, this_->dataWrapper, this_->mappedSize);
+        if (allocatedSize < 2 * STACK_DATA_WRAPPER_LEN * sizeof(STACK_CANARY_TYPE))     // allocator doesn't know real size
+            return STACK_SIZE_T_POISON;
+
+        return (allocatedSize - 2 * STACK_DATA_WRAPPER_LEN * sizeof(STACK_CANARY_TYPE)) / sizeof(STACK_TYPE);
+    }
+#endif
+
+
+//===========================================
+// Auxiliary stack functions
+
+
+static size_t GENERIC(stack_expandFactorCalc)(size_t capacity)          
+{
+    #if STACK_GROWTH_POLICY == STACK_GROWTH_X1_5
+        size_t newCapacity = capacity + capacity / 2;
+    #else
+        size_t newCapacity = capacity * 2;
+    #endif
+    if (newCapacity <= capacity)
+        newCapacity = capacity + 1;
+
+    #if STACK_GROWTH_POLICY == STACK_GROWTH_PAGE
+        size_t allocatedSize = GENERIC(stack_allocated_size)(newCapacity);
+        if (allocatedSize >= stack_pageSize()) {                    // fills whole pages, small stacks don't waste a page
+            allocatedSize = (allocatedSize + stack_pageSize() - 1) / stack_pageSize() * stack_pageSize();
+            newCapacity   = (allocatedSize - 2 * STACK_DATA_WRAPPER_LEN * sizeof(STACK_CANARY_TYPE)) / sizeof(STACK_TYPE);
+            newCapacity  -= newCapacity % GENERIC(stack_capacityStep)();
+            if (newCapacity > capacity)
+                return newCapacity;
+        }
+    #endif
+
+    return GENERIC(stack_alignCapacity)(newCapacity);
+}
+
+
+static size_t GENERIC(stack_shrinkageFactorCalc)(size_t capacity)
+{
+    #if STACK_GROWTH_POLICY == STACK_GROWTH_X1_5
+        size_t newCapacity = capacity - capacity / 3;               // inverse of the 1.5x growth
+    #else
+        size_t newCapacity = capacity / 2;
+    #endif
+
+    newCapacity = GENERIC(stack_alignCapacity)(newCapacity);
+    return newCapacity < capacity ? newCapacity : capacity;
+}
+
+
+static size_t GENERIC(stack_capacityStep)()
+{
+    size_t step = 1;
+
+    #ifdef STACK_USE_DATA_CANARY
+        step = sizeof(STACK_CANARY_TYPE);                           // least capacity step keeping capacity * sizeof(STACK_TYPE) a multiple of canary size
+        for (size_t size = sizeof(STACK_TYPE); size % 2 == 0 && step > 1; size /= 2)
+            step /= 2;
+    #endif
+
+    return step;
+}
+
+
+static size_t GENERIC(stack_alignCapacity)(size_t capacity)
+{
+    if (capacity == 0)
+        capacity = 1;
+
+    size_t step = GENERIC(stack_capacityStep)();
+    return (capacity + step - 1) / step * step;
+}
+
+
+static size_t GENERIC(stack_inlineCapacity)()
+{
+    return STACK_INLINE_CAPACITY - STACK_INLINE_CAPACITY % GENERIC(stack_capacityStep)();
+}
+
+
+static size_t GENERIC(stack_allocated_size)(size_t capacity) 
+{
+    return (capacity * sizeof(STACK_TYPE) + 2 * STACK_DATA_WRAPPER_LEN * sizeof(STACK_CANARY_TYPE));
+}
+
+
+static bool GENERIC(stack_checkDue)(GENERIC(stack) *this_)
+{
+    if (this_->checkPolicy.mode == STACK_CHECK_ALWAYS && this_->checkScheduled)      // nothing to advance
+        return true;
+
+    #ifdef STACK_USE_STRUCT_HASH
+        bool hashValid = this_->structHash == GENERIC(stack_calculateStructHash)(this_);     // cadence state is hashed, a stale hash stays stale
+    #endif
+
+    this_->checkScheduled = GENERIC(stack_checkCadence)(this_);
+
+    #ifdef STACK_USE_STRUCT_HASH
+        if (hashValid)
+            this_->structHash = GENERIC(stack_calculateStructHash)(this_);
+    #endif
+
+    return this_->checkScheduled;
+}
+
+
+static bool GENERIC(stack_checkCadence)(GENERIC(stack) *this_)
+{
+    switch (this_->checkPolicy.mode) {
+        case STACK_CHECK_ALWAYS:
+            return true;
+
+        case STACK_CHECK_EVERY_N:
+            if (this_->checkCountdown == 0) {
+                this_->checkCountdown = this_->checkPolicy.period - 1;
+                return true;
+            }
+            this_->checkCountdown -= 1;
+            return false;
+
+        case STACK_CHECK_SAMPLED:
+            this_->checkRandState ^= this_->checkRandState << 13;          // xorshift64
+            this_->checkRandState ^= this_->checkRandState >> 7;
+            this_->checkRandState ^= this_->checkRandState << 17;
+            return (double)(this_->checkRandState >> 11) * 0x1.0p-53 < this_->checkPolicy.rate;
+
+        case STACK_CHECK_BUDGET: {
+            uint64_t now = stack_clockNs(false);
+            if (now - this_->checkWindowStart >= STACK_CHECK_BUDGET_WINDOW_NS) {
+                this_->checkWindowStart = now;
+                this_->checkWindowSpent = 0;
+            }
+            return this_->checkWindowSpent < this_->checkPolicy.budgetNs;
+        }
+
+        default:
+            return true;
+    }
+}
+
+
+static uint64_t GENERIC(stack_checkClock)(const GENERIC(stack) *this_)
+{
+    return this_->checkPolicy.mode == STACK_CHECK_BUDGET ? stack_clockNs(true) : 0;
+}
+
+
+static void GENERIC(stack_checkSpent)(GENERIC(stack) *this_, uint64_t start)
+{
+    if (this_->checkPolicy.mode != STACK_CHECK_BUDGET)
+        return;
+
+    #ifdef STACK_USE_STRUCT_HASH
+        bool hashValid = this_->structHash == GENERIC(stack_calculateStructHash)(this_);
+    #endif
+
+    this_->checkWindowSpent += stack_clockNs(true) - start;
+
+    #ifdef STACK_USE_STRUCT_HASH
+        if (hashValid)
+            this_->structHash = GENERIC(stack_calculateStructHash)(this_);
+    #endif
+}
+
+
+//===========================================
+// Stack implementation
+
+
+static stack_status GENERIC(stack_ctor)(GENERIC(stack) *this_)
+{
+    return GENERIC(stack_ctorCapacity)(this_, STACK_STARTING_CAPACITY);
+}
+
+
+static stack_status GENERIC(stack_ctorCapacity)(GENERIC(stack) *this_, size_t capacity)
+{
+    return GENERIC(stack_ctorAllocator)(this_, capacity, &STACK_ALLOCATOR_MALLOC);
+}
+
+
+static stack_status GENERIC(stack_ctorAllocator)(GENERIC(stack) *this_, size_t capacity, const stack_allocator *allocator)
+{
+    return GENERIC(stack_ctorStorage)(this_, capacity, allocator, false);
+}
+
+
+static stack_status GENERIC(stack_ctorDeferred)(GENERIC(stack) *this_, size_t capacity, const stack_allocator *allocator)
+{
+    return GENERIC(stack_ctorStorage)(this_, capacity, allocator, true);
+}
+
+
+static stack_status GENERIC(stack_ctorStorage)(GENERIC(stack) *this_, size_t capacity, const stack_allocator *allocator, bool deferred)
+{
+    STACK_PTR_VALIDATE(this_);
+
+    if (allocator == NULL)
+        allocator = &STACK_ALLOCATOR_MALLOC;
+
+    bool capacityFits = capacity <= stack_maxCapacity(sizeof(STACK_TYPE), STACK_DATA_WRAPPER_LEN);       // allocated size would wrap around otherwise
+    capacity = GENERIC(stack_alignCapacity)(capacity);
+
+    this_->capacity = STACK_SIZE_T_POISON;
+    this_->len      = STACK_SIZE_T_POISON;
+    this_->logStream = stdout;          //TODO
+    this_->allocator = allocator;
+    #ifdef STACK_USE_ASYNC_CHECK
+        this_->watch = NULL;
+    #endif
+    #ifdef STACK_USE_STATS
+        memset((char*)&this_->stats, 0, sizeof(stack_stats));
+    #endif
+
+    this_->checkPolicy      = STACK_CHECK_POLICY_ALWAYS;
+    this_->checkScheduled   = true;
+    this_->checkCountdown   = 0;
+    this_->checkRandState   = (uint64_t)this_ ^ 0x9E3779B97F4A7C15;       // any nonzero seed
+    this_->checkWindowStart = 0;
+    this_->checkWindowSpent = 0;
+    
+    this_->deferredCapacity = 0;
+    this_->generation       = 0;
+
+    if (!capacityFits) {
+        this_->dataWrapper = NULL;
+    }
+    else if ((capacity <= GENERIC(stack_inlineCapacity)() && !allocator->persistent) || deferred) {            // allocation-free construction
+        if (capacity > GENERIC(stack_inlineCapacity)())
+            this_->deferredCapacity = capacity;
+
+        capacity = GENERIC(stack_inlineCapacity)();
+        this_->dataWrapper = this_->inlineWrapper;
+        this_->mappedSize  = 0;
+    }
+    else {
+        this_->dataWrapper = (STACK_CANARY_TYPE*)stack_storageAlloc(allocator, GENERIC(stack_allocated_size)(capacity), &this_->mappedSize);
+    }
+
+    if (!this_->dataWrapper) {
+        #ifdef STACK_USE_PTR_POISON
+            this_->dataWrapper = (STACK_CANARY_TYPE*)STACK_DEAD_STRUCT_PTR;
+            this_->data        =  (STACK_TYPE*)STACK_DEAD_STRUCT_PTR;
+        #endif
+
+        this_->status = STACK_BAD_MEM_ALLOC;
+        return this_->status;
+    }
+
+    this_->data = (STACK_TYPE*)(this_->dataWrapper + STACK_DATA_WRAPPER_LEN);
+
+    #ifdef STACK_USE_USABLE_SIZE
+        if (this_->mappedSize != 0) {                                   // the rest of the last page is free to use
+            capacity  = (this_->mappedSize - 2 * STACK_DATA_WRAPPER_LEN * sizeof(STACK_CANARY_TYPE)) / sizeof(STACK_TYPE);
+            capacity -= capacity % GENERIC(stack_capacityStep)();
+        }
+    #endif
+
+    this_->capacity = capacity;
+    this_->residentCapacity = capacity;
+    this_->len = 0;
+    this_->status = STACK_OK;
+
+    #ifdef STACK_USE_STATS
+        this_->stats.peakCapacity = capacity;
+    #endif
+
+    #ifdef STACK_USE_CANARY
+       for (size_t i = 0; i < STACK_CANARY_WRAPPER_LEN; ++i) {
+            this_-> leftCanary[i]   =  STACK_LEFT_CANARY_POISON;
+            this_->rightCanary[i]   = STACK_RIGHT_CANARY_POISON;
+        }
+    #endif  
+
+    #ifdef STACK_USE_DATA_CANARY
+       for (size_t i = 0; i < STACK_DATA_WRAPPER_LEN; ++i) {
+             LEFT_CANARY_WRAPPER[i] =  STACK_LEFT_CANARY_POISON;
+            RIGHT_CANARY_WRAPPER[i] = STACK_RIGHT_CANARY_POISON;
+        }
+    #endif  
+
+    #ifdef STACK_USE_POISON
+        memset((char*)(&GENERIC(STACK_REFERENCE_POISONED_ELEM)), STACK_ELEM_POISON, sizeof(STACK_TYPE));
+        memset((char*)this_->data, STACK_ELEM_POISON, this_->capacity * sizeof(STACK_TYPE));
+    #endif
+
+    #ifdef STACK_USE_DATA_HASH_BLOCKS
+        size_t blockCount = GENERIC(stack_blockCount)(this_->capacity);
+        this_->blockHashes  = (uint32_t*)calloc(fmax(blockCount, 1), sizeof(uint32_t));
+        this_->dirtyBlocks  = (uint64_t*)calloc(fmax((blockCount + 63) / 64, 1), sizeof(uint64_t));
+        this_->sampleCursor = 0;
+        this_->badBlock     = STACK_SIZE_T_POISON;
+
+        if (!this_->blockHashes || !this_->dirtyBlocks) {
+            free(this_->blockHashes);
+            free(this_->dirtyBlocks);
+            if (!GENERIC(stack_isInline)(this_))
+                stack_storageFree(this_->allocator, this_->dataWrapper, this_->mappedSize);
+            #ifdef STACK_USE_PTR_POISON
+                this_->dataWrapper = (STACK_CANARY_TYPE*)STACK_DEAD_STRUCT_PTR;
+                this_->data        =  (STACK_TYPE*)STACK_DEAD_STRUCT_PTR;
+            #endif
+
+            this_->status = STACK_BAD_MEM_ALLOC;
+            return this_->status;
+        }
+    #endif
+
+    #ifdef STACK_USE_GUARD_PAGES
+        if (!GENERIC(stack_isInline)(this_) && !allocator->persistent)
+            GENERIC(stack_guardRegister)(this_);
+    #endif
+
+    #ifdef STACK_USE_DATA_HASH
+        this_->dataHash = GENERIC(stack_calculateDataHash)(this_);
+    #endif
+
+    #ifdef STACK_USE_DATA_HASH_WATERMARK
+        this_->verifiedLen  = 0;
+        this_->verifiedHash = 0;
+        this_->rescanLen    = 0;
+        this_->rescanHash   = 0;
+    #endif
+
+    #ifdef STACK_USE_STRUCT_HASH
+        this_->structHash = GENERIC(stack_calculateStructHash)(this_);
+    #endif
+
+    return STACK_HEALTH_CHECK(this_);
+}   
+
+
+static bool GENERIC(stack_isInline)(const GENERIC(stack) *this_)
+{
+    return this_->dataWrapper == this_->inlineWrapper;
+}
+
+
+static stack_status GENERIC(stack_setCheckPolicy)(GENERIC(stack) *this_, stack_check_policy policy)
+{
+    STACK_PTR_VALIDATE(this_);
+    STACK_WRITE_SCOPE(this_);
+
+    if (policy.period == 0)
+        policy.period = 1;
+    if (policy.rate < 0)
+        policy.rate = 0;
+    if (policy.rate > 1)
+        policy.rate = 1;
+
+    #ifdef STACK_USE_STRUCT_HASH
+        bool hashValid = this_->structHash == GENERIC(stack_calculateStructHash)(this_);
+    #endif
+
+    this_->checkPolicy      = policy;
+    this_->checkCountdown   = 0;
+    this_->checkWindowStart = stack_clockNs(false);
+    this_->checkWindowSpent = 0;
+
+    #ifdef STACK_USE_STRUCT_HASH
+        if (hashValid)
+            this_->structHash = GENERIC(stack_calculateStructHash)(this_);
+    #endif
+
+    return this_->status;
+}
+
+
+static stack_status GENERIC(stack_dtor)(GENERIC(stack) *this_)           
+{
+    STACK_PTR_VALIDATE(this_);          
+    STACK_WRITE_SCOPE(this_);
+
+    STACK_HEALTH_CHECK(this_);
+
+    #ifdef STACK_USE_CAPACITY_SYS_CHECK
+        size_t newCapacity = GENERIC(stack_getRealCapacity)(this_);
+        if (newCapacity != STACK_SIZE_T_POISON)
+            this_->capacity = newCapacity;
+    #endif
+
+    #ifdef STACK_USE_POISON
+        if (!ptrValid(this_->allocator) || !this_->allocator->persistent)        // file keeps the data
+            memset((char*)this_->dataWrapper, STACK_FREED_POISON, GENERIC(stack_allocated_size)(this_->capacity));
+    #endif
+
+
+    this_->capacity = STACK_SIZE_T_POISON;
+    this_->len      = STACK_SIZE_T_POISON;
+
+    if (!ptrValid(this_->dataWrapper)) {
+        fprintf(this_->logStream, "ERROR: pointer to the data is invalid!\n");      //TODO think if dtor should be silent here too?
+        return STACK_BAD_DATA_PTR;
+    }
+
+    #ifdef STACK_USE_GUARD_PAGES
+        stack_guardRemove(this_);
+    #endif
+
+    #ifdef STACK_USE_ASYNC_CHECK
+        stack_watchWait(this_->watch);
+    #endif
+
+    if (!GENERIC(stack_isInline)(this_))
+        stack_storageFree(this_->allocator, this_->dataWrapper, this_->mappedSize);
+    this_->mappedSize = 0;
+
+    #ifdef STACK_USE_DATA_HASH_BLOCKS
+        free(this_->blockHashes);
+        free(this_->dirtyBlocks);
+        this_->blockHashes = NULL;
+        this_->dirtyBlocks = NULL;
+    #endif
+    
+    #ifdef STACK_USE_PTR_POISON
+        this_->dataWrapper = (STACK_CANARY_TYPE*)STACK_FREED_PTR;
+        this_->data        = (STACK_TYPE*)STACK_FREED_PTR;
+    #endif
+
+    return STACK_HEALTH_CHECK(this_);
+}
+
+
+static inline stack_status GENERIC(stack_push)(GENERIC(stack) *this_, STACK_TYPE item)
+{
+    STACK_PTR_VALIDATE(this_);
+    STACK_WRITE_SCOPE(this_);
+    STACK_STATS_OP_SCOPE(this_, STACK_STATS_PUSH);
+
+    if (STACK_UNLIKELY(STACK_OP_BEGIN_CHECK(this_)))
+        return this_->status;
+   
+    if (STACK_UNLIKELY(this_->len == this_->capacity))
+        this_->status |= GENERIC(stack_grow)(this_, this_->len + 1);
+
+    #ifdef STACK_USE_POISON  
+        if (STACK_UNLIKELY(!GENERIC(stack_isPoisoned)(&this_->data[this_->len]))) {
+            STACK_LOG_TO_STREAM(this_, this_->logStream, "Stack structure corrupt, element was modified!");
+            this_->status |= STACK_DATA_INTEGRITY_VIOLATED;
+        }
+    #endif
+    
+    #if defined(STACK_USE_DATA_CANARY) && defined(STACK_USE_POISON)
+        if (STACK_UNLIKELY((STACK_CANARY_TYPE)this_->data[this_->len] == STACK_RIGHT_CANARY_POISON)) {
+            STACK_LOG_TO_STREAM(this_, this_->logStream, "WARNING: Requested elem in wrapper, stack didn't reallocate?");
+            this_->status |= STACK_BAD_MEM_ALLOC;
+        }
+    #endif  
+
+    this_->data[this_->len] = item;
+    this_->len += 1;
+
+    if (STACK_UNLIKELY(this_->len > this_->residentCapacity))        // released pages get faulted back in
+        this_->residentCapacity = this_->capacity;
+
+    #ifdef STACK_USE_STATS
+        this_->stats.pushes += 1;
+        if (this_->len > this_->stats.peakLen)
+            this_->stats.peakLen = this_->len;
+    #endif
+
+    #ifdef STACK_USE_DATA_HASH
+        GENERIC(stack_dataHashPush)(this_, 1);
+    #endif
+
+    #ifdef STACK_USE_STRUCT_HASH
+        this_->structHash = GENERIC(stack_calculateStructHash)(this_);
+    #endif
+
+
+    return STACK_OP_END_CHECK(this_);
+}
+
+
+static inline stack_status GENERIC(stack_pop)(GENERIC(stack) *this_, STACK_TYPE *item)
+{
+    STACK_PTR_VALIDATE(this_);
+    STACK_WRITE_SCOPE(this_);
+    STACK_STATS_OP_SCOPE(this_, STACK_STATS_POP);
+
+    if (STACK_UNLIKELY(STACK_OP_BEGIN_CHECK(this_)))
+        return this_->status;
+    
+    if (STACK_UNLIKELY(this_->len == 0)) {
+        STACK_LOG_TO_STREAM(this_, this_->logStream, "WARNING: trying to pop from empty stack!");
+        return this_->status | STACK_EMPTY;
+    }
+
+    this_->len -= 1;
+
+    #ifdef STACK_USE_STATS
+        this_->stats.pops += 1;
+    #endif
+
+    #ifdef STACK_USE_DATA_HASH
+        GENERIC(stack_dataHashPop)(this_, 1);
+    #endif
+
+    if (STACK_LIKELY(ptrValid(item))) {   
+        *item = this_->data[this_->len];
+        #ifdef STACK_USE_POISON 
+            if (STACK_UNLIKELY(GENERIC(stack_isPoisoned)(item))) {               
+                STACK_LOG_TO_STREAM(this_, this_->logStream, "WARNING: accessed uninitilized element!");
+            }
+        #endif
+    }
+
+    #ifdef STACK_USE_POISON
+        memset((char*)(&this_->data[this_->len]), STACK_ELEM_POISON, sizeof(STACK_TYPE));
+    #endif
+   
+    #ifdef STACK_USE_STRUCT_HASH
+        this_->structHash = GENERIC(stack_calculateStructHash)(this_);
+    #endif
+
+    #ifdef AUTO_SHRINK
+        GENERIC(stack_autoShrink)(this_);
+    #endif
+
+    return STACK_OP_END_CHECK(this_);
+}
+
+static stack_status GENERIC(stack_pushN)(GENERIC(stack) *this_, const STACK_TYPE *items, size_t count)
+{
+    STACK_PTR_VALIDATE(this_);
+    STACK_WRITE_SCOPE(this_);
+    STACK_STATS_OP_SCOPE(this_, STACK_STATS_PUSH_N);
+
+    if (STACK_OP_BEGIN_CHECK(this_))
+        return this_->status;
+
+    if (count == 0)
+        return STACK_OP_END_CHECK(this_);
+
+    if (!ptrValid(items)) {
+        STACK_LOG_TO_STREAM(this_, this_->logStream, "ERROR: bad items pointer provided to stack_pushN!");
+        return this_->status;
+    }
+
+    if (count > this_->capacity - this_->len) {
+        if (count > STACK_SIZE_T_POISON / sizeof(STACK_TYPE) - this_->len) {
+            this_->status |= STACK_BAD_MEM_ALLOC;
+            return this_->status;
+        }
+
+        bool ownItems = this_->data <= items && items < this_->data + this_->len;         // items in the live data are freed by reallocation
+        size_t itemsOffset = items - this_->data;
+
+        this_->status |= GENERIC(stack_grow)(this_, this_->len + count);
+        if (this_->capacity < this_->len + count)
+            return this_->status;
+
+        if (ownItems)
+            items = this_->data + itemsOffset;
+    }
+
+    #ifdef STACK_USE_POISON
+        if (!GENERIC(stack_isRangePoisoned)(&this_->data[this_->len], count)) {
+            STACK_LOG_TO_STREAM(this_, this_->logStream, "Stack structure corrupt, element was modified!");
+            this_->status |= STACK_DATA_INTEGRITY_VIOLATED;
+        }
+    #endif
+
+    memcpy((char*)&this_->data[this_->len], items, count * sizeof(STACK_TYPE));
+    this_->len += count;
+
+    if (this_->len > this_->residentCapacity)
+        this_->residentCapacity = this_->capacity;
+
+    #ifdef STACK_USE_STATS
+        this_->stats.pushes += count;
+        if (this_->len > this_->stats.peakLen)
+            this_->stats.peakLen = this_->len;
+    #endif
+
+    #ifdef STACK_USE_DATA_HASH
+        GENERIC(stack_dataHashPush)(this_, count);
+    #endif
+
+    #ifdef STACK_USE_STRUCT_HASH
+        this_->structHash = GENERIC(stack_calculateStructHash)(this_);
+    #endif
+
+    return STACK_OP_END_CHECK(this_);
+}
+
+
+static stack_status GENERIC(stack_popN)(GENERIC(stack) *this_, STACK_TYPE *items, size_t count, size_t *popped)
+{
+    STACK_PTR_VALIDATE(this_);
+    STACK_WRITE_SCOPE(this_);
+    STACK_STATS_OP_SCOPE(this_, STACK_STATS_POP_N);
+
+    if (STACK_OP_BEGIN_CHECK(this_))
+        return this_->status;
+
+    if (count > this_->len) {
+        STACK_LOG_TO_STREAM(this_, this_->logStream, "WARNING: trying to pop more elems than stack has!");
+        count = this_->len;
+    }
+
+    this_->len -= count;
+
+    #ifdef STACK_USE_STATS
+        this_->stats.pops += count;
+    #endif
+
+    #ifdef STACK_USE_DATA_HASH
+        GENERIC(stack_dataHashPop)(this_, count);
+    #endif
+
+    if (ptrValid(items)) {
+        memcpy((char*)items, &this_->data[this_->len], count * sizeof(STACK_TYPE));
+    }
+    if (ptrValid(popped)) {
+        *popped = count;
+    }
+
+    #ifdef STACK_USE_POISON
+        memset((char*)(&this_->data[this_->len]), STACK_ELEM_POISON, count * sizeof(STACK_TYPE));
+    #endif
+
+    #ifdef STACK_USE_STRUCT_HASH
+        this_->structHash = GENERIC(stack_calculateStructHash)(this_);
+    #endif
+
+    #ifdef AUTO_SHRINK
+        GENERIC(stack_autoShrink)(this_);
+    #endif
+
+    return STACK_OP_END_CHECK(this_);
+}
+
+
+static stack_status GENERIC(stack_dropN)(GENERIC(stack) *this_, size_t count)
+{
+    return GENERIC(stack_popN)(this_, NULL, count, NULL);
+}
+
+
+static stack_status GENERIC(stack_top)(GENERIC(stack) *this_, STACK_TYPE **item)
+{
+    STACK_PTR_VALIDATE(this_);
+    STACK_WRITE_SCOPE(this_);                                           // cadence, check results and dirty blocks change even here
+    STACK_STATS_OP_SCOPE(this_, STACK_STATS_TOP);
+
+    if (STACK_OP_BEGIN_CHECK(this_))
+        return this_->status;
+    
+    if (this_->len == 0) {
+        STACK_LOG_TO_STREAM(this_, this_->logStream, "WARNING: trying to pop from empty stack!");
+    }
+
+    if (ptrValid(item)) {
+        *item = &this_->data[this_->len - 1];
+    }
+
+    stack_status status = STACK_OP_END_CHECK(this_);
+
+    #ifdef STACK_USE_DATA_HASH_BLOCKS                  // elem is handed out for writing, so its block is verified by the next check
+        if (this_->len != 0 && this_->len <= this_->capacity)
+            GENERIC(stack_markBlockDirty)(this_, this_->len - 1);
+    #elif defined(STACK_USE_DATA_HASH_WATERMARK)
+        if (this_->len != 0 && this_->len <= this_->capacity)
+            GENERIC(stack_lowerWatermark)(this_, this_->len - 1);
+    #endif
+
+    return status;
+}
+
+static stack_status GENERIC(stack_get)(GENERIC(stack) *this_, size_t pos, STACK_TYPE **item)
+{
+    STACK_PTR_VALIDATE(this_);
+    STACK_WRITE_SCOPE(this_);
+    STACK_STATS_OP_SCOPE(this_, STACK_STATS_GET);
+
+    if (STACK_OP_BEGIN_CHECK(this_))
+        return this_->status;
+    
+    if (pos >= this_->len) {
+        STACK_LOG_TO_STREAM(this_, this_->logStream, "ERROR: bad position provided to stack_get!");
+        *item = NULL;
+    }
+
+    if (ptrValid(item)) {
+        *item = &this_->data[pos];
+    }
+
+    stack_status status = STACK_OP_END_CHECK(this_);
+
+    #ifdef STACK_USE_DATA_HASH_BLOCKS                  // elem is handed out for writing, so its block is verified by the next check
+        if (pos < this_->len && this_->len <= this_->capacity)
+            GENERIC(stack_markBlockDirty)(this_, pos);
+    #elif defined(STACK_USE_DATA_HASH_WATERMARK)
+        if (pos < this_->len && this_->len <= this_->capacity)
+            GENERIC(stack_lowerWatermark)(this_, pos);
+    #endif
+
+    return status;
+}
+
+
+static stack_status GENERIC(stack_getView)(GENERIC(stack) *this_, GENERIC(stack_view) *view)
+{
+    STACK_PTR_VALIDATE(this_);
+    STACK_WRITE_SCOPE(this_);
+    assert(ptrValid(view));
+
+    view->begin      = NULL;
+    view->end        = NULL;
+    view->stack      = this_;
+    view->generation = STACK_SIZE_T_POISON;
+
+    stack_status status = STACK_HEALTH_CHECK(this_);
+    if (status)
+        return status;
+
+    view->begin      = this_->data;
+    view->end        = this_->data + this_->len;
+    view->generation = this_->generation;
+    return status;
+}
+
+
+static bool GENERIC(stack_viewValid)(const GENERIC(stack_view) *view)
+{
+    assert(ptrValid(view));
+
+    const GENERIC(stack) *stack = view->stack;
+    return view->begin != NULL && ptrValid(stack) &&
+           view->generation == stack->generation && view->begin == stack->data &&
+           (size_t)(view->end - view->begin) <= stack->len;
+}
+
+
+static stack_status GENERIC(stack_reallocate)(GENERIC(stack) *this_, size_t newCapacity)
+{
+    STACK_HEALTH_CHECK(this_);
+
+    #ifdef STACK_USE_ASYNC_CHECK
+        stack_watchWait(this_->watch);                                  // old data is freed below
+    #endif
+
+    stack_status status = STACK_OK;
+
+    if (GENERIC(stack_isInline)(this_) && newCapacity <= GENERIC(stack_inlineCapacity)())       // inline storage is never shrinked
+        return STACK_HEALTH_CHECK(this_);
+
+    #ifdef STACK_USE_POISON
+        size_t requestedCapacity = newCapacity;
+
+        if (newCapacity < this_->capacity)
+        {
+            memset((char*)(this_->data + newCapacity), STACK_FREED_POISON, (this_->capacity - newCapacity) * sizeof(STACK_TYPE));
+        }
+    #endif
+
+    #ifdef STACK_USE_STATS
+        bool wasMapped = this_->mappedSize != 0;
+    #endif
+
+    STACK_CANARY_TYPE *newDataWrapper = NULL;
+    if (GENERIC(stack_isInline)(this_)) {                                           // the first heap allocation
+        newDataWrapper = (STACK_CANARY_TYPE*)stack_storageAlloc(this_->allocator, GENERIC(stack_allocated_size)(newCapacity), &this_->mappedSize);
+        if (newDataWrapper != NULL)
+            memcpy(newDataWrapper, this_->dataWrapper, GENERIC(stack_allocated_size)(this_->capacity));
+    }
+    else if (newCapacity <= GENERIC(stack_inlineCapacity)() && !this_->allocator->persistent) {   // data fits the struct again
+        memcpy(this_->inlineWrapper, this_->dataWrapper, GENERIC(stack_allocated_size)(newCapacity));
+        #ifdef STACK_USE_GUARD_PAGES
+            stack_guardRemove(this_);
+        #endif
+        stack_storageFree(this_->allocator, this_->dataWrapper, this_->mappedSize);
+        this_->mappedSize = 0;
+
+        newDataWrapper = this_->inlineWrapper;
+        newCapacity    = GENERIC(stack_inlineCapacity)();
+    }
+    else {
+        newDataWrapper = (STACK_CANARY_TYPE*)stack_storageRealloc(this_->allocator, this_->dataWrapper, &this_->mappedSize,
+                                                            GENERIC(stack_allocated_size)(this_->capacity), GENERIC(stack_allocated_size)(newCapacity));
+    }
+
+    if (newDataWrapper == NULL)             // reallocation failed
+    {
+        #ifdef STACK_USE_PTR_POISON
+            newDataWrapper = (STACK_CANARY_TYPE*)STACK_INVALID_PTR;
+        #endif
+        return STACK_BAD_MEM_ALLOC;
+    }
+
+    this_->generation += 1;
+
+    #ifdef STACK_USE_STATS
+        this_->stats.reallocations += 1;
+        if (this_->dataWrapper != newDataWrapper && !(wasMapped && this_->mappedSize != 0))        // `mremap` moves pages, not bytes
+            this_->stats.bytesCopied += GENERIC(stack_allocated_size)(fmin(this_->capacity, newCapacity));
+    #endif
+
+    if (this_->dataWrapper != newDataWrapper) { 
+        this_->dataWrapper = newDataWrapper;
+        this_->data = (STACK_TYPE*)(this_->dataWrapper + STACK_DATA_WRAPPER_LEN);
+    }
+
+    #ifdef STACK_USE_USABLE_SIZE
+        if (!GENERIC(stack_isInline)(this_) &&
+            (this_->mappedSize != 0 || (newCapacity > this_->capacity && STACK_GROWTH_POLICY == STACK_GROWTH_USABLE_SIZE))) {     // takes the slack allocator has given anyway
+            size_t usableSize = stack_storageUsableSize(this_->allocator, newDataWrapper, this_->mappedSize);
+            if (usableSize > GENERIC(stack_allocated_size)(newCapacity)) {
+                size_t usableCapacity = (usableSize - 2 * STACK_DATA_WRAPPER_LEN * sizeof(STACK_CANARY_TYPE)) / sizeof(STACK_TYPE);
+                usableCapacity -= usableCapacity % GENERIC(stack_capacityStep)();
+                if (usableCapacity > newCapacity)
+                    newCapacity = usableCapacity;
+            }
+        }
+    #endif
+
+    #ifdef STACK_USE_DATA_HASH_BLOCKS
+        if (!GENERIC(stack_resizeBlocks)(this_, newCapacity)) {
+            newCapacity = this_->capacity;                        // data is already bigger, stack just keeps the old capacity
+            status = STACK_BAD_MEM_ALLOC;
+        }
+    #endif
+
+    #ifdef STACK_USE_POISON
+        size_t poisonFrom = fmin(requestedCapacity, this_->capacity);             // shrinked capacity could be raised back to the usable size
+        if (newCapacity > poisonFrom)
+            memset((char*)(this_->data + poisonFrom), STACK_ELEM_POISON, (newCapacity - poisonFrom) * sizeof(STACK_TYPE));
+    #endif
+
+    this_->capacity = newCapacity;
+    this_->residentCapacity = newCapacity;
+    this_->deferredCapacity = 0;
+
+    #ifdef STACK_USE_STATS
+        if (newCapacity > this_->stats.peakCapacity)
+            this_->stats.peakCapacity = newCapacity;
+    #endif
+
+    #ifdef STACK_USE_DATA_CANARY
+        for (size_t i = 0; i < STACK_DATA_WRAPPER_LEN; ++i) {
+            RIGHT_CANARY_WRAPPER[i] = STACK_RIGHT_CANARY_POISON;
+        }
+    #endif
+
+    #ifdef STACK_USE_GUARD_PAGES
+        if (!GENERIC(stack_isInline)(this_) && !this_->allocator->persistent)
+            GENERIC(stack_guardRegister)(this_);
+    #endif
+
+    #ifdef STACK_USE_STRUCT_HASH
+        this_->structHash = GENERIC(stack_calculateStructHash)(this_);
+    #endif
+
+
+    return status | STACK_HEALTH_CHECK(this_);
+}
+
+
+#ifdef STACK_USE_DATA_HASH_BLOCKS
+    static bool GENERIC(stack_resizeBlocks)(GENERIC(stack) *this_, size_t newCapacity)
+    {
+        size_t oldBlockCount = GENERIC(stack_blockCount)(this_->capacity);
+        size_t newBlockCount = GENERIC(stack_blockCount)(newCapacity);
+        if (newBlockCount == oldBlockCount)
+            return true;
+
+        uint32_t *newBlockHashes = (uint32_t*)realloc(this_->blockHashes, fmax(newBlockCount, 1) * sizeof(uint32_t));
+        if (newBlockHashes != NULL)
+            this_->blockHashes = newBlockHashes;
+
+        uint64_t *newDirtyBlocks = (uint64_t*)realloc(this_->dirtyBlocks, fmax((newBlockCount + 63) / 64, 1) * sizeof(uint64_t));
+        if (newDirtyBlocks != NULL)
+            this_->dirtyBlocks = newDirtyBlocks;
+
+        if (newBlockCount > oldBlockCount && (newBlockHashes == NULL || newDirtyBlocks == NULL))
+            return false;
+
+        if (newBlockCount > oldBlockCount) {
+            memset(this_->blockHashes + oldBlockCount, 0, (newBlockCount - oldBlockCount) * sizeof(uint32_t));
+            memset(this_->dirtyBlocks + (oldBlockCount + 63) / 64, 0, ((newBlockCount + 63) / 64 - (oldBlockCount + 63) / 64) * sizeof(uint64_t));
+        }
+        return true;
+    }
+#endif
+
+
+static stack_status GENERIC(stack_grow)(GENERIC(stack) *this_, size_t required)
+{
+    size_t newCapacity = this_->capacity;
+    while (newCapacity < required)
+        newCapacity = GENERIC(stack_expandFactorCalc)(newCapacity);
+    if (newCapacity < this_->deferredCapacity)
+        newCapacity = this_->deferredCapacity;
+
+    return GENERIC(stack_reallocate)(this_, newCapacity);
+}
+
+
+static stack_status GENERIC(stack_release)(GENERIC(stack) *this_, size_t capacity)
+{
+    if (capacity >= this_->residentCapacity)
+        return STACK_OK;
+
+    #if defined(STACK_SHRINK_ADVICE) && !defined(STACK_USE_POISON)     // released pages read as zeros, poison would be lost
+        if (this_->mappedSize != 0) {                                   // mapping keeps its size, regrowth needs no remap
+            size_t page  = stack_pageSize();
+            size_t begin = ((size_t)(this_->data + capacity) + page - 1) / page * page;
+            size_t end   = (size_t)(this_->data + this_->capacity) / page * page;
+            if (begin < end)
+                madvise((void*)begin, end - begin, STACK_SHRINK_ADVICE);
+
+            this_->residentCapacity = capacity;
+            #ifdef STACK_USE_STRUCT_HASH
+                this_->structHash = GENERIC(stack_calculateStructHash)(this_);
+            #endif
+            return STACK_OK;
+        }
+    #endif
+
+    if (capacity >= this_->capacity)
+        return STACK_OK;
+
+    return GENERIC(stack_reallocate)(this_, capacity);
+}
+
+
+#ifdef AUTO_SHRINK
+    static void GENERIC(stack_autoShrink)(GENERIC(stack) *this_)
+    {
+        size_t target    = GENERIC(stack_shrinkageFactorCalc)(this_->residentCapacity);
+        size_t threshold = GENERIC(stack_shrinkageFactorCalc)(target);      // hysteresis: len is less than half of target after release
+
+        if (this_->len < threshold && target >= STACK_STARTING_CAPACITY && target < this_->residentCapacity && !GENERIC(stack_isInline)(this_))
+            this_->status |= GENERIC(stack_release)(this_, target);
+    }
+#endif
+
+
+#ifdef STACK_USE_GUARD_PAGES
+    static void GENERIC(stack_guardRegister)(const GENERIC(stack) *this_)
+    {
+        char *leftGuard  = (char*)this_->dataWrapper - stack_pageSize();
+        char *rightGuard = (char*)this_->dataWrapper + this_->mappedSize;
+        stack_guardSet((void*)this_, leftGuard, rightGuard, GENERIC(stack_guardFault));
+    }
+
+
+    static void GENERIC(stack_guardFault)(void *stack, int status)
+    {
+        GENERIC(stack) *this_ = (GENERIC(stack)*)stack;
+
+        this_->status |= status;
+        GENERIC(stack_dump)(this_);
+        fflush(this_->logStream);
+    }
+#endif
+
+
+static stack_status GENERIC(stack_reserve)(GENERIC(stack) *this_, size_t capacity)
+{
+    STACK_PTR_VALIDATE(this_);
+    STACK_WRITE_SCOPE(this_);
+
+    if (STACK_HEALTH_CHECK(this_))
+        return this_->status;
+
+    if (capacity <= this_->capacity)
+        return this_->status;
+
+    if (capacity > stack_maxCapacity(sizeof(STACK_TYPE), STACK_DATA_WRAPPER_LEN)) {
+        this_->status |= STACK_BAD_MEM_ALLOC;
+        return this_->status;
+    }
+
+    this_->status |= GENERIC(stack_reallocate)(this_, GENERIC(stack_alignCapacity)(capacity));
+    return this_->status;
+}
+
+
+static stack_status GENERIC(stack_trim)(GENERIC(stack) *this_)
+{
+    STACK_PTR_VALIDATE(this_);
+    STACK_WRITE_SCOPE(this_);
+
+    if (STACK_HEALTH_CHECK(this_))
+        return this_->status;
+
+    this_->status |= GENERIC(stack_release)(this_, GENERIC(stack_alignCapacity)(this_->len));
+    return this_->status;
+}
+
+
+static stack_status GENERIC(stack_shrinkToFit)(GENERIC(stack) *this_)
+{
+    STACK_PTR_VALIDATE(this_);
+    STACK_WRITE_SCOPE(this_);
+
+    if (STACK_HEALTH_CHECK(this_))
+        return this_->status;
+
+    size_t newCapacity = GENERIC(stack_alignCapacity)(this_->len);
+    if (newCapacity >= this_->capacity)
+        return this_->status;
+
+    this_->status |= GENERIC(stack_reallocate)(this_, newCapacity);
+    return this_->status;
+}
+
+
+static stack_status GENERIC(stack_clear)(GENERIC(stack) *this_)
+{
+    STACK_WRITE_SCOPE(this_);
+    const stack_allocator *allocator = this_->allocator;
+    size_t generation = this_->generation;
+    #ifdef STACK_USE_ASYNC_CHECK
+        stack_watch *watch = this_->watch;
+    #endif
+    #ifdef STACK_USE_STATS
+        stack_stats stats = this_->stats;
+    #endif
+
+    stack_status status = GENERIC(stack_dtor)(this_);
+    if (status != 0)
+        return status;
+    status = GENERIC(stack_ctorAllocator)(this_, STACK_STARTING_CAPACITY, allocator);
+    this_->generation = generation + 1;                                 // views of the freed data stay invalid
+    #ifdef STACK_USE_STRUCT_HASH
+        this_->structHash = GENERIC(stack_calculateStructHash)(this_);
+    #endif
+
+    #ifdef STACK_USE_ASYNC_CHECK
+        this_->watch = watch;
+    #endif
+    #ifdef STACK_USE_STATS
+        this_->stats = stats;                                           // counters live as long as the stack, not its data
     #endif
-
-    return STACK_HEALTH_CHECK(this_);
+    return status;
 }
 
 
-static stack_status GENERIC(stack_push)(GENERIC(stack) *this_, STACK_TYPE item)
-{
-    STACK_PTR_VALIDATE(this_);
+#ifdef STACK_USE_FILE
+    static stack_status GENERIC(stack_open)(GENERIC(stack) *this_, const char *path, size_t capacity)
+    {
+        STACK_PTR_VALIDATE(this_);
+        assert(ptrValid(path));
 
-    if (STACK_HEALTH_CHECK(this_))
-        return this_->status;
-    
-    FILE *out = this_->logStream;       //TODO
-   
-    if (this_->len == this_->capacity) {
-        this_->status |= GENERIC(stack_reallocate)(this_, GENERIC(stack_expandFactorCalc)(this_->capacity));
-    }
-    
+        const size_t wrapperSize = STACK_DATA_WRAPPER_LEN * sizeof(STACK_CANARY_TYPE);
 
-    #ifdef STACK_USE_POISON  
-        if (!GENERIC(stack_isPoisoned)(&this_->data[this_->len])) {
-            STACK_LOG_TO_STREAM(this_, out, "Stack structure corrupt, element was modified!");
-            this_->status |= STACK_DATA_INTEGRITY_VIOLATED;
+        stack_file *file = stack_fileOpen(path);
+        if (file == NULL) {
+            this_->status = STACK_BAD_MEM_ALLOC;
+            return this_->status;
         }
-    #endif
-    
-    #if defined(STACK_USE_CANARY) && defined(STACK_USE_POISON)
-        if ((STACK_CANARY_TYPE)this_->data[this_->len] == STACK_RIGHT_CANARY_POISON) {
-            STACK_LOG_TO_STREAM(this_, out, "WARNING: Requested elem in wrapper, stack didn't reallocate?");
-            this_->status |= STACK_BAD_MEM_ALLOC;
+
+        if (file->size == 0) {                                          // new file gets a fresh stack and an empty commit
+            stack_status status = GENERIC(stack_ctorStorage)(this_, capacity, &file->allocator, false);
+            if (status & STACK_BAD_MEM_ALLOC) {
+                stack_fileRelease(file);
+                return status;
+            }
+
+            stack_fileHeaderInit(file, sizeof(STACK_TYPE), wrapperSize);
+            return GENERIC(stack_sync)(this_);
         }
-    #endif  
 
-    this_->data[this_->len] = item;
-    this_->len += 1;
+        if (!stack_fileMap(file, file->size)) {
+            stack_fileRelease(file);
+            this_->status = STACK_BAD_MEM_ALLOC;
+            return this_->status;
+        }
 
-    #ifdef STACK_USE_DATA_HASH
-        this_->dataHash = GENERIC(stack_calculateDataHash)(this_);
-    #endif
+        size_t len = 0;
+        if (!stack_fileHeaderValid(file, sizeof(STACK_TYPE), wrapperSize)) {
+            stack_fileRelease(file);
+            this_->status = STACK_DATA_INTEGRITY_VIOLATED;
+            return this_->status;
+        }
 
-    #ifdef STACK_USE_STRUCT_HASH
-        this_->structHash = GENERIC(stack_calculateStructHash)(this_);
-    #endif
+        capacity  = (file->size - STACK_FILE_HEADER_SIZE - 2 * wrapperSize) / sizeof(STACK_TYPE);
+        capacity -= capacity % GENERIC(stack_capacityStep)();
 
+        if (!stack_fileRecover(file, file->base + STACK_FILE_HEADER_SIZE + wrapperSize, capacity, sizeof(STACK_TYPE), &len)) {
+            stack_fileRelease(file);
+            this_->status = STACK_DATA_INTEGRITY_VIOLATED;
+            return this_->status;
+        }
 
-    return STACK_HEALTH_CHECK(this_);
-}
+        stack_status status = GENERIC(stack_ctorDeferred)(this_, 0, &file->allocator);        // fields of an empty stack, data is adopted below
+        #ifdef STACK_USE_DATA_HASH_BLOCKS
+            if (!(status & STACK_BAD_MEM_ALLOC) && !GENERIC(stack_resizeBlocks)(this_, capacity)) {
+                GENERIC(stack_dtor)(this_);
+                status = STACK_BAD_MEM_ALLOC;
+            }
+        #endif
+        if (status & STACK_BAD_MEM_ALLOC) {
+            stack_fileRelease(file);
+            this_->status = status;
+            return status;
+        }
 
+        this_->dataWrapper      = (STACK_CANARY_TYPE*)(file->base + STACK_FILE_HEADER_SIZE);
+        this_->data             = (STACK_TYPE*)(this_->dataWrapper + STACK_DATA_WRAPPER_LEN);
+        this_->capacity         = capacity;
+        this_->residentCapacity = capacity;
+        this_->deferredCapacity = 0;
+        this_->len              = len;
 
-static stack_status GENERIC(stack_pop)(GENERIC(stack) *this_, STACK_TYPE *item)
-{
-    STACK_PTR_VALIDATE(this_);
+        #ifdef STACK_USE_POISON                                         // elems pushed after the sync are dropped
+            memset((char*)(this_->data + len), STACK_ELEM_POISON, (capacity - len) * sizeof(STACK_TYPE));
+        #endif
 
-    if (STACK_HEALTH_CHECK(this_))
-        return this_->status;
-    
-    if (this_->len == 0) {
-        STACK_LOG_TO_STREAM(this_, this_->logStream, "WARNING: trying to pop from empty stack!");
-    }
+        #ifdef STACK_USE_DATA_CANARY                                    // torn growth could miss the right canary, the left one is checked as is
+            for (size_t i = 0; i < STACK_DATA_WRAPPER_LEN; ++i)
+                RIGHT_CANARY_WRAPPER[i] = STACK_RIGHT_CANARY_POISON;
+        #endif
 
-    this_->len -= 1;
+        #ifdef STACK_USE_DATA_HASH
+            GENERIC(stack_dataHashPush)(this_, len);
+        #endif
 
-    if (ptrValid(item)) {   
-        *item = this_->data[this_->len];
-        #ifdef STACK_USE_POISON 
-            if (GENERIC(stack_isPoisoned)(item)) {                               
-                STACK_LOG_TO_STREAM(this_, this_->logStream, "WARNING: accessed uninitilized element!");
-            }
+        #ifdef STACK_USE_STATS
+            this_->stats.peakLen      = len;
+            this_->stats.peakCapacity = capacity;
         #endif
-    }
 
-    #ifdef STACK_USE_POISON
-        memset((char*)(&this_->data[this_->len]), STACK_ELEM_POISON, sizeof(STACK_TYPE));
-    #endif
-   
-    #ifdef AUTO_SHRINK
-        size_t newCapacity = GENERIC(stack_shrinkageFactorCalc)(this_->capacity);
+        #ifdef STACK_USE_STRUCT_HASH
+            this_->structHash = GENERIC(stack_calculateStructHash)(this_);
+        #endif
 
-        if (this_->len < newCapacity && this_->capacity > newCapacity)
-        {
-            stack_reallocate(this_, newCapacity);
+        status = STACK_HEALTH_CHECK(this_);
+        if (len != ((stack_file_header*)file->base)->commits[file->slot].len) {
+            STACK_LOG_TO_STREAM(this_, this_->logStream, "WARNING: committed elems were overwritten, stack is rolled back to the last consistent len");
+            status |= GENERIC(stack_sync)(this_);
         }
-    #endif
-
-    #ifdef STACK_USE_DATA_HASH
-        this_->dataHash = GENERIC(stack_calculateDataHash)(this_);
-    #endif
+        return status;
+    }
 
-    #ifdef STACK_USE_STRUCT_HASH
-        this_->structHash = GENERIC(stack_calculateStructHash)(this_);
-    #endif
 
-    return STACK_HEALTH_CHECK(this_);
-}
+    static stack_status GENERIC(stack_sync)(GENERIC(stack) *this_)
+    {
+        STACK_PTR_VALIDATE(this_);
 
-static stack_status GENERIC(stack_top)(GENERIC(stack) *this_, STACK_TYPE **item)
-{
-    STACK_PTR_VALIDATE(this_);
+        if (STACK_HEALTH_CHECK(this_) || !this_->allocator->persistent)
+            return this_->status;
 
-    if (STACK_HEALTH_CHECK(this_))
+        if (!stack_fileCommit((stack_file*)this_->allocator->ctx, this_->data, this_->len, sizeof(STACK_TYPE))) {
+            STACK_LOG_TO_STREAM(this_, this_->logStream, "ERROR: stack file couldn't be synced!");
+            return this_->status | STACK_BAD_MEM_ALLOC;
+        }
         return this_->status;
-    
-    if (this_->len == 0) {
-        STACK_LOG_TO_STREAM(this_, this_->logStream, "WARNING: trying to pop from empty stack!");
     }
 
-    if (ptrValid(item)) {
-        *item = &this_->data[this_->len - 1];
+
+    static stack_status GENERIC(stack_close)(GENERIC(stack) *this_)
+    {
+        STACK_PTR_VALIDATE(this_);
+
+        stack_file *file = ptrValid(this_->allocator) && this_->allocator->persistent ? (stack_file*)this_->allocator->ctx : NULL;
+
+        stack_status status = GENERIC(stack_sync)(this_);
+        status |= GENERIC(stack_dtor)(this_);
+        if (file != NULL)
+            stack_fileRelease(file);
+        return status;
     }
+#endif
 
-    return STACK_HEALTH_CHECK(this_);
-}
 
-static stack_status GENERIC(stack_get)(GENERIC(stack) *this_, size_t pos, STACK_TYPE **item)
-{
-    STACK_PTR_VALIDATE(this_);
+#ifdef STACK_USE_STATS
+    static stack_status GENERIC(stack_statsSnapshot)(const GENERIC(stack) *this_, stack_stats *stats)
+    {
+        STACK_PTR_VALIDATE(this_);
+        assert(ptrValid(stats));
 
-    if (STACK_HEALTH_CHECK(this_))
+        memcpy((char*)stats, &this_->stats, sizeof(stack_stats));
         return this_->status;
-    
-    if (pos >= this_->len) {
-        STACK_LOG_TO_STREAM(this_, this_->logStream, "ERROR: bad position provided to stack_get!");
-        *item = NULL;
     }
 
-    if (ptrValid(item)) {
-        *item = &this_->data[pos];
-    }
 
-    return STACK_HEALTH_CHECK(this_);
-}
+    static stack_status GENERIC(stack_statsReset)(GENERIC(stack) *this_)
+    {
+        STACK_PTR_VALIDATE(this_);
+        STACK_WRITE_SCOPE(this_);
 
+        memset((char*)&this_->stats, 0, sizeof(stack_stats));
+        this_->stats.peakLen      = this_->len;
+        this_->stats.peakCapacity = this_->capacity;
+        return this_->status;
+    }
+#endif
 
-static stack_status GENERIC(stack_reallocate)(GENERIC(stack) *this_, const size_t newCapacity)
-{
-    STACK_HEALTH_CHECK(this_);
 
-    #ifdef STACK_USE_POISON
-        if (newCapacity < this_->capacity)
-        {
-            memset((char*)(this_->data + newCapacity), STACK_FREED_POISON, (this_->capacity - newCapacity) * sizeof(STACK_TYPE));
+#ifdef STACK_USE_ASYNC_CHECK
+    static stack_status GENERIC(stack_verifierWatch)(GENERIC(stack) *this_, stack_verifier *verifier, void (*callback)(void *stack, int status, void *ctx), void *ctx)
+    {
+        STACK_PTR_VALIDATE(this_);
+        assert(ptrValid(verifier));
+
+        stack_watch *watch = NULL;
+
+        pthread_mutex_lock(&verifier->lock);
+        for (size_t i = 0; i < STACK_VERIFIER_CAPACITY && this_->watch == NULL; ++i) {
+            if (verifier->watches[i].stack == NULL) {
+                watch = &verifier->watches[i];
+                watch->version  = 0;
+                watch->depth    = 0;
+                watch->reading  = 0;
+                watch->status   = STACK_OK;
+                watch->verify   = GENERIC(stack_verifySnapshot);
+                watch->callback = callback;
+                watch->ctx      = ctx;
+                watch->stack    = this_;
+                this_->watch    = watch;
+            }
         }
-    #endif
+        pthread_mutex_unlock(&verifier->lock);
 
-    STACK_CANARY_TYPE *newDataWrapper = (STACK_CANARY_TYPE*)realloc(this_->dataWrapper, GENERIC(stack_allocated_size)(newCapacity));
-    if (newDataWrapper == NULL)             // reallocation failed
-    {
-        #ifdef STACK_USE_PTR_POISON
-            newDataWrapper = (STACK_CANARY_TYPE*)STACK_INVALID_PTR;
-        #endif
-        return STACK_BAD_MEM_ALLOC;
+        if (watch == NULL) {
+            if (STACK_VERBOSE >= 1)
+                fprintf(this_->logStream, "ERROR: stack is already watched or verifier is full\n");
+            this_->status |= STACK_BAD_MEM_ALLOC;
+        }
+        return this_->status;
     }
 
-    if (this_->dataWrapper != newDataWrapper) { 
-        this_->dataWrapper = newDataWrapper;
-        this_->data = (STACK_TYPE*)(this_->dataWrapper + STACK_CANARY_WRAPPER_LEN);
+
+    static stack_status GENERIC(stack_verifierUnwatch)(GENERIC(stack) *this_, stack_verifier *verifier)
+    {
+        STACK_PTR_VALIDATE(this_);
+        assert(ptrValid(verifier));
+
+        pthread_mutex_lock(&verifier->lock);                            // waits for the current pass
+        if (this_->watch != NULL) {
+            this_->status |= this_->watch->status;
+            this_->watch->stack = NULL;
+            this_->watch = NULL;
+        }
+        pthread_mutex_unlock(&verifier->lock);
+
+        return this_->status;
     }
 
-    #ifdef STACK_USE_POISON
-        if (newCapacity > this_->capacity)
-            memset((char*)(this_->data + this_->capacity), STACK_ELEM_POISON, (newCapacity - this_->capacity) * sizeof(STACK_TYPE));
-    #endif
 
-    this_->capacity = newCapacity;
+    static bool GENERIC(stack_verifySnapshot)(void *stack, stack_watch *watch, int *status)
+    {
+        const GENERIC(stack) *live = (const GENERIC(stack)*)stack;
 
-    #ifdef STACK_USE_CANARY
-        for (size_t i = 0; i < STACK_CANARY_WRAPPER_LEN; ++i) {
-            RIGHT_CANARY_WRAPPER[i] = STACK_RIGHT_CANARY_POISON;
+        __atomic_store_n(&watch->reading, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);                        // pairs with `stack_watchWait`
+        uint64_t version = __atomic_load_n(&watch->version, __ATOMIC_ACQUIRE);
+        if (version & 1) {
+            __atomic_store_n(&watch->reading, 0, __ATOMIC_RELEASE);
+            return false;
         }
-    #endif
 
-    #ifdef STACK_USE_DATA_HASH
-        this_->dataHash = GENERIC(stack_calculateDataHash)(this_);
-    #endif
+        GENERIC(stack) snapshot;                                        // data pointers and capacity are stable while we are reading,
+        memcpy((void*)&snapshot, live, sizeof(GENERIC(stack)));         // anything else is validated by version afterwards
 
-    #ifdef STACK_USE_STRUCT_HASH
-        this_->structHash = GENERIC(stack_calculateStructHash)(this_);
-    #endif
+        bool isInline = snapshot.dataWrapper == live->inlineWrapper;
+        bool hasData  = !isInline && snapshot.capacity != STACK_SIZE_T_POISON && ptrValid(snapshot.dataWrapper);
+        stack_status found = STACK_OK;
 
+        STACK_CANARY_TYPE *dataWrapper = NULL;
+        if (hasData) {
+            dataWrapper = (STACK_CANARY_TYPE*)malloc(GENERIC(stack_allocated_size)(snapshot.capacity));
+            if (dataWrapper != NULL)
+                memcpy((char*)dataWrapper, snapshot.dataWrapper, GENERIC(stack_allocated_size)(snapshot.capacity));
+        }
 
-    return STACK_HEALTH_CHECK(this_);
-}
+        #ifdef STACK_USE_CAPACITY_SYS_CHECK
+            if (hasData) {
+                size_t realCapacity = GENERIC(stack_getRealCapacity)(&snapshot);
+                if (realCapacity != STACK_SIZE_T_POISON && realCapacity < snapshot.capacity)
+                    found |= STACK_BAD_CAPACITY;
+            }
+        #endif
 
+        #ifdef STACK_USE_DATA_HASH_BLOCKS
+            uint32_t *blockHashes = NULL;
+            uint64_t *dirtyBlocks = NULL;
+            size_t blockCount = 0;
+            if ((isInline || hasData) && ptrValid(snapshot.blockHashes)) {          // inline data still has block tables on heap
+                blockCount  = GENERIC(stack_blockCount)(snapshot.capacity);
+                blockHashes = (uint32_t*)malloc(blockCount * sizeof(uint32_t) + 1);
+                dirtyBlocks = (uint64_t*)malloc((blockCount + 63) / 64 * sizeof(uint64_t) + 1);
+                if (blockHashes != NULL)
+                    memcpy((char*)blockHashes, snapshot.blockHashes, blockCount * sizeof(uint32_t));
+            }
+        #endif
 
-static stack_status GENERIC(stack_clear)(GENERIC(stack) *this_)
-{
-    stack_status status = GENERIC(stack_dtor)(this_);
-    if (status != 0)
-        return status;
-    status = GENERIC(stack_ctor)(this_);
-    return status;
-}
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        bool torn = __atomic_load_n(&watch->version, __ATOMIC_RELAXED) != version;
+        __atomic_store_n(&watch->reading, 0, __ATOMIC_RELEASE);
+
+        if (!torn && (!hasData || dataWrapper != NULL)) {
+            #ifdef STACK_USE_STRUCT_HASH
+                if (GENERIC(stack_calculateStructHash)(&snapshot) != snapshot.structHash)
+                    found |= STACK_BAD_STRUCT_HASH;
+            #endif
+
+            if (isInline || hasData) {                                  // snapshot is made self-contained, then checked as a usual stack
+                snapshot.dataWrapper = isInline ? snapshot.inlineWrapper : dataWrapper;
+                snapshot.data        = (STACK_TYPE*)(snapshot.dataWrapper + STACK_DATA_WRAPPER_LEN);
+                snapshot.mappedSize  = 0;
+                snapshot.allocator   = &STACK_ALLOCATOR_MALLOC;
+                snapshot.watch       = NULL;
+                snapshot.status      = STACK_OK;
+                #ifdef STACK_USE_DATA_HASH_BLOCKS
+                    if (dirtyBlocks != NULL)
+                        memset((char*)dirtyBlocks, 0xFF, (blockCount + 63) / 64 * sizeof(uint64_t));      // every block is verified
+                    snapshot.blockHashes = blockHashes;
+                    snapshot.dirtyBlocks = dirtyBlocks;
+                    snapshot.badBlock    = STACK_SIZE_T_POISON;
+                #elif defined(STACK_USE_DATA_HASH_WATERMARK)
+                    snapshot.verifiedLen  = 0;                          // every elem is verified
+                    snapshot.verifiedHash = 0;
+                    snapshot.rescanLen    = 0;
+                    snapshot.rescanHash   = 0;
+                #endif
+                #ifdef STACK_USE_STRUCT_HASH
+                    snapshot.structHash = GENERIC(stack_calculateStructHash)(&snapshot);
+                #endif
+                found |= GENERIC(stack_healthCheck)(&snapshot);
+            }
+            else if (snapshot.capacity != STACK_SIZE_T_POISON) {
+                found |= STACK_BAD_DATA_PTR;
+            }
+        }
+
+        free(dataWrapper);
+        #ifdef STACK_USE_DATA_HASH_BLOCKS
+            free(blockHashes);
+            free(dirtyBlocks);
+        #endif
+
+        *status = found;
+        return !torn && (!hasData || dataWrapper != NULL);
+    }
+#endif
 
 
 static stack_status GENERIC(stack_dumpToStream)(const GENERIC(stack) *this_, FILE *out)
@@ -441,33 +2924,17 @@ static stack_status GENERIC(stack_dumpToStream)(const GENERIC(stack) *this_, FIL
     fprintf(out, "|----------------\n");
 
     fprintf(out, "| Current status = %d\n", this_->status); 
-    if (this_->status & STACK_BAD_STRUCT_PTR)
-        fprintf(out, "| Bad self ptr \n");
-    if (this_->status & STACK_BAD_MEM_ALLOC)
-        fprintf(out, "| Bad memory allocation \n");
-    if (this_->status & STACK_INTEGRITY_VIOLATED)
-        fprintf(out, "| Stack integrity violated \n");
-    if (this_->status & STACK_DATA_INTEGRITY_VIOLATED)
-        fprintf(out, "| Data integrity violated \n");
-    if (this_->status & STACK_LEFT_STRUCT_CANARY_CORRUPT)
-        fprintf(out, "| Left structure canary corrupted \n");
-    if (this_->status & STACK_RIGHT_STRUCT_CANARY_CORRUPT)
-        fprintf(out, "| Right structure canary corrupted \n");
-    if (this_->status & STACK_LEFT_DATA_CANARY_CORRUPT)
-        fprintf(out, "| Left data canary corrupted \n");
-    if (this_->status & STACK_RIGHT_DATA_CANARY_CORRUPT)
-        fprintf(out, "| Right data canary corrupted \n");
-    if (this_->status & STACK_BAD_STRUCT_HASH)
-        fprintf(out, "| Bad structure hash, stack may be corrupted \n");
-    if (this_->status & STACK_BAD_DATA_HASH)
-        fprintf(out, "| Bad data hash, stack data may be corrupted \n");
-    if (this_->status & STACK_BAD_CAPACITY)
-        fprintf(out, "| Bad capacity, capacity value differs from the allocated one\n");
+    stack_statusToStream(this_->status, out);
+    #ifdef STACK_USE_DATA_HASH_BLOCKS
+        if ((this_->status & STACK_BAD_DATA_HASH) && this_->badBlock != STACK_SIZE_T_POISON)
+            fprintf(out, "| Bad data block %zu, elems from %zu to %zu \n", this_->badBlock,
+                    this_->badBlock * GENERIC(stack_blockLen)(), (this_->badBlock + 1) * GENERIC(stack_blockLen)() - 1);
+    #endif
 
     size_t capacity = this_->capacity;
     #ifdef STACK_USE_CAPACITY_SYS_CHECK
         if (this_->status & STACK_BAD_CAPACITY) {
-            capacity = GENERIC(stack_getRealCapacity)(this_->dataWrapper);
+            capacity = GENERIC(stack_getRealCapacity)(this_);
             if (capacity == STACK_SIZE_T_POISON) {
                 capacity = this_->capacity;
             }
@@ -482,7 +2949,7 @@ static stack_status GENERIC(stack_dumpToStream)(const GENERIC(stack) *this_, FIL
         #endif
         fprintf(out, "| Len              = %zu\n", this_->len);
         fprintf(out, "| Data wrapper ptr = %p\n",  this_->dataWrapper);
-        fprintf(out, "| Data ptr         = %p\n",  this_->data);
+        fprintf(out, "| Data ptr         = %p%s\n", this_->data, GENERIC(stack_isInline)(this_) ? " (inline)" : "");
         fprintf(out, "| Elem size        = %zu\n", sizeof(STACK_TYPE));
         #ifdef STACK_USE_STRUCT_HASH
             fprintf(out, "| Struct hash      = %zu\n", this_->structHash);
@@ -490,65 +2957,70 @@ static stack_status GENERIC(stack_dumpToStream)(const GENERIC(stack) *this_, FIL
         #ifdef STACK_USE_DATA_HASH
             fprintf(out, "| Data hash        = %zu\n", this_->dataHash);
         #endif
-        fprintf(out, "|   {\n");
+        if (!ptrValid(this_->dataWrapper)) {                  // stack that failed to allocate has nothing to print
+            fprintf(out, "|   { bad data ptr }\n");
+        }
+        else {
+            fprintf(out, "|   {\n");
 
-        #ifdef STACK_USE_CANARY                    //TODO read about graphviz 
-            for (size_t i = 0; i < STACK_CANARY_WRAPPER_LEN; ++i) {                 
-                    fprintf(out, "| l   %llx\n", LEFT_CANARY_WRAPPER[i]);           // `l` for left canary
-            }
-        #endif
+            #ifdef STACK_USE_DATA_CANARY                    //TODO read about graphviz 
+                for (size_t i = 0; i < STACK_DATA_WRAPPER_LEN; ++i) {                 
+                        fprintf(out, "| l   %llx\n", LEFT_CANARY_WRAPPER[i]);           // `l` for left canary
+                }
+            #endif
         
-        size_t cap = fmin(this_->len, capacity);          // in case structure is corrupt and len > capacity
+            size_t cap = fmin(this_->len, capacity);          // in case structure is corrupt and len > capacity
 
-        for (size_t i = 0; i < cap; ++i) {
-                fprintf(out, "| *   " ELEM_PRINTF_FORM "\n", this_->data[i]);      // `*` for in-use cells
-        }
+            for (size_t i = 0; i < cap; ++i) {
+                    fprintf(out, "| *   " ELEM_PRINTF_FORM "\n", this_->data[i]);      // `*` for in-use cells
+            }
 
-        bool printAll = true;
+            bool printAll = true;
     
         
-        #ifdef STACK_USE_POISON
-            if (capacity == this_->capacity) {
-                printAll = false;
-                for (size_t i = this_->len; i < capacity; ++i) {
-                    if (!GENERIC(stack_isPoisoned)(&this_->data[i]))
-                        printAll = true;
+            #ifdef STACK_USE_POISON
+                if (capacity == this_->capacity && this_->len <= capacity) {
+                    printAll = !GENERIC(stack_isRangePoisoned)(&this_->data[this_->len], capacity - this_->len);
                 }
-            }
-        #endif  
+            #endif  
         
 
-        if (capacity < this_->len)
-            printAll = true;
+            if (capacity < this_->len)
+                printAll = true;
 
-        if (capacity - this_->len > 10 && !printAll) {                      // shortens outp of the same poison     
-            fprintf(out, "|     %x\n", this_->data[this_->len]);
-            fprintf(out, "|     %x\n", this_->data[this_->len]);
-            fprintf(out, "|     %x\n", this_->data[this_->len]);
-            fprintf(out, "|     ...\n");
-            fprintf(out, "|     %x\n", this_->data[this_->len]);
-            fprintf(out, "|     %x\n", this_->data[this_->len]);
-        }
-        else {
-            for (size_t i = this_->len; i < capacity; ++i) {
-                fprintf(out, "|     %x\n", this_->data[i]);
+            if (capacity - this_->len > 10 && !printAll) {                      // shortens outp of the same poison     
+                fprintf(out, "|     %x\n", this_->data[this_->len]);
+                fprintf(out, "|     %x\n", this_->data[this_->len]);
+                fprintf(out, "|     %x\n", this_->data[this_->len]);
+                fprintf(out, "|     ...\n");
+                fprintf(out, "|     %x\n", this_->data[this_->len]);
+                fprintf(out, "|     %x\n", this_->data[this_->len]);
             }
-        }
-    
-        #ifdef STACK_USE_CANARY             
-            #ifdef STACK_USE_CAPACITY_SYS_CHECK
-                for (size_t i = 0; i < STACK_CANARY_WRAPPER_LEN; ++i) {
-                    fprintf(out, "| r   %llx\n", ((STACK_CANARY_TYPE*)((char*)this_->dataWrapper + STACK_CANARY_WRAPPER_LEN * sizeof(STACK_CANARY_TYPE) + capacity * sizeof(STACK_TYPE)))[i]);
-                }
-            #else
-                for (size_t i = 0; i < STACK_CANARY_WRAPPER_LEN; ++i) {
-                        fprintf(out, "| r   %llx\n", RIGHT_CANARY_WRAPPER[i]);  // `r` for right canary
+            else {
+                for (size_t i = this_->len; i < capacity; ++i) {
+                    fprintf(out, "|     %x\n", this_->data[i]);
                 }
+            }
+    
+            #ifdef STACK_USE_DATA_CANARY             
+                #ifdef STACK_USE_CAPACITY_SYS_CHECK
+                    for (size_t i = 0; i < STACK_DATA_WRAPPER_LEN; ++i) {
+                        fprintf(out, "| r   %llx\n", ((STACK_CANARY_TYPE*)((char*)this_->dataWrapper + STACK_DATA_WRAPPER_LEN * sizeof(STACK_CANARY_TYPE) + capacity * sizeof(STACK_TYPE)))[i]);
+                    }
+                #else
+                    for (size_t i = 0; i < STACK_DATA_WRAPPER_LEN; ++i) {
+                            fprintf(out, "| r   %llx\n", RIGHT_CANARY_WRAPPER[i]);  // `r` for right canary
+                    }
+                #endif
             #endif
-        #endif
 
-        fprintf(out, "|  }\n");
+            fprintf(out, "|  }\n");
+        }
     }
+
+    #ifdef STACK_USE_STATS
+        stack_statsToStream(&this_->stats, out);
+    #endif
     fprintf(out, "%s\n", STACK_LOG_DELIM);
 
     return this_->status;
@@ -559,6 +3031,17 @@ static stack_status GENERIC(stack_dump)(const GENERIC(stack) *this_)
     return GENERIC(stack_dumpToStream)(this_, this_->logStream);
 }
 
+
+#ifndef STACK_USE_EVENT_LOG
+    static void GENERIC(stack_log)(const GENERIC(stack) *this_, FILE *out, const char *message, const char *func, int line, const char *file)
+    {
+        fprintf(out, "%s\n| %s\n", STACK_LOG_DELIM, message);
+        fprintf(out, "| called from func %s on line %d of file %s\n", func, line, file);
+        GENERIC(stack_dumpToStream)(this_, out);
+    }
+#endif
+
+
 #ifdef STACK_USE_CAPACITY_SYS_CHECK
 static stack_status GENERIC(stack_healthCheck)(GENERIC(stack) *this_)            // healthcheck changes this_->capacity to realCapacity if the current value is definetly wrong
 #else
@@ -566,9 +3049,14 @@ static stack_status GENERIC(stack_healthCheck)(const GENERIC(stack) *this_)
 #endif
 {
     STACK_PTR_VALIDATE(this_);
+    STACK_WRITE_SCOPE(this_);                                           // status and check state are written even by a const check
 
     FILE *out = this_->logStream;
 
+    #ifdef STACK_USE_STATS
+        this_->stats.healthChecks += 1;
+    #endif
+
     if ((this_->capacity == 0 || this_->capacity == STACK_SIZE_T_POISON) &&                     // checks if properly empty
         (this_->len      == 0 || this_->len      == STACK_SIZE_T_POISON)) 
     {
@@ -585,18 +3073,31 @@ static stack_status GENERIC(stack_healthCheck)(const GENERIC(stack) *this_)
     #endif
     }
 
+    #ifdef STACK_USE_ASYNC_CHECK
+        if (this_->watch != NULL)                                       // problems found in background
+            this_->status |= __atomic_load_n(&this_->watch->status, __ATOMIC_RELAXED);
+    #endif
+
     uint64_t hash = 0;
 
     #ifdef STACK_USE_STRUCT_HASH
+    {
+        STACK_STATS_PHASE_SCOPE(this_, STACK_STATS_PHASE_STRUCT_HASH);
         hash = GENERIC(stack_calculateStructHash)(this_);
         if (this_->structHash != hash) 
             this_->status |= STACK_BAD_STRUCT_HASH;
+    }
     #endif
 
     if (this_->len > this_->capacity || this_->capacity > 1e20)
         this_->status |= STACK_INTEGRITY_VIOLATED;
 
+    if (GENERIC(stack_isInline)(this_) && this_->capacity > GENERIC(stack_inlineCapacity)())
+        this_->status |= STACK_BAD_CAPACITY;
+
     #ifdef STACK_USE_CANARY
+    {
+    STACK_STATS_PHASE_SCOPE(this_, STACK_STATS_PHASE_CANARIES);
     for (size_t i = 0; i < STACK_CANARY_WRAPPER_LEN; ++i) {             
         if (this_->leftCanary[i] != STACK_LEFT_CANARY_POISON) {
             this_->status |= STACK_LEFT_STRUCT_CANARY_CORRUPT;
@@ -606,14 +3107,18 @@ static stack_status GENERIC(stack_healthCheck)(const GENERIC(stack) *this_)
             this_->status |= STACK_RIGHT_STRUCT_CANARY_CORRUPT;
         }
     }
+    }
     #endif
     
-    if (!ptrValid(this_->dataWrapper)) {
+    bool dataValid = ptrValid(this_->dataWrapper);          // data of a stack that failed to allocate is never read
+    if (!dataValid) {
         this_->status |= STACK_BAD_DATA_PTR;
     }
     
     #ifdef STACK_USE_CAPACITY_SYS_CHECK
-        size_t capacity = GENERIC(stack_getRealCapacity)(this_->dataWrapper);
+    {
+        STACK_STATS_PHASE_SCOPE(this_, STACK_STATS_PHASE_SYS_CAPACITY);
+        size_t capacity = GENERIC(stack_getRealCapacity)(this_);
         if (capacity != STACK_SIZE_T_POISON) {
             if ((capacity < this_->capacity)) {
                 STACK_LOG_TO_STREAM(this_, stderr, "Capacity != RealCapacity");
@@ -622,7 +3127,7 @@ static stack_status GENERIC(stack_healthCheck)(const GENERIC(stack) *this_)
             }
             else {
                 #if defined(__SANITIZE_ADDRESS__)
-                if (capacity != this_->capacity) {
+                if (capacity != this_->capacity && this_->mappedSize == 0 && this_->allocator == &STACK_ALLOCATOR_MALLOC) {    // mappings are whole pages, other allocators round blocks up
                     STACK_LOG_TO_STREAM(this_, stderr, "Capacity != RealCapacity");
                     this_->status |= STACK_BAD_CAPACITY;
                     this_->capacity = capacity;
@@ -630,6 +3135,7 @@ static stack_status GENERIC(stack_healthCheck)(const GENERIC(stack) *this_)
                 #endif
             }
        }
+    }
     #endif
  
 
@@ -637,14 +3143,51 @@ static stack_status GENERIC(stack_healthCheck)(const GENERIC(stack) *this_)
     /// All stack data   chechs should happen below here
 
 
-    #ifdef STACK_USE_DATA_HASH
-        hash = GENERIC(stack_calculateDataHash)(this_);
-        if (this_->dataHash != hash) 
-            this_->status |= STACK_BAD_DATA_HASH;
+    #if defined(STACK_USE_DATA_HASH_BLOCKS)
+        if (!(this_->status & STACK_INTEGRITY_VIOLATED) && ptrValid(this_->blockHashes) && ptrValid(this_->dirtyBlocks)) {
+            STACK_STATS_PHASE_SCOPE(this_, STACK_STATS_PHASE_DATA_HASH);
+            size_t liveBlocks = GENERIC(stack_blockCount)(this_->len);
+
+            hash = 0;
+            for (size_t block = 0; block < liveBlocks; ++block)        // protects the block table itself
+                hash ^= this_->blockHashes[block];
+            if (this_->dataHash != hash)
+                this_->status |= STACK_BAD_DATA_HASH;
+
+            for (size_t word = 0; word < (GENERIC(stack_blockCount)(this_->capacity) + 63) / 64; ++word) {
+                for (uint64_t bits = this_->dirtyBlocks[word]; bits; bits &= bits - 1) {
+                    size_t block = word * 64 + __builtin_ctzll(bits);
+                    if (block < liveBlocks && !GENERIC(stack_verifyBlock)(this_, block)) {
+                        this_->status |= STACK_BAD_DATA_HASH;
+                        if (this_->badBlock == STACK_SIZE_T_POISON)
+                            this_->badBlock = block;
+                    }
+                }
+                this_->dirtyBlocks[word] = 0;
+            }
+
+            for (size_t i = 0; i < STACK_DATA_HASH_SAMPLE_BLOCKS && liveBlocks; ++i) {     // rotating sample of clean blocks
+                size_t block = this_->sampleCursor % liveBlocks;
+                if (!GENERIC(stack_verifyBlock)(this_, block)) {
+                    this_->status |= STACK_BAD_DATA_HASH;
+                    if (this_->badBlock == STACK_SIZE_T_POISON)
+                        this_->badBlock = block;
+                }
+                this_->sampleCursor = block + 1;
+            }
+        }
+    #elif defined(STACK_USE_DATA_HASH_WATERMARK)
+        if (dataValid) {
+            STACK_STATS_PHASE_SCOPE(this_, STACK_STATS_PHASE_DATA_HASH);
+            if (!GENERIC(stack_verifyWatermark)(this_))
+                this_->status |= STACK_BAD_DATA_HASH;
+        }
     #endif
 
-    #ifdef STACK_USE_CANARY
-    for (size_t i = 0; i < STACK_CANARY_WRAPPER_LEN; ++i) {             
+    #ifdef STACK_USE_DATA_CANARY
+    if (dataValid) {
+    STACK_STATS_PHASE_SCOPE(this_, STACK_STATS_PHASE_CANARIES);
+    for (size_t i = 0; i < STACK_DATA_WRAPPER_LEN; ++i) {             
         if (LEFT_CANARY_WRAPPER[i] != STACK_LEFT_CANARY_POISON) {      
             this_->status |= STACK_LEFT_DATA_CANARY_CORRUPT;
         }
@@ -653,14 +3196,15 @@ static stack_status GENERIC(stack_healthCheck)(const GENERIC(stack) *this_)
             this_->status |= STACK_RIGHT_DATA_CANARY_CORRUPT;
             }
     }
+    }
     #endif
 
 
     #ifdef STACK_USE_POISON
-        for (size_t i = this_->len; i < this_->capacity; ++i) {
-            if (!GENERIC(stack_isPoisoned)(&this_->data[i])) {
+        if (this_->len < this_->capacity && dataValid) {
+            STACK_STATS_PHASE_SCOPE(this_, STACK_STATS_PHASE_POISON);
+            if (!GENERIC(stack_isRangePoisoned)(&this_->data[this_->len], this_->capacity - this_->len))
                 this_->status |= STACK_DATA_INTEGRITY_VIOLATED;
-            }
         }
     #endif
     
@@ -679,15 +3223,39 @@ static uint64_t GENERIC(stack_calculateStructHash)(const GENERIC(stack) *this_)
 
     uint64_t hash = 0;
 
-    hash = _mm_crc32_u64(hash, (uint64_t)(this_->dataWrapper));
-    hash = _mm_crc32_u64(hash, (uint64_t)(this_->data));
-    hash = _mm_crc32_u64(hash, (uint64_t)(this_->capacity));
-    hash = _mm_crc32_u64(hash, (uint64_t)(this_->len));
-    hash = _mm_crc32_u64(hash, (uint64_t)(this_->logStream));
-    
+    uint64_t rate = 0;
+    memcpy(&rate, &this_->checkPolicy.rate, sizeof(rate));
+
+    uint64_t fields[] = {
+        (uint64_t)(this_->dataWrapper),
+        (uint64_t)(this_->data),
+        (uint64_t)(this_->capacity),
+        (uint64_t)(this_->len),
+        (uint64_t)(this_->mappedSize),
+        (uint64_t)(this_->allocator),
+        (uint64_t)(this_->residentCapacity),
+        (uint64_t)(this_->deferredCapacity),
+        (uint64_t)(this_->generation),
+        (uint64_t)(this_->logStream),
+        (uint64_t)(this_->checkPolicy.mode),              // a stray write to the cadence could turn checks off
+        (uint64_t)(this_->checkPolicy.period),
+        rate,
+        (uint64_t)(this_->checkPolicy.budgetNs),
+        (uint64_t)(this_->checkScheduled),
+        (uint64_t)(this_->checkCountdown),
+        (uint64_t)(this_->checkRandState),
+        (uint64_t)(this_->checkWindowStart),
+        (uint64_t)(this_->checkWindowSpent),
     #ifdef STACK_USE_DATA_HASH
-        hash = _mm_crc32_u64(hash, (uint64_t)(this_->dataHash));
+        (uint64_t)(this_->dataHash),
+    #endif
+    #ifdef STACK_USE_DATA_HASH_BLOCKS
+        (uint64_t)(this_->blockHashes),
+        (uint64_t)(this_->dirtyBlocks),
     #endif
+    };
+
+    hash = stack_crc32c((uint32_t)hash, fields, sizeof(fields));
 
     return hash;
 }
@@ -699,13 +3267,18 @@ static uint64_t GENERIC(stack_calculateDataHash)(const GENERIC(stack) *this_)
 {
     assert(ptrValid(this_));
 
-    uint64_t hash = 0;
-
-    for (char* iter = (char*)(this_->data); iter < (char*)(this_->data + this_->capacity); ++iter) {
-        hash = _mm_crc32_u8(hash, *iter);
-    }
+    size_t len = this_->len < this_->capacity ? this_->len : this_->capacity;     // in case structure is corrupt and len > capacity
 
-    return hash;
+    #ifdef STACK_USE_DATA_HASH_BLOCKS
+        uint64_t hash = 0;
+        for (size_t begin = 0; begin < len; begin += GENERIC(stack_blockLen)()) {
+            size_t end = fmin(begin + GENERIC(stack_blockLen)(), len);
+            hash ^= stack_crc32c(0, &this_->data[begin], (end - begin) * sizeof(STACK_TYPE));
+        }
+        return hash;
+    #else
+        return stack_crc32c(0, this_->data, len * sizeof(STACK_TYPE));
+    #endif
 }
 #endif
 
@@ -0,0 +1,513 @@
+/**
+ * @file C++ front-end of the generalized stack: checks are chosen per stack by a policy type
+ *       instead of global `STACK_USE_*` macros, so unchecked and hardened stacks live in one
+ *       translation unit; data keeps the canary wrapped layout of the C stack
+ */
+
+#ifndef GSTACK_HPP
+#define GSTACK_HPP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <type_traits>
+#include <utility>
+#include <new>
+
+#include "gstack-common.h"
+
+
+/**
+ * @struct stack_policy
+ * @brief compile-time set of checks of `gstack`, disabled checks compile to nothing;
+ *        custom policies derive from one of the policies below and hide its flags
+ */
+struct stack_policy
+{
+    static constexpr bool poison     = false;       /// free slots are poisoned and checked on reuse, as with `STACK_USE_POISON`
+    static constexpr bool canary     = false;       /// struct and data are wrapped in canaries, as with `STACK_USE_CANARY`
+    static constexpr bool structHash = false;       /// struct fields are hashed, as with `STACK_USE_STRUCT_HASH`
+    static constexpr bool dataHash   = false;       /// data is hashed incrementally, as with `STACK_USE_DATA_HASH`
+    static constexpr bool opChecks   = false;       /// every operation runs healthcheck before and after itself
+} typedef stack_policy_release;
+
+/// @brief checks of `CHEAP_DEBUG`
+struct stack_policy_cheap : stack_policy
+{
+    static constexpr bool canary     = true;
+    static constexpr bool structHash = true;
+    static constexpr bool opChecks   = true;
+};
+
+/// @brief checks of `FULL_DEBUG`
+struct stack_policy_full : stack_policy_cheap
+{
+    static constexpr bool poison     = true;
+    static constexpr bool dataHash   = true;
+};
+
+
+/**
+ * @struct stack_trivially_relocatable
+ * @brief tells if moving an elem to another address and forgetting the old one equals copying its bytes;
+ *        then growth uses `realloc`, otherwise elems are move-constructed into new data and destroyed in the old one.
+ *        Specialize it for types that don't point into themselves, like refcounted handles or most vectors
+ */
+template <class T>
+struct stack_trivially_relocatable
+{
+    static constexpr bool value = std::is_trivially_copyable<T>::value;
+};
+
+
+/// @brief placeholder of a field of a disabled check, `Tag` keeps placeholders of one struct at distinct types
+template <int Tag> struct stack_no_field {};
+
+template <bool Enabled, class Field, int Tag>
+using stack_field = std::conditional_t<Enabled, Field, stack_no_field<Tag>>;
+
+
+/**
+ * @struct gstack
+ * @brief stack of `T` with checks of `Policy`; fields are public like in the C stack,
+ *        errors are OR'ed into `status` and returned by every operation.
+ *        Elems are constructed in place, moved on growth unless trivially relocatable and destroyed on pop, clear and dtor
+ */
+template <class T, class Policy = stack_policy_release>
+struct gstack
+{
+    static_assert(stack_trivially_relocatable<T>::value || std::is_nothrow_move_constructible<T>::value,
+                  "elems are moved on growth without a way to roll back");
+    static_assert(!Policy::canary || alignof(T) <= alignof(unsigned long long), "data follows the left data canaries");
+
+    typedef STACK_CANARY_TYPE canary_type;
+
+    static constexpr canary_type LEFT_CANARY       = STACK_LEFT_CANARY_POISON;
+    static constexpr canary_type RIGHT_CANARY      = STACK_RIGHT_CANARY_POISON;
+    static constexpr size_t      CANARY_LEN        = Policy::canary ? STACK_CANARY_COUNT : 0;
+    static constexpr char        ELEM_POISON       = STACK_ELEM_POISON;
+    static constexpr size_t      STARTING_CAPACITY = 2;
+
+    [[no_unique_address]] stack_field<Policy::canary, canary_type, 0> leftCanary;
+
+    canary_type  *dataWrapper;
+    T            *data;
+    size_t        len;
+    size_t        capacity;
+    stack_status  status;
+    FILE         *logStream;
+
+    [[no_unique_address]] stack_field<Policy::dataHash,   uint64_t, 1> dataHash;
+    [[no_unique_address]] stack_field<Policy::structHash, uint64_t, 2> structHash;
+    [[no_unique_address]] stack_field<Policy::canary, canary_type, 3> rightCanary;
+
+
+    gstack() : dataWrapper(NULL), data(NULL), len(0), capacity(0), status(STACK_OK), logStream(stderr)
+    {
+        if constexpr (Policy::canary) {
+            leftCanary  = LEFT_CANARY;
+            rightCanary = RIGHT_CANARY;
+        }
+        if constexpr (Policy::dataHash)
+            dataHash = 0;
+
+        status |= grow();
+        rehash();
+    }
+
+    ~gstack()
+    {
+        destroy(0, len);
+        free(dataWrapper);
+        dataWrapper = NULL;
+        data        = NULL;
+    }
+
+    gstack(const gstack&)            = delete;
+    gstack &operator=(const gstack&) = delete;
+
+
+    /// @brief pushes copy of `item`, returns bitset of stack status
+    stack_status push(const T &item) { return emplace(item); }
+
+    /// @brief pushes `item` moved from, returns bitset of stack status
+    stack_status push(T &&item)      { return emplace(std::move(item)); }
+
+    /**
+     * @brief constructs elem at the top of the stack from `args`
+     * @return bitset of stack status
+     */
+    template <class... Args>
+    stack_status emplace(Args&&... args)
+    {
+        if (STACK_UNLIKELY(beginCheck()))
+            return status;
+
+        if (STACK_UNLIKELY(len == capacity))
+            return growAndPlace(std::forward<Args>(args)...);
+
+        return place(std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief pops last elem from stack, it is moved to `item` and destroyed
+     * @param item pointer to var to move to or NULL if value should be discarded
+     * @return bitset of stack status, with `STACK_EMPTY` if there was nothing to pop
+     */
+    stack_status pop(T *item)
+    {
+        if (STACK_UNLIKELY(beginCheck()))
+            return status;
+
+        if (STACK_UNLIKELY(len == 0)) {
+            log("WARNING: trying to pop from empty stack!");
+            return status | STACK_EMPTY;
+        }
+
+        len -= 1;
+        if constexpr (Policy::dataHash)
+            dataHash = crc32cCut((uint32_t)dataHash, &data[len]);
+
+        if (STACK_LIKELY(item != NULL))
+            *item = std::move(data[len]);
+        data[len].~T();
+        if constexpr (Policy::poison)
+            memset((char*)&data[len], ELEM_POISON, sizeof(T));
+
+        rehash();
+        return endCheck();
+    }
+
+    /**
+     * @brief gives pointer to elem at `pos`, writing through it breaks the data hash like in the C stack
+     * @param item pointer to write elem pointer to, NULL is written on bad `pos`
+     * @return bitset of stack status
+     */
+    stack_status get(size_t pos, T **item)
+    {
+        if (STACK_UNLIKELY(beginCheck()))
+            return status;
+
+        if (STACK_UNLIKELY(pos >= len)) {
+            log("ERROR: bad position provided to get!");
+            *item = NULL;
+            return status;
+        }
+
+        *item = &data[pos];
+        return endCheck();
+    }
+
+    /**
+     * @brief gives pointer to the last elem
+     * @return bitset of stack status, with `STACK_EMPTY` if stack is empty
+     */
+    stack_status top(T **item)
+    {
+        if (len == 0) {
+            *item = NULL;
+            return status | STACK_EMPTY;
+        }
+        return get(len - 1, item);
+    }
+
+    /**
+     * @brief destroys all elems keeping the capacity
+     * @return bitset of stack status
+     */
+    stack_status clear()
+    {
+        if (STACK_UNLIKELY(beginCheck()))
+            return status;
+
+        destroy(0, len);
+        if constexpr (Policy::poison)
+            memset((char*)data, ELEM_POISON, len * sizeof(T));
+        if constexpr (Policy::dataHash)
+            dataHash = 0;
+        len = 0;
+
+        rehash();
+        return endCheck();
+    }
+
+
+    /**
+     * @brief runs all checks of the policy, cost is linear in capacity with data hash or poison
+     * @return bitset of stack status
+     */
+    stack_status healthCheck()
+    {
+        if constexpr (Policy::canary) {
+            if (leftCanary  != LEFT_CANARY)
+                status |= STACK_LEFT_STRUCT_CANARY_CORRUPT;
+            if (rightCanary != RIGHT_CANARY)
+                status |= STACK_RIGHT_STRUCT_CANARY_CORRUPT;
+        }
+        if constexpr (Policy::structHash) {
+            if (structHash != calculateStructHash())
+                status |= STACK_BAD_STRUCT_HASH;
+        }
+
+        if (data == NULL)
+            status |= STACK_BAD_DATA_PTR;
+        if (len > capacity || capacity > 1e20)
+            status |= STACK_INTEGRITY_VIOLATED;
+
+        if (status & (STACK_BAD_DATA_PTR | STACK_INTEGRITY_VIOLATED | STACK_BAD_STRUCT_HASH)) {     // data can't be trusted to be walked
+            log("Problems found in healthcheck");
+            return status;
+        }
+
+        if constexpr (Policy::canary) {
+            char *rightWrapper = (char*)(data + capacity);
+            for (size_t i = 0; i < CANARY_LEN; ++i) {
+                if (dataWrapper[i] != LEFT_CANARY)
+                    status |= STACK_LEFT_DATA_CANARY_CORRUPT;
+                if (loadCanary(rightWrapper + i * sizeof(canary_type)) != RIGHT_CANARY)
+                    status |= STACK_RIGHT_DATA_CANARY_CORRUPT;
+            }
+        }
+        if constexpr (Policy::dataHash) {
+            if (dataHash != calculateDataHash())
+                status |= STACK_BAD_DATA_HASH;
+        }
+        if constexpr (Policy::poison) {
+            for (size_t i = len; i < capacity; ++i) {
+                if (!isPoisoned(&data[i]))
+                    status |= STACK_DATA_INTEGRITY_VIOLATED;
+            }
+        }
+
+        if (status)
+            log("Problems found in healthcheck");
+        return status;
+    }
+
+    /**
+     * @brief dumps stack structure to `out`
+     * @return bitset of stack status
+     */
+    stack_status dump(FILE *out) const
+    {
+        fprintf(out, "%s\n| gstack [%p] :\n|----------------\n", STACK_LOG_DELIM, (const void*)this);
+        fprintf(out, "| Current status   = %d\n", status);
+        fprintf(out, "| Capacity         = %zu\n", capacity);
+        fprintf(out, "| Len              = %zu\n", len);
+        fprintf(out, "| Data wrapper ptr = %p\n", (void*)dataWrapper);
+        fprintf(out, "| Data ptr         = %p\n", (void*)data);
+        fprintf(out, "| Elem size        = %zu\n", sizeof(T));
+        if constexpr (Policy::structHash)
+            fprintf(out, "| Struct hash      = %" PRIu64 "\n", structHash);
+        if constexpr (Policy::dataHash)
+            fprintf(out, "| Data hash        = %" PRIu64 "\n", dataHash);
+        fprintf(out, "%s\n", STACK_LOG_DELIM);
+
+        return status;
+    }
+
+
+private:
+    stack_status beginCheck()
+    {
+        if constexpr (Policy::opChecks)
+            return healthCheck();
+        return status;
+    }
+
+    stack_status endCheck()
+    {
+        if constexpr (Policy::opChecks)
+            return healthCheck();
+        return status;
+    }
+
+    void rehash()
+    {
+        if constexpr (Policy::structHash)
+            structHash = calculateStructHash();
+    }
+
+    /// constructs elem from `args` in the free slot on top of the stack
+    template <class... Args>
+    stack_status place(Args&&... args)
+    {
+        if constexpr (Policy::poison) {
+            if (STACK_UNLIKELY(!isPoisoned(&data[len]))) {
+                log("Stack structure corrupt, element was modified!");
+                status |= STACK_DATA_INTEGRITY_VIOLATED;
+            }
+        }
+
+        new (&data[len]) T(std::forward<Args>(args)...);
+        return placed();
+    }
+
+    /// accounts the elem just constructed at `len`
+    stack_status placed()
+    {
+        if constexpr (Policy::dataHash)
+            dataHash = stack_crc32c((uint32_t)dataHash, &data[len], sizeof(T));
+        len += 1;
+
+        rehash();
+        return endCheck();
+    }
+
+    /// grows the full stack and constructs elem from `args` on top of it; like `std::vector`, the elem is built
+    /// before the old data is freed, as `args` could refer to elems of this stack
+    template <class... Args>
+    STACK_COLD
+    stack_status growAndPlace(Args&&... args)
+    {
+        if constexpr (stack_trivially_relocatable<T>::value) {
+            alignas(T) unsigned char item[sizeof(T)];                   // relocated as bytes after realloc
+            new (item) T(std::forward<Args>(args)...);
+
+            status |= grow();
+            if (len == capacity) {
+                ((T*)item)->~T();
+                return status;
+            }
+            memcpy((void*)&data[len], item, sizeof(T));
+        }
+        else {
+            status |= grow(std::forward<Args>(args)...);
+            if (len == capacity)
+                return status;
+        }
+
+        return placed();
+    }
+
+    void destroy(size_t begin, size_t end)
+    {
+        if constexpr (!std::is_trivially_destructible<T>::value) {
+            for (size_t i = begin; i < end; ++i)
+                data[i].~T();
+        }
+    }
+
+    /// grows capacity twice, out of line so push stays small; `args`, if any, construct the elem at `len`
+    /// in the new data before old elems are moved out, which needs growth without realloc
+    template <class... Args>
+    STACK_COLD
+    stack_status grow(Args&&... args)
+    {
+        static_assert(sizeof...(Args) == 0 || !stack_trivially_relocatable<T>::value, "realloc frees what args could refer to");
+
+        if (capacity > stack_maxCapacity(sizeof(T), CANARY_LEN) / 2) {         // allocated size would wrap around
+            log("ERROR: failed to grow stack data!");
+            return STACK_BAD_MEM_ALLOC;
+        }
+
+        size_t newCapacity = capacity ? 2 * capacity : STARTING_CAPACITY;
+        size_t size        = 2 * CANARY_LEN * sizeof(canary_type) + newCapacity * sizeof(T);
+
+        canary_type *wrapper = NULL;
+        if constexpr (stack_trivially_relocatable<T>::value)
+            wrapper = (canary_type*)realloc(dataWrapper, size);
+        else
+            wrapper = (canary_type*)malloc(size);
+        if (wrapper == NULL) {
+            log("ERROR: failed to grow stack data!");
+            return STACK_BAD_MEM_ALLOC;
+        }
+
+        T *newData = (T*)(wrapper + CANARY_LEN);
+        if constexpr (Policy::poison)
+            memset((char*)(newData + capacity), ELEM_POISON, (newCapacity - capacity) * sizeof(T));
+
+        if constexpr (!stack_trivially_relocatable<T>::value) {
+            if constexpr (sizeof...(Args) != 0) {
+                try {
+                    new (&newData[len]) T(std::forward<Args>(args)...);
+                }
+                catch (...) {
+                    free(wrapper);
+                    throw;
+                }
+            }
+
+            for (size_t i = 0; i < len; ++i) {
+                new (&newData[i]) T(std::move(data[i]));
+                data[i].~T();
+            }
+            free(dataWrapper);
+        }
+
+        dataWrapper = wrapper;
+        data        = newData;
+
+        if constexpr (Policy::dataHash && !stack_trivially_relocatable<T>::value)
+            dataHash = calculateDataHash();                                     // moved elems could hold pointers into themselves
+
+        capacity = newCapacity;
+
+        if constexpr (Policy::canary) {
+            char *rightWrapper = (char*)(data + capacity);
+            for (size_t i = 0; i < CANARY_LEN; ++i) {
+                dataWrapper[i] = LEFT_CANARY;
+                memcpy(rightWrapper + i * sizeof(canary_type), &RIGHT_CANARY, sizeof(canary_type));    // could be unaligned after small elems
+            }
+        }
+
+        rehash();
+        return STACK_OK;
+    }
+
+    STACK_COLD
+    void log(const char *message) const
+    {
+        fprintf(logStream, "%s\n| %s\n", STACK_LOG_DELIM, message);
+        dump(logStream);
+    }
+
+    static canary_type loadCanary(const void *ptr)
+    {
+        canary_type value = 0;
+        memcpy(&value, ptr, sizeof(value));
+        return value;
+    }
+
+    static bool isPoisoned(const T *elem)
+    {
+        for (size_t i = 0; i < sizeof(T); ++i) {
+            if (((const char*)elem)[i] != ELEM_POISON)
+                return false;
+        }
+        return true;
+    }
+
+    /// cuts the last elem off the raw crc32c of data, same as `stack_crc32cCut` of the C stack
+    static uint32_t crc32cCut(uint32_t hash, const T *elem)
+    {
+        static const uint32_t elemFactor = stack_crc32cPowModP(STACK_CRC32C_X_INV, 8 * sizeof(T));     // x^(-8 * sizeof(T))
+        return stack_crc32cMultModP(hash ^ stack_crc32c(0, elem, sizeof(T)), elemFactor);
+    }
+
+    uint64_t calculateDataHash() const
+    {
+        return stack_crc32c(0, data, len * sizeof(T));
+    }
+
+    uint64_t calculateStructHash() const
+    {
+        uint64_t fields[] = {
+            (uint64_t)(dataWrapper),
+            (uint64_t)(data),
+            (uint64_t)(capacity),
+            (uint64_t)(len),
+            (uint64_t)(logStream),
+        };
+
+        uint64_t hash = stack_crc32c(0, fields, sizeof(fields));
+        if constexpr (Policy::dataHash)
+            hash = stack_crc32c((uint32_t)hash, &dataHash, sizeof(dataHash));
+        return hash;
+    }
+};
+
+#endif  /* GSTACK_HPP */
@@ -0,0 +1,298 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <stack>
+
+/// 64 byte elem, the conversion is what canary checks of elems need
+struct bench_blob64 {
+    uint64_t words[8];
+    explicit operator unsigned long long() const { return words[0]; }
+};
+
+/// gstack functions of one STACK_TYPE, specialized after every include of gstack.h
+template <class Item> struct StackOps;
+
+#define BENCH_STACK_OPS()                                                                                       \
+    template <> struct StackOps<STACK_TYPE> {                                                                    \
+        typedef GENERIC(stack) Stack;                                                                             \
+        static stack_status ctor (Stack *this_)                          { return GENERIC(stack_ctor)(this_); }    \
+        static stack_status dtor (Stack *this_)                          { return GENERIC(stack_dtor)(this_); }    \
+        static stack_status push (Stack *this_, STACK_TYPE item)         { return GENERIC(stack_push)(this_, item); } \
+        static stack_status pop  (Stack *this_, STACK_TYPE *item)        { return GENERIC(stack_pop)(this_, item); }  \
+        static stack_status get  (Stack *this_, size_t pos, STACK_TYPE **item) { return GENERIC(stack_get)(this_, pos, item); } \
+        static stack_status clear(Stack *this_)                          { return GENERIC(stack_clear)(this_); }   \
+    };
+
+#define STACK_TYPE char
+#include "gstack.h"
+BENCH_STACK_OPS()
+#undef STACK_TYPE
+
+#define STACK_TYPE int
+#include "gstack.h"
+BENCH_STACK_OPS()
+#undef STACK_TYPE
+
+#define STACK_TYPE double
+#include "gstack.h"
+BENCH_STACK_OPS()
+#undef STACK_TYPE
+
+#define STACK_TYPE bench_blob64
+#include "gstack.h"
+BENCH_STACK_OPS()
+#undef STACK_TYPE
+
+#ifndef STACK_BENCH_VARIANT
+    #define STACK_BENCH_VARIANT "custom"        /// name of the set of debug options the bench is built with
+#endif
+
+
+/// Containers share the interface used by workloads; `status` is `stack_status` bits, always 0 for std containers
+template <class Item>
+struct GStack {
+    static const char *name() { return "gstack"; }
+    typename StackOps<Item>::Stack S;
+
+    void   init()              { S = {}; StackOps<Item>::ctor(&S); }
+    void   destroy()           { StackOps<Item>::dtor(&S); }
+    void   push(Item item)     { StackOps<Item>::push(&S, item); }
+    void   pop(Item *item)     { StackOps<Item>::pop(&S, item); }
+    Item   get(size_t pos)     { Item *item = NULL; StackOps<Item>::get(&S, pos, &item); return *item; }
+    void   clear()             { StackOps<Item>::clear(&S); }
+    size_t len() const         { return S.len; }
+    int    status() const      { return S.status; }
+};
+
+template <class Item>
+struct StdVector {
+    static const char *name() { return "std::vector"; }
+    std::vector<Item> V;
+
+    void   init()              { V = std::vector<Item>(); }
+    void   destroy()           { V = std::vector<Item>(); }
+    void   push(Item item)     { V.push_back(item); }
+    void   pop(Item *item)     { *item = V.back(); V.pop_back(); }
+    Item   get(size_t pos)     { return V[pos]; }
+    void   clear()             { V.clear(); }
+    size_t len() const         { return V.size(); }
+    int    status() const      { return 0; }
+};
+
+template <class Item>
+struct StdStack {
+    static const char *name() { return "std::stack"; }
+    std::stack<Item> S;
+
+    void   init()              { S = std::stack<Item>(); }
+    void   destroy()           { S = std::stack<Item>(); }
+    void   push(Item item)     { S.push(item); }
+    void   pop(Item *item)     { *item = S.top(); S.pop(); }
+    Item   get(size_t)         { return S.top(); }             // no random access, reads the top instead
+    void   clear()             { S = std::stack<Item>(); }
+    size_t len() const         { return S.size(); }
+    int    status() const      { return 0; }
+};
+
+
+struct BenchConfig {
+    size_t   maxElems;
+    size_t   maxBytes;                          /// sizes with bigger data are skipped
+    uint64_t budgetNs;                          /// runs longer than that are cut and marked truncated
+    FILE    *out;
+};
+
+/// counts operations and cuts the run once the time budget is spent
+struct BenchRun {
+    uint64_t ops;
+    uint64_t deadline;
+    uint64_t state;                             /// xorshift state, fixed seed for reproducible patterns
+    bool     truncated;
+
+    bool step()
+    {
+        if ((++ops & 4095) == 0 && stack_clockNs(false) > deadline)
+            truncated = true;
+        return !truncated;
+    }
+
+    uint64_t random()
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+};
+
+/// values stay below 0x7f so no item matches the all-0xFA poison pattern
+template <class Item>
+static Item benchItem(uint64_t i)
+{
+    i %= 0x7f;
+    Item item = {};
+    memcpy((char*)&item, &i, sizeof(Item) < sizeof(i) ? sizeof(Item) : sizeof(i));
+    return item;
+}
+
+static volatile uint64_t BENCH_SINK = 0;        /// keeps reads from being optimized out
+
+template <class Item>
+static void benchConsume(const Item &item)
+{
+    uint64_t value = 0;
+    memcpy(&value, &item, sizeof(Item) < sizeof(value) ? sizeof(Item) : sizeof(value));
+    BENCH_SINK = BENCH_SINK + value;
+}
+
+
+/// push all, read all in order, pop all
+template <class C, class Item>
+static void patternSequential(C &c, size_t size, BenchRun &run)
+{
+    for (size_t i = 0; i < size && run.step(); ++i)
+        c.push(benchItem<Item>(i));
+    for (size_t i = 0; i < c.len() && run.step(); ++i)
+        benchConsume(c.get(i));
+    Item item = {};
+    while (c.len() != 0 && run.step())
+        c.pop(&item);
+}
+
+/// push all, read random positions, then random pushes and pops
+template <class C, class Item>
+static void patternRandom(C &c, size_t size, BenchRun &run)
+{
+    for (size_t i = 0; i < size && run.step(); ++i)
+        c.push(benchItem<Item>(i));
+    for (size_t i = 0; i < size && c.len() != 0 && run.step(); ++i)
+        benchConsume(c.get(run.random() % c.len()));
+    Item item = {};
+    for (size_t i = 0; i < size && run.step(); ++i) {
+        if (c.len() != 0 && (run.random() & 1))
+            c.pop(&item);
+        else
+            c.push(benchItem<Item>(i));
+    }
+}
+
+/// grows to size and falls to a quarter of it several times, hits growth and shrink thresholds
+template <class C, class Item>
+static void patternSawtooth(C &c, size_t size, BenchRun &run)
+{
+    Item item = {};
+    for (size_t tooth = 0; tooth < 4; ++tooth) {
+        while (c.len() < size && run.step())
+            c.push(benchItem<Item>(c.len()));
+        while (c.len() > size / 4 && run.step())
+            c.pop(&item);
+    }
+}
+
+/// bursts of random length of pushes followed by bursts of pops
+template <class C, class Item>
+static void patternBursty(C &c, size_t size, BenchRun &run)
+{
+    Item item = {};
+    size_t maxBurst = size / 8 + 1;
+    for (size_t done = 0; done < 3 * size && !run.truncated;) {
+        size_t burst = run.random() % maxBurst + 1;
+        for (size_t i = 0; i < burst && c.len() < size && run.step(); ++i, ++done)
+            c.push(benchItem<Item>(done));
+
+        burst = run.random() % maxBurst + 1;
+        for (size_t i = 0; i < burst && c.len() != 0 && run.step(); ++i, ++done)
+            c.pop(&item);
+        ++done;
+    }
+}
+
+
+template <template <class> class Container, class Item>
+static void benchContainer(const BenchConfig &config, const char *variant, const char *type, size_t size)
+{
+    typedef Container<Item> C;
+
+    static const struct {
+        const char *name;
+        void (*run)(C &c, size_t size, BenchRun &run);
+    } patterns[] = {
+        {"sequential", patternSequential<C, Item>},
+        {"random",     patternRandom<C, Item>},
+        {"sawtooth",   patternSawtooth<C, Item>},
+        {"bursty",     patternBursty<C, Item>},
+    };
+
+    size_t plannedReps = 1000000 / size + 1;     // small sizes are repeated for stable timing
+
+    for (const auto &pattern : patterns) {
+        BenchRun run = {0, stack_clockNs(false) + config.budgetNs, 0x9E3779B97F4A7C15, false};
+        uint64_t workNs  = 0;
+        uint64_t clearNs = 0;
+        size_t   reps    = 0;
+        int      status  = 0;
+
+        C c;
+        c.init();
+        for (; reps < plannedReps && !run.truncated; ++reps) {
+            uint64_t start = stack_clockNs(false);
+            pattern.run(c, size, run);
+            uint64_t mid = stack_clockNs(false);
+            c.clear();
+            clearNs += stack_clockNs(false) - mid;
+            workNs  += mid - start;
+        }
+        if (run.truncated)
+            --reps;                                 // the last one was cut
+        status = c.status();
+        c.destroy();
+
+        fprintf(config.out, "{\"variant\": \"%s\", \"container\": \"%s\", \"type\": \"%s\", \"elem_size\": %zu, \"size\": %zu, "
+                            "\"pattern\": \"%s\", \"reps\": %zu, \"planned_reps\": %zu, \"ops\": %" PRIu64 ", \"ns_per_op\": %.2f, "
+                            "\"clear_ns\": %.1f, \"truncated\": %s, \"status\": %d}\n",
+                variant, C::name(), type, sizeof(Item), size, pattern.name, reps, plannedReps, run.ops, run.ops ? (double)workNs / run.ops : 0.0,
+                (double)clearNs / (reps + run.truncated), run.truncated ? "true" : "false", status);
+        fflush(config.out);
+    }
+}
+
+
+template <class Item>
+static void benchType(const BenchConfig &config, const char *type)
+{
+    for (size_t size = 10; size <= config.maxElems; size *= 10) {
+        if (size * sizeof(Item) * 2 > config.maxBytes)
+            break;
+
+        benchContainer<GStack, Item>(config, STACK_BENCH_VARIANT, type, size);
+        #ifdef STACK_BENCH_BASELINES
+            benchContainer<StdVector, Item>(config, "baseline", type, size);
+            benchContainer<StdStack,  Item>(config, "baseline", type, size);
+        #endif
+    }
+}
+
+
+/// Usage: stack-bench-<variant> [max elems] [json lines file to append to] [time budget per run, ms]
+int main(int argc, char *argv[])
+{
+    BenchConfig config = {};
+    config.maxElems = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+    config.maxBytes = 1ull << 31;
+    config.budgetNs = (argc > 3 ? strtoull(argv[3], NULL, 10) : 2000) * 1000000;
+    config.out      = argc > 2 ? fopen(argv[2], "a") : stdout;
+
+    if (config.out == NULL) {
+        perror(argv[2]);
+        return 1;
+    }
+
+    benchType<char>        (config, "char");
+    benchType<int>         (config, "int");
+    benchType<double>      (config, "double");
+    benchType<bench_blob64>(config, "blob64");
+
+    if (config.out != stdout)
+        fclose(config.out);
+    return 0;
+}
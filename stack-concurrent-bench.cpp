@@ -0,0 +1,67 @@
+#define STACK_TYPE int
+#define ELEM_PRINTF_FORM "%d"
+
+#include "gstack.h"
+#include "gcstack.h"
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// runs `threadCount` threads doing push/pop pairs, returns millions of ops per second
+template <typename Op>
+static double runThreads(size_t threadCount, size_t pairs, Op op)
+{
+    std::vector<std::thread> threads;
+    uint64_t start = stack_clockNs(false);
+
+    for (size_t t = 0; t < threadCount; t++)
+        threads.emplace_back([=]() {
+            for (size_t i = 0; i < pairs; i++)
+                op((int)i);
+        });
+    for (auto &thread : threads)
+        thread.join();
+
+    uint64_t elapsed = stack_clockNs(false) - start;
+    return 2.0 * threadCount * pairs / (elapsed / 1e3);
+}
+
+/// Usage: stack-concurrent-bench [max threads] [push/pop pairs per thread]
+int main(int argc, char *argv[])
+{
+    size_t maxThreads = argc > 1 ? strtoull(argv[1], NULL, 10) : std::thread::hardware_concurrency();
+    size_t pairs      = argc > 2 ? strtoull(argv[2], NULL, 10) : 1000000;
+
+    #ifdef STACK_USE_ELIMINATION
+        const char *variant = "cstack+elimination";
+    #else
+        const char *variant = "cstack";
+    #endif
+
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        GENERIC(stack) S = {};
+        GENERIC(stack_ctor)(&S);
+        std::mutex lock;
+
+        double locked = runThreads(threads, pairs, [&](int i) {
+            int item = 0;
+            { std::lock_guard<std::mutex> guard(lock); GENERIC(stack_push)(&S, i); }
+            { std::lock_guard<std::mutex> guard(lock); GENERIC(stack_pop)(&S, &item); }
+        });
+        GENERIC(stack_dtor)(&S);
+
+        GENERIC(cstack) C = {};
+        GENERIC(cstack_ctor)(&C);
+
+        double lockFree = runThreads(threads, pairs, [&](int i) {
+            int item = 0;
+            GENERIC(cstack_push)(&C, i);
+            GENERIC(cstack_pop)(&C, &item, NULL);
+        });
+        GENERIC(cstack_dtor)(&C);
+
+        printf("threads=%zu mutex_stack_mops=%.2f %s_mops=%.2f\n", threads, locked, variant, lockFree);
+    }
+
+    return 0;
+}
@@ -97,6 +97,7 @@ TEST_F(myFixture, StructureHashLen)
 }
 
 
+#ifdef STACK_USE_DATA_CANARY
 TEST_F(myFixture, DataCanary)
 {
     GENERIC(stack) *this_ = Stack;
@@ -109,3 +110,4 @@ TEST_F(myFixture, DataCanary)
     strcpy(rButcher, "Hamster running down the cliff...");
     GENERIC(stack_healthCheck)(Stack);
 }
+#endif
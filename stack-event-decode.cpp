@@ -0,0 +1,35 @@
+#define STACK_TYPE int
+#define ELEM_PRINTF_FORM "%d"
+#define STACK_USE_EVENT_LOG
+
+#include "gstack.h"
+
+/// Usage: stack-event-decode <event file> [text file]
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <event file> [text file]\n", argv[0]);
+        return 1;
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    if (in == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    FILE *out = argc > 2 ? fopen(argv[2], "w") : stdout;
+    if (out == NULL) {
+        perror(argv[2]);
+        fclose(in);
+        return 1;
+    }
+
+    bool ok = stack_eventDecode(in, out);
+    if (!ok)
+        fprintf(stderr, "%s is not an event file or is truncated\n", argv[1]);
+
+    fclose(in);
+    if (out != stdout)
+        fclose(out);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,51 @@
+#define STACK_TYPE int
+#define ELEM_PRINTF_FORM "%d"
+
+#include "gstack.h"
+#include <sys/resource.h>
+
+static const char *growthPolicyName()
+{
+    #if   STACK_GROWTH_POLICY == STACK_GROWTH_X1_5
+        return "x1.5";
+    #elif STACK_GROWTH_POLICY == STACK_GROWTH_PAGE
+        return "page";
+    #elif STACK_GROWTH_POLICY == STACK_GROWTH_USABLE_SIZE
+        return "usable_size";
+    #else
+        return "x2";
+    #endif
+}
+
+/// Usage: stack-growth-bench-<policy> [elems count]
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000000;
+
+    GENERIC(stack) S = {};
+    GENERIC(stack_ctor)(&S);
+
+    size_t reallocs = 0;
+    size_t capacity = S.capacity;
+    uint64_t start  = stack_clockNs(false);
+
+    for (size_t i = 0; i < count; i++) {
+        GENERIC(stack_push)(&S, (int)i);
+        if (S.capacity != capacity) {
+            capacity = S.capacity;
+            reallocs++;
+        }
+    }
+
+    uint64_t elapsed = stack_clockNs(false) - start;
+
+    struct rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("policy=%s elems=%zu reallocs=%zu capacity=%zu slack=%.1f%% peak_rss_kb=%ld time_ms=%.1f\n",
+           growthPolicyName(), count, reallocs, S.capacity, 100.0 * (S.capacity - S.len) / S.capacity,
+           usage.ru_maxrss, elapsed / 1e6);
+
+    GENERIC(stack_dtor)(&S);
+    return 0;
+}
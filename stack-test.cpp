@@ -5,9 +5,14 @@
 
 #include "gstack.h"
 
+#include "gstack.hpp"
+
 #include <random>
 #include <time.h>
 #include <stack>
+#include <string>
+#include <thread>
+#include <atomic>
 
 // std::mt19937 rnd(time(NULL));
 std::mt19937 rnd(179);
@@ -241,3 +246,1593 @@ TEST(PushGet, Random)
     GENERIC(stack_dtor)(&S);
 
 }
+
+#ifdef STACK_USE_DATA_HASH
+TEST(DataHash, Incremental)
+{
+    GENERIC(stack) S = {};
+
+    GENERIC(stack_ctor)(&S);
+
+    EXPECT_EQ(stack_crc32cMultModP(stack_crc32cPowModP(STACK_CRC32C_ONE >> 1, 8), stack_crc32cPowModP(STACK_CRC32C_X_INV, 8)), STACK_CRC32C_ONE);
+
+    size_t iterations = rnd() % 1000 + 100;
+    for (size_t i = 0; i < iterations; ++i) {
+        if (rnd() % 10 < 7 || S.len == 0) {
+            GENERIC(stack_push)(&S, rnd());
+        }
+        else {
+            GENERIC(stack_pop)(&S, NULL);
+        }
+        EXPECT_EQ(S.dataHash, GENERIC(stack_calculateDataHash)(&S));
+    }
+
+    uint64_t hash = S.dataHash;
+    GENERIC(stack_push)(&S, 179);
+    GENERIC(stack_pop)(&S, NULL);
+    EXPECT_EQ(S.dataHash, hash);
+    EXPECT_EQ(S.status, STACK_OK);
+
+    S.data[0] += 1;
+    #ifdef STACK_USE_DATA_HASH_WATERMARK                                    // verified prefix is caught by the rotating rescan
+        for (size_t i = 0; i < 2 * (S.len * sizeof(STACK_TYPE) / STACK_DATA_HASH_RESCAN_SIZE + 1) && !S.status; ++i)
+            GENERIC(stack_healthCheck)(&S);
+        EXPECT_TRUE(S.status & STACK_BAD_DATA_HASH);
+    #else
+        EXPECT_TRUE(GENERIC(stack_healthCheck)(&S) & STACK_BAD_DATA_HASH);
+    #endif
+
+    S.data[0] -= 1;
+    S.status = STACK_OK;
+    GENERIC(stack_dtor)(&S);
+}
+#endif
+
+#ifdef STACK_USE_DATA_HASH_WATERMARK
+TEST(DataHash, Watermark)
+{
+    GENERIC(stack) S = {};
+
+    GENERIC(stack_ctor)(&S);
+
+    size_t len = 8 * STACK_DATA_HASH_RESCAN_SIZE / sizeof(STACK_TYPE);
+    for (size_t i = 0; i < len; ++i)
+        GENERIC(stack_push)(&S, rnd());
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+    EXPECT_EQ(S.verifiedLen, len);                                          // checks of pushes hashed only new elems
+    EXPECT_EQ(S.verifiedHash, S.dataHash);
+
+    STACK_TYPE *item = NULL;
+    GENERIC(stack_get)(&S, len / 2, &item);
+    EXPECT_EQ(S.verifiedLen, len / 2);
+    EXPECT_EQ(S.verifiedHash, stack_crc32c(0, S.data, len / 2 * sizeof(STACK_TYPE)));
+    *item += 1;
+    EXPECT_TRUE(GENERIC(stack_healthCheck)(&S) & STACK_BAD_DATA_HASH);      // handed out elem is verified right away
+
+    *item -= 1;
+    S.status = STACK_OK;
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+    EXPECT_EQ(S.verifiedLen, len);
+
+    for (size_t i = 0; i < len / 4; ++i)
+        GENERIC(stack_pop)(&S, NULL);
+    EXPECT_EQ(S.verifiedLen, S.len);
+    EXPECT_EQ(S.verifiedHash, GENERIC(stack_calculateDataHash)(&S));
+
+    S.data[1] += 1;                                                         // stray write below the watermark is found
+    size_t checks = 0;                                                      // within the current and the next rescan rounds
+    for (; checks < 20 && !S.status; ++checks)
+        GENERIC(stack_healthCheck)(&S);
+    EXPECT_TRUE(S.status & STACK_BAD_DATA_HASH);
+    EXPECT_LE(checks, 2 * 6);
+
+    S.data[1] -= 1;
+    S.status = STACK_OK;
+    while (S.len)
+        GENERIC(stack_pop)(&S, NULL);
+    EXPECT_EQ(S.dataHash, 0);
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+    GENERIC(stack_dtor)(&S);
+}
+#endif
+
+TEST(DataHash, Kernels)
+{
+    std::vector<unsigned char> buf(3 * 3 * STACK_CRC32C_STRIPE + 13);
+    for (auto &byte : buf)
+        byte = rnd();
+
+    const size_t sizes[] = {0, 1, 7, 8, 9, 100, 3 * STACK_CRC32C_STRIPE - 1, 3 * STACK_CRC32C_STRIPE, buf.size()};
+    for (size_t size : sizes) {
+        uint32_t expected = stack_crc32cTable(179, buf.data(), size);
+        EXPECT_EQ(stack_crc32c(179, buf.data(), size), expected);
+        #ifdef __x86_64__
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("sse4.2")) {
+                EXPECT_EQ(stack_crc32cSse42(179, buf.data(), size), expected);
+            }
+            if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul")) {
+                EXPECT_EQ(stack_crc32cClmul(179, buf.data(), size), expected);
+            }
+            }
+
+    EXPECT_EQ(stack_crc32cTable(0xFFFFFFFF, "123456789", 9) ^ 0xFFFFFFFF, 0xE3069283);     // standard crc32c check value
+}
+
+TEST(DataHash, ConcurrentDispatch)
+{
+    std::vector<unsigned char> buf(3 * STACK_CRC32C_STRIPE + 13);
+    for (auto &byte : buf)
+        byte = rnd();
+    uint32_t expected = stack_crc32c(0, buf.data(), buf.size());
+
+    STACK_CRC32C_INIT_STATE = 0;                                        // first calls race from every thread
+    STACK_CRC32C_KERNEL     = stack_crc32cResolve;
+    std::atomic<int> wrong{0};
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < 8; ++i) {
+        threads.emplace_back([&, i] {
+            uint32_t hash = (i % 2) ? stack_crc32cTable(0, buf.data(), buf.size()) : stack_crc32c(0, buf.data(), buf.size());
+            wrong += hash != expected;
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    EXPECT_EQ(wrong, 0);
+    EXPECT_EQ(STACK_CRC32C_INIT_STATE, 2);
+}
+#endif
+
+#ifdef STACK_USE_DATA_HASH_BLOCKS
+TEST(DataHash, Blocks)
+{
+    GENERIC(stack) S = {};
+
+    GENERIC(stack_ctor)(&S);
+
+    size_t blocks = 6;
+    for (size_t i = 0; i < blocks * GENERIC(stack_blockLen)() - 7; ++i)
+        GENERIC(stack_push)(&S, rnd());
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+    EXPECT_EQ(S.dataHash, GENERIC(stack_calculateDataHash)(&S));
+
+    STACK_TYPE *item = NULL;
+    GENERIC(stack_get)(&S, 3 * GENERIC(stack_blockLen)() + 5, &item);
+    *item += 1;
+    EXPECT_TRUE(GENERIC(stack_healthCheck)(&S) & STACK_BAD_DATA_HASH);      // handed out block is verified right away
+    EXPECT_EQ(S.badBlock, 3);
+
+    *item -= 1;
+    S.status   = STACK_OK;
+    S.badBlock = STACK_SIZE_T_POISON;
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+
+    S.data[1] += 1;                                                         // clean block is caught by sampling
+    for (size_t i = 0; i < blocks && !S.status; ++i)
+        GENERIC(stack_healthCheck)(&S);
+    EXPECT_TRUE(S.status & STACK_BAD_DATA_HASH);
+    EXPECT_EQ(S.badBlock, 0);
+
+    S.data[1] -= 1;
+    S.status   = STACK_OK;
+    while (S.len)
+        GENERIC(stack_pop)(&S, NULL);
+    EXPECT_EQ(S.dataHash, 0);
+    EXPECT_EQ(S.status, STACK_OK);
+    GENERIC(stack_dtor)(&S);
+}
+#endif
+
+#ifdef STACK_USE_POISON
+TEST(Poison, ScanKernels)
+{
+    std::vector<char> buf(1000, STACK_ELEM_POISON);
+
+    const size_t sizes[] = {0, 1, 15, 16, 17, 64, 127, 128, 129, 1000};
+    for (size_t size : sizes) {
+        for (size_t bad = 0; bad <= size; bad += 1 + bad / 4) {
+            if (bad < size)
+                buf[bad] = 0;
+            EXPECT_EQ(stack_findNotPoisonedScalar(buf.data(), size, STACK_ELEM_POISON), bad);
+            EXPECT_EQ(stack_findNotPoisoned(buf.data(), size, STACK_ELEM_POISON), bad);
+            #ifdef __x86_64__
+                EXPECT_EQ(stack_findNotPoisonedSse2(buf.data(), size, STACK_ELEM_POISON), bad);
+                __builtin_cpu_init();
+                if (__builtin_cpu_supports("avx2")) {
+                    EXPECT_EQ(stack_findNotPoisonedAvx2(buf.data(), size, STACK_ELEM_POISON), bad);
+                }
+            #endif
+            if (bad < size)
+                buf[bad] = STACK_ELEM_POISON;
+        }
+    }
+}
+#endif
+
+TEST(CheckPolicy, Cadence)
+{
+    GENERIC(stack) S = {};
+
+    GENERIC(stack_ctor)(&S);
+    EXPECT_TRUE(GENERIC(stack_checkDue)(&S));
+
+    GENERIC(stack_setCheckPolicy)(&S, {STACK_CHECK_EVERY_N, 3, 0, 0});
+    for (size_t i = 0; i < 9; ++i)
+        EXPECT_EQ(GENERIC(stack_checkDue)(&S), i % 3 == 0);
+
+    GENERIC(stack_setCheckPolicy)(&S, {STACK_CHECK_SAMPLED, 0, 0.25, 0});
+    size_t checked = 0;
+    for (size_t i = 0; i < 10000; ++i)
+        checked += GENERIC(stack_checkDue)(&S);
+    EXPECT_NEAR(checked, 2500, 300);
+
+    GENERIC(stack_setCheckPolicy)(&S, {STACK_CHECK_BUDGET, 0, 0, 0});
+    EXPECT_FALSE(GENERIC(stack_checkDue)(&S));
+    GENERIC(stack_setCheckPolicy)(&S, {STACK_CHECK_BUDGET, 0, 0, STACK_CHECK_BUDGET_WINDOW_NS});
+    EXPECT_TRUE(GENERIC(stack_checkDue)(&S));
+
+    GENERIC(stack_setCheckPolicy)(&S, {STACK_CHECK_EVERY_N, 4, 0, 0});
+    for (size_t i = 0; i < 1000; ++i)
+        GENERIC(stack_push)(&S, i);
+    for (size_t i = 0; i < 1000; ++i) {
+        STACK_TYPE item = 0;
+        GENERIC(stack_pop)(&S, &item);
+        EXPECT_EQ(item, 999 - i);
+    }
+    EXPECT_EQ(S.status, STACK_OK);
+
+    for (size_t i = 0; i < 10; ++i) {                                   // skipped checks and top keep the hash of the cadence
+        STACK_TYPE *item = NULL;
+        GENERIC(stack_push)(&S, i);
+        GENERIC(stack_top)(&S, &item);
+    }
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+    #ifdef STACK_USE_STRUCT_HASH
+        S.checkPolicy.period = SIZE_MAX;                                // stray write turning checks off
+        EXPECT_TRUE(GENERIC(stack_healthCheck)(&S) & STACK_BAD_STRUCT_HASH);
+        for (size_t i = 0; i < 10; ++i)
+            GENERIC(stack_checkDue)(&S);
+        EXPECT_NE(S.structHash, GENERIC(stack_calculateStructHash)(&S));    // stale hash stays stale
+        S.checkPolicy.period = 4;
+        S.status = STACK_OK;
+        S.structHash = GENERIC(stack_calculateStructHash)(&S);
+    #endif
+
+    GENERIC(stack_dtor)(&S);
+}
+
+TEST(PushPopN, Random)
+{
+    GENERIC(stack) S = {};
+    std::vector<STACK_TYPE> STD = {};
+
+    GENERIC(stack_ctor)(&S);
+
+    for (size_t i = 0; i < 100; ++i) {
+        size_t count = rnd() % 300;
+        if (rnd() % 10 < 6) {
+            std::vector<STACK_TYPE> items(count);
+            for (auto &item : items)
+                item = rnd();
+            GENERIC(stack_pushN)(&S, items.data(), count);
+            STD.insert(STD.end(), items.begin(), items.end());
+        }
+        else {
+            std::vector<STACK_TYPE> items(count);
+            size_t popped = 0;
+            GENERIC(stack_popN)(&S, items.data(), count, &popped);
+            EXPECT_EQ(popped, std::min(count, STD.size()));
+            EXPECT_TRUE(std::equal(items.begin(), items.begin() + popped, STD.end() - popped));
+            STD.resize(STD.size() - popped);
+            S.status = STACK_OK;                    // popping more than there is only warns
+        }
+        EXPECT_EQ(S.len, STD.size());
+        EXPECT_TRUE(std::equal(STD.begin(), STD.end(), S.data));
+    }
+
+    GENERIC(stack_dropN)(&S, S.len / 2);
+    EXPECT_EQ(S.len, STD.size() - STD.size() / 2);
+    #ifdef STACK_USE_DATA_HASH
+        EXPECT_EQ(S.dataHash, GENERIC(stack_calculateDataHash)(&S));
+    #endif
+    EXPECT_EQ(S.status, STACK_OK);
+
+    GENERIC(stack_dtor)(&S);
+}
+
+TEST(PushPopN, OwnItems)
+{
+    GENERIC(stack) S = {};
+    GENERIC(stack_ctor)(&S);
+
+    for (size_t round = 0; round < 8; ++round) {
+        while (S.len < S.capacity)
+            GENERIC(stack_push)(&S, S.len);
+        size_t len = S.len;
+        EXPECT_EQ(GENERIC(stack_pushN)(&S, S.data, len), STACK_OK);           // source is in the data freed by growth
+        EXPECT_EQ(S.len, 2 * len);
+        for (size_t i = 0; i < len; ++i)
+            EXPECT_EQ(S.data[len + i], S.data[i]);
+    }
+    #ifdef STACK_USE_DATA_HASH
+        EXPECT_EQ(S.dataHash, GENERIC(stack_calculateDataHash)(&S));
+    #endif
+
+    GENERIC(stack_dtor)(&S);
+}
+
+TEST(Capacity, ReserveShrink)
+{
+    GENERIC(stack) S = {};
+
+    GENERIC(stack_ctorCapacity)(&S, 1000);
+    EXPECT_GE(S.capacity, 1000);
+    STACK_TYPE *data = S.data;
+    for (size_t i = 0; i < 1000; ++i)
+        GENERIC(stack_push)(&S, i);
+    EXPECT_EQ(S.data, data);                        // no reallocations
+
+    GENERIC(stack_reserve)(&S, 5000);
+    EXPECT_GE(S.capacity, 5000);
+    data = S.data;
+    for (size_t i = 1000; i < 5000; ++i)
+        GENERIC(stack_push)(&S, i);
+    EXPECT_EQ(S.data, data);
+
+    GENERIC(stack_reserve)(&S, 10);
+    EXPECT_GE(S.capacity, 5000);
+
+    GENERIC(stack_dropN)(&S, 4990);
+    GENERIC(stack_shrinkToFit)(&S);
+    #ifdef STACK_USE_GUARD_PAGES
+        EXPECT_EQ(S.capacity * sizeof(STACK_TYPE), stack_pageSize());       // data fills whole pages
+    #else
+        EXPECT_LT(S.capacity, 20);
+    #endif
+    EXPECT_EQ(S.len, 10);
+    for (size_t i = 0; i < S.len; ++i)
+        EXPECT_EQ(S.data[i], i);
+    #ifdef STACK_USE_CANARY
+        EXPECT_EQ(S.capacity * sizeof(STACK_TYPE) % sizeof(STACK_CANARY_TYPE), 0);
+    #endif
+    #ifdef STACK_USE_DATA_HASH
+        EXPECT_EQ(S.dataHash, GENERIC(stack_calculateDataHash)(&S));
+    #endif
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+
+    GENERIC(stack_dtor)(&S);
+}
+
+TEST(Capacity, Overflow)
+{
+    GENERIC(stack) S = {};
+
+    EXPECT_EQ(GENERIC(stack_ctorCapacity)(&S, SIZE_MAX / sizeof(STACK_TYPE) + 2), STACK_BAD_MEM_ALLOC);
+    #ifdef STACK_USE_PTR_POISON                     // only poisoned ptrs tell a failed stack from a destructed one
+        EXPECT_NE(GENERIC(stack_push)(&S, 1), STACK_OK);
+    #endif
+
+    GENERIC(stack_ctor)(&S);
+    GENERIC(stack_push)(&S, 1);
+    EXPECT_NE(GENERIC(stack_reserve)(&S, SIZE_MAX / sizeof(STACK_TYPE) + 2) & STACK_BAD_MEM_ALLOC, 0);
+    GENERIC(stack_dtor)(&S);
+}
+
+TEST(Capacity, GrowthPolicy)
+{
+    for (size_t capacity = 1; capacity < 100000; capacity = GENERIC(stack_expandFactorCalc)(capacity)) {
+        size_t expanded = GENERIC(stack_expandFactorCalc)(capacity);
+        EXPECT_GT(expanded, capacity);
+        EXPECT_EQ(expanded % GENERIC(stack_capacityStep)(), 0);
+
+        size_t shrinked = GENERIC(stack_shrinkageFactorCalc)(expanded);
+        EXPECT_LE(shrinked, expanded);
+        EXPECT_GE(shrinked, 1);
+    }
+
+    GENERIC(stack) S = {};
+    GENERIC(stack_ctor)(&S);
+    for (size_t i = 0; i < 3000; ++i) {
+        size_t capacity = S.capacity;
+        GENERIC(stack_push)(&S, i);
+        if (S.capacity != capacity) {
+            EXPECT_GT(S.capacity, capacity);
+        }
+    }
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+    GENERIC(stack_dtor)(&S);
+}
+
+#ifdef STACK_USE_MMAP
+TEST(Storage, Mmap)
+{
+    GENERIC(stack) S = {};
+
+    GENERIC(stack_ctor)(&S);
+    EXPECT_EQ(S.mappedSize, 0);
+    for (size_t i = 0; i < 100; ++i)
+        GENERIC(stack_push)(&S, i);
+
+    GENERIC(stack_reserve)(&S, STACK_MMAP_THRESHOLD / sizeof(STACK_TYPE));           // malloc -> mmap
+    EXPECT_NE(S.mappedSize, 0);
+    EXPECT_EQ(S.mappedSize % stack_pageSize(), 0);
+    EXPECT_GE(S.capacity, STACK_MMAP_THRESHOLD / sizeof(STACK_TYPE));
+
+    GENERIC(stack_reserve)(&S, 2 * S.capacity);                                      // mremap
+    EXPECT_GE(S.mappedSize, 2 * STACK_MMAP_THRESHOLD);
+    for (size_t i = 0; i < S.len; ++i)
+        EXPECT_EQ(S.data[i], i);
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+
+    GENERIC(stack_shrinkToFit)(&S);                                                  // mmap -> malloc
+    EXPECT_EQ(S.mappedSize, 0);
+    EXPECT_EQ(S.len, 100);
+    for (size_t i = 0; i < S.len; ++i)
+        EXPECT_EQ(S.data[i], i);
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+
+    GENERIC(stack_dtor)(&S);
+
+    GENERIC(stack_ctorCapacity)(&S, STACK_MMAP_THRESHOLD / sizeof(STACK_TYPE));
+    EXPECT_NE(S.mappedSize, 0);
+    GENERIC(stack_push)(&S, 179);
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+    GENERIC(stack_dtor)(&S);
+}
+#endif
+
+#ifdef STACK_USE_GUARD_PAGES
+TEST(GuardPages, Overflow)
+{
+    GENERIC(stack) S = {};
+
+    GENERIC(stack_ctor)(&S);
+    S.logStream = stderr;
+    #ifdef STACK_USE_STRUCT_HASH
+        S.structHash = GENERIC(stack_calculateStructHash)(&S);
+    #endif
+    for (size_t i = 0; i < 3000; ++i)
+        GENERIC(stack_push)(&S, i);
+    EXPECT_EQ(S.capacity, S.mappedSize / sizeof(STACK_TYPE));               // data fills whole pages
+    for (size_t i = 0; i < S.len; ++i)
+        EXPECT_EQ(S.data[i], i);
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+
+    volatile STACK_TYPE *data = S.data;
+    EXPECT_DEATH(data[S.capacity] = 1, "Right data canary corrupted");
+    EXPECT_DEATH(data[-1] = 1, "Left data canary corrupted");
+
+    GENERIC(stack_dtor)(&S);
+}
+#endif
+
+#ifdef STACK_USE_PTR_CACHE
+TEST(PtrValid, Cache)
+{
+    size_t page = stack_pageSize();
+    char *mem = (char*)mmap(NULL, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_NE(mem, MAP_FAILED);
+
+    EXPECT_TRUE(ptrValid(mem));
+    EXPECT_TRUE(ptrValid(mem + page));
+    EXPECT_TRUE(stack_ptrCacheFind((size_t)mem + page + 1));           // pages are merged into one interval
+
+    munmap(mem, 2 * page);
+    stack_ptrCacheInvalidate();
+    EXPECT_FALSE(stack_ptrCacheFind((size_t)mem));
+    EXPECT_FALSE(ptrValid(mem));
+}
+#endif
+
+TEST(Shrink, Trim)
+{
+    GENERIC(stack) S = {};
+
+    GENERIC(stack_ctor)(&S);
+    for (size_t i = 0; i < 5000; ++i)
+        GENERIC(stack_push)(&S, i);
+    GENERIC(stack_dropN)(&S, 4900);
+
+    GENERIC(stack_trim)(&S);
+    EXPECT_EQ(S.len, 100);
+    EXPECT_LT(S.residentCapacity, 5000);
+    if (S.mappedSize == 0) {
+        EXPECT_EQ(S.capacity, S.residentCapacity);
+    }
+    #if defined(STACK_SHRINK_ADVICE) && !defined(STACK_USE_POISON)
+        size_t page  = stack_pageSize();
+        size_t begin = ((size_t)(S.data + S.residentCapacity) + page - 1) / page * page;
+        if (S.mappedSize != 0 && begin + page <= (size_t)(S.data + S.capacity)) {
+            unsigned char resident = 1;
+            mincore((void*)begin, page, &resident);
+            EXPECT_EQ(resident & 1, 0);                                 // pages are released
+        }
+    #endif
+    for (size_t i = 0; i < S.len; ++i)
+        EXPECT_EQ(S.data[i], i);
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+
+    for (size_t i = 100; i < 5000; ++i)                                // released pages are usable again
+        GENERIC(stack_push)(&S, i);
+    for (size_t i = 0; i < S.len; ++i)
+        EXPECT_EQ(S.data[i], i);
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+
+    GENERIC(stack_dtor)(&S);
+}
+
+#ifdef AUTO_SHRINK
+TEST(Shrink, Hysteresis)
+{
+    GENERIC(stack) S = {};
+
+    GENERIC(stack_ctor)(&S);
+    for (size_t i = 0; i < 4096; ++i)
+        GENERIC(stack_push)(&S, i);
+
+    size_t releases = 0;
+    size_t resident = S.residentCapacity;
+    for (size_t i = 0; i < 4096; ++i) {
+        GENERIC(stack_pop)(&S, NULL);
+        if (S.residentCapacity != resident) {
+            EXPECT_LT(S.residentCapacity, resident);
+            EXPECT_LE(S.len * 2, S.residentCapacity);                  // the next release is at least len ops away
+            resident = S.residentCapacity;
+            releases++;
+        }
+    }
+    EXPECT_GT(releases, 0);
+    EXPECT_LT(releases, 20);
+
+    size_t base = S.len;
+    for (size_t i = 0; i < 1000; ++i) {                                // push/pop at the boundary doesn't thrash
+        GENERIC(stack_push)(&S, i);
+        GENERIC(stack_pop)(&S, NULL);
+    }
+    EXPECT_EQ(S.len, base);
+    EXPECT_EQ(S.residentCapacity, resident);
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+
+    GENERIC(stack_dtor)(&S);
+}
+#endif
+
+#ifndef STACK_USE_GUARD_PAGES                  // guard pages keep all data in mappings
+struct CountingAllocator
+{
+    size_t allocs;
+    size_t reallocs;
+    size_t frees;
+};
+
+static void *countingAlloc(void *ctx, size_t size)
+{
+    ((CountingAllocator*)ctx)->allocs++;
+    return malloc(size);
+}
+
+static void *countingRealloc(void *ctx, void *ptr, size_t size)
+{
+    ((CountingAllocator*)ctx)->reallocs++;
+    return realloc(ptr, size);
+}
+
+static void countingFree(void *ctx, void *ptr)
+{
+    ((CountingAllocator*)ctx)->frees++;
+    free(ptr);
+}
+
+TEST(Allocator, Custom)
+{
+    CountingAllocator counts = {};
+    stack_allocator allocator = {countingAlloc, countingRealloc, countingFree, NULL, &counts, false};
+    GENERIC(stack) S = {};
+
+    GENERIC(stack_ctorAllocator)(&S, STACK_INLINE_CAPACITY + 4, &allocator);
+    for (size_t i = 0; i < 100; ++i)
+        GENERIC(stack_push)(&S, i);
+    for (size_t i = 0; i < S.len; ++i)
+        EXPECT_EQ(S.data[i], i);
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+
+    GENERIC(stack_clear)(&S);                                           // allocator is kept
+    EXPECT_EQ(S.allocator, &allocator);
+    GENERIC(stack_dtor)(&S);
+
+    EXPECT_GE(counts.allocs, 1);
+    EXPECT_GT(counts.reallocs, 0);
+    EXPECT_EQ(counts.frees, counts.allocs);
+}
+
+TEST(Allocator, Arena)
+{
+    EXPECT_EQ(stack_arenaClass(1), 0);
+    EXPECT_EQ(stack_arenaClass(STACK_ARENA_MIN_BLOCK - STACK_ARENA_HEADER_SIZE), 0);
+    EXPECT_EQ(stack_arenaClass(STACK_ARENA_MIN_BLOCK - STACK_ARENA_HEADER_SIZE + 1), 1);
+    EXPECT_EQ(stack_arenaClass(STACK_ARENA_MIN_BLOCK << (STACK_ARENA_CLASS_COUNT - 1)), STACK_ARENA_CLASS_COUNT);
+
+    GENERIC(stack) S = {};
+    GENERIC(stack_ctorAllocator)(&S, STACK_INLINE_CAPACITY + 8, &STACK_ALLOCATOR_ARENA);
+    void *first = S.dataWrapper;
+    GENERIC(stack_dtor)(&S);
+
+    GENERIC(stack_ctorAllocator)(&S, STACK_INLINE_CAPACITY + 8, &STACK_ALLOCATOR_ARENA);      // freed block of the same class is reused
+    EXPECT_EQ((void*)S.dataWrapper, first);
+    EXPECT_EQ((size_t)S.dataWrapper % 16, 0);
+
+    std::stack<long> reference;
+    for (size_t i = 0; i < 100000; ++i) {                              // grows through all classes and out of the arena
+        if (rnd() % 4) {
+            GENERIC(stack_push)(&S, i);
+            reference.push(i);
+        }
+        else if (!reference.empty()) {
+            long item = 0;
+            GENERIC(stack_pop)(&S, &item);
+            EXPECT_EQ(item, reference.top());
+            reference.pop();
+        }
+    }
+    EXPECT_EQ(S.len, reference.size());
+    #ifdef STACK_USE_USABLE_SIZE
+        EXPECT_GE(stack_storageUsableSize(S.allocator, S.dataWrapper, S.mappedSize), GENERIC(stack_allocated_size)(S.capacity));
+    #endif
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+
+    GENERIC(stack_shrinkToFit)(&S);
+    EXPECT_EQ(S.len, reference.size());
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+
+    GENERIC(stack_dtor)(&S);
+}
+#endif
+
+#ifndef STACK_USE_GUARD_PAGES
+TEST(Inline, Deferred)
+{
+    CountingAllocator counts = {};
+    stack_allocator allocator = {countingAlloc, countingRealloc, countingFree, NULL, &counts, false};
+    GENERIC(stack) S = {};
+
+    GENERIC(stack_ctorDeferred)(&S, 100, &allocator);
+    EXPECT_TRUE(GENERIC(stack_isInline)(&S));
+    EXPECT_EQ(S.capacity, GENERIC(stack_inlineCapacity)());
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+
+    for (size_t i = 0; i < GENERIC(stack_inlineCapacity)(); ++i)
+        GENERIC(stack_push)(&S, i);
+    EXPECT_EQ(counts.allocs, 0);
+
+    GENERIC(stack_push)(&S, S.len);                                     // the first overflow allocates all the deferred capacity
+    EXPECT_FALSE(GENERIC(stack_isInline)(&S));
+    EXPECT_EQ(counts.allocs, 1);
+    EXPECT_GE(S.capacity, 100);
+
+    for (size_t i = S.len; i < 100; ++i)
+        GENERIC(stack_push)(&S, i);
+    EXPECT_EQ(counts.allocs + counts.reallocs, 1);
+    for (size_t i = 0; i < S.len; ++i)
+        EXPECT_EQ(S.data[i], i);
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+
+    GENERIC(stack_dtor)(&S);
+    EXPECT_EQ(counts.frees, 1);
+}
+
+#if STACK_INLINE_CAPACITY >= 2
+TEST(Inline, SmallBuffer)
+{
+    CountingAllocator counts = {};
+    stack_allocator allocator = {countingAlloc, countingRealloc, countingFree, NULL, &counts, false};
+    GENERIC(stack) S = {};
+
+    GENERIC(stack_ctorAllocator)(&S, 2, &allocator);                 // allocation-free
+    EXPECT_TRUE(GENERIC(stack_isInline)(&S));
+    EXPECT_GE((char*)S.data, (char*)&S);
+    EXPECT_LE((char*)(S.data + S.capacity), (char*)(&S + 1));
+
+    size_t inlineCapacity = GENERIC(stack_inlineCapacity)();
+    for (size_t i = 0; i < 4 * inlineCapacity; ++i)
+        GENERIC(stack_push)(&S, i);
+    EXPECT_FALSE(GENERIC(stack_isInline)(&S));
+    EXPECT_EQ(counts.allocs, 1);
+
+    GENERIC(stack_dropN)(&S, 3 * inlineCapacity + 1);
+    GENERIC(stack_shrinkToFit)(&S);                                     // data moves back into the struct
+    EXPECT_TRUE(GENERIC(stack_isInline)(&S));
+    EXPECT_EQ(counts.frees, 1);
+    for (size_t i = 0; i < S.len; ++i)
+        EXPECT_EQ(S.data[i], i);
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+
+    #ifdef STACK_USE_POISON
+        S.data[S.len] = 0;                                              // free inline capacity is checked
+        EXPECT_TRUE(GENERIC(stack_healthCheck)(&S) & STACK_DATA_INTEGRITY_VIOLATED);
+        S.status = STACK_OK;
+        memset((char*)&S.data[S.len], STACK_ELEM_POISON, sizeof(STACK_TYPE));
+    #endif
+    #ifdef STACK_USE_DATA_CANARY
+        STACK_CANARY_TYPE canary = *(STACK_CANARY_TYPE*)&S.data[S.capacity];
+        memset((char*)&S.data[S.capacity], 0, sizeof(STACK_CANARY_TYPE));     // inline overflow
+        EXPECT_TRUE(GENERIC(stack_healthCheck)(&S) & STACK_RIGHT_DATA_CANARY_CORRUPT);
+        S.status = STACK_OK;
+        *(STACK_CANARY_TYPE*)&S.data[S.capacity] = canary;
+    #endif
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+
+    GENERIC(stack_dtor)(&S);
+    EXPECT_EQ(counts.frees, 1);
+}
+#endif
+#endif
+
+#include "gcstack.h"
+
+#include <thread>
+#include <vector>
+
+TEST(Concurrent, Lifo)
+{
+    GENERIC(cstack) S = {};
+    GENERIC(cstack_ctor)(&S);
+
+    bool popped = true;
+    long item = 0;
+    GENERIC(cstack_pop)(&S, &item, &popped);
+    EXPECT_FALSE(popped);
+
+    size_t count = 5 * STACK_NODE_SEGMENT_BASE;                         // spans several pool segments
+    for (size_t i = 0; i < count; ++i)
+        EXPECT_EQ(GENERIC(cstack_push)(&S, i), STACK_OK);
+    EXPECT_EQ(S.len, count);
+
+    for (size_t i = count; i > count / 2; --i) {
+        EXPECT_EQ(GENERIC(cstack_pop)(&S, &item, &popped), STACK_OK);
+        EXPECT_TRUE(popped);
+        EXPECT_EQ(item, i - 1);
+    }
+
+    uint64_t fresh = S.fresh;
+    for (size_t i = count / 2; i < count; ++i)                          // popped nodes are reused
+        GENERIC(cstack_push)(&S, i);
+    EXPECT_EQ(S.fresh, fresh);
+    EXPECT_EQ(GENERIC(cstack_healthCheck)(&S), STACK_OK);
+
+    #ifdef STACK_USE_CANARY
+        GENERIC(cstack_nodeAt)(&S, (uint32_t)S.head)->rightCanary = 0;
+        EXPECT_TRUE(GENERIC(cstack_healthCheck)(&S) & STACK_RIGHT_DATA_CANARY_CORRUPT);
+        GENERIC(cstack_nodeAt)(&S, (uint32_t)S.head)->rightCanary = STACK_RIGHT_CANARY_POISON;
+        S.status = STACK_OK;
+    #endif
+    #ifdef STACK_USE_DATA_HASH
+        GENERIC(cstack_nodeAt)(&S, (uint32_t)S.head)->item = -1;       // hash of a node is checked on pop
+        EXPECT_TRUE(GENERIC(cstack_pop)(&S, &item, &popped) & STACK_BAD_DATA_HASH);
+        S.status = STACK_OK;
+    #endif
+
+    GENERIC(cstack_dtor)(&S);
+}
+
+TEST(Concurrent, Threads)
+{
+    GENERIC(cstack) S = {};
+    GENERIC(cstack_ctor)(&S);
+
+    const size_t threadCount = 8;
+    const size_t perThread   = 20000;
+    std::vector<std::vector<long>> poppedBy(threadCount);
+    std::vector<std::thread> threads;
+
+    for (size_t t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&S, &poppedBy, t, perThread]() {
+            for (size_t i = 0; i < perThread; ++i) {
+                GENERIC(cstack_push)(&S, t * perThread + i);
+                if (i % 2) {
+                    long item = 0;
+                    bool popped = false;
+                    GENERIC(cstack_pop)(&S, &item, &popped);
+                    if (popped)
+                        poppedBy[t].push_back(item);
+                }
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    std::vector<size_t> seen(threadCount * perThread, 0);
+    for (auto &items : poppedBy)
+        for (long item : items)
+            ++seen[item];
+
+    long item = 0;
+    bool popped = true;
+    while (GENERIC(cstack_pop)(&S, &item, &popped), popped)
+        ++seen[item];
+
+    for (size_t i = 0; i < seen.size(); ++i)
+        EXPECT_EQ(seen[i], 1);
+    EXPECT_EQ(S.len, 0);
+    EXPECT_EQ(GENERIC(cstack_healthCheck)(&S), STACK_OK);
+
+    GENERIC(cstack_dtor)(&S);
+}
+
+TEST(WorkStealing, Owner)
+{
+    GENERIC(wsdeque) D = {};
+    EXPECT_EQ(GENERIC(wsdeque_ctor)(&D, 3), STACK_OK);
+    EXPECT_EQ(D.buffer->capacity, 4);
+
+    for (long i = 0; i < 100; ++i)                                      // grows through several buffers
+        EXPECT_EQ(GENERIC(wsdeque_push)(&D, i), STACK_OK);
+    EXPECT_EQ(GENERIC(wsdeque_size)(&D), 100);
+    EXPECT_EQ(D.buffer->capacity, 128);
+
+    long item = -1;
+    bool done = false;
+    GENERIC(wsdeque_steal)(&D, &item, &done);                           // thieves take the oldest elems
+    EXPECT_TRUE(done);
+    EXPECT_EQ(item, 0);
+    GENERIC(wsdeque_pop)(&D, &item, &done);                             // the owner takes the newest ones
+    EXPECT_TRUE(done);
+    EXPECT_EQ(item, 99);
+
+    for (long i = 98; i > 0; --i) {
+        GENERIC(wsdeque_pop)(&D, &item, &done);
+        EXPECT_EQ(item, i);
+    }
+    GENERIC(wsdeque_pop)(&D, &item, &done);
+    EXPECT_FALSE(done);
+    GENERIC(wsdeque_steal)(&D, &item, &done);
+    EXPECT_FALSE(done);
+    EXPECT_EQ(GENERIC(wsdeque_size)(&D), 0);
+
+    for (long i = 0; i < 1000; ++i) {                                   // wraps around the circular buffer
+        GENERIC(wsdeque_push)(&D, i);
+        GENERIC(wsdeque_steal)(&D, &item, &done);
+        EXPECT_EQ(item, i);
+    }
+    EXPECT_EQ(D.buffer->capacity, 128);
+    EXPECT_EQ(GENERIC(wsdeque_healthCheck)(&D), STACK_OK);
+
+    #ifdef STACK_USE_DATA_CANARY
+        D.buffer->data[D.buffer->capacity] = 0;                         // overflow of the buffer
+        EXPECT_TRUE(GENERIC(wsdeque_healthCheck)(&D) & STACK_RIGHT_DATA_CANARY_CORRUPT);
+        *(STACK_CANARY_TYPE*)&D.buffer->data[D.buffer->capacity] = STACK_RIGHT_CANARY_POISON;
+        D.status = STACK_OK;
+    #endif
+
+    GENERIC(wsdeque_dtor)(&D);
+}
+
+TEST(WorkStealing, Thieves)
+{
+    GENERIC(wsdeque) D = {};
+    GENERIC(wsdeque_ctor)(&D, 16);
+
+    const size_t thiefCount = 4;
+    const long   count      = 100000;
+    std::vector<std::vector<long>> takenBy(thiefCount + 1);
+    std::vector<std::thread> thieves;
+    bool finished = false;
+
+    for (size_t t = 0; t < thiefCount; ++t) {
+        thieves.emplace_back([&D, &takenBy, &finished, t]() {
+            long item = 0;
+            bool stolen = false;
+            while (!__atomic_load_n(&finished, __ATOMIC_ACQUIRE) || GENERIC(wsdeque_size)(&D)) {
+                GENERIC(wsdeque_steal)(&D, &item, &stolen);
+                if (stolen)
+                    takenBy[t].push_back(item);
+            }
+        });
+    }
+
+    for (long i = 0; i < count; ++i) {
+        GENERIC(wsdeque_push)(&D, i);
+        if (i % 3 == 0) {
+            long item = 0;
+            bool popped = false;
+            GENERIC(wsdeque_pop)(&D, &item, &popped);
+            if (popped)
+                takenBy[thiefCount].push_back(item);
+        }
+    }
+    __atomic_store_n(&finished, true, __ATOMIC_RELEASE);
+    for (auto &thief : thieves)
+        thief.join();
+
+    std::vector<size_t> seen(count, 0);
+    for (auto &items : takenBy)
+        for (long item : items)
+            ++seen[item];
+    for (long i = 0; i < count; ++i)
+        EXPECT_EQ(seen[i], 1);
+    EXPECT_EQ(GENERIC(wsdeque_healthCheck)(&D), STACK_OK);
+
+    GENERIC(wsdeque_dtor)(&D);
+}
+
+#ifdef STACK_USE_ASYNC_CHECK
+static void countingCallback(void *stack, int status, void *ctx)
+{
+    (void)stack;
+    (void)status;
+    __atomic_add_fetch((int*)ctx, 1, __ATOMIC_RELAXED);
+}
+
+static void waitPasses(stack_verifier *verifier, uint64_t passes)
+{
+    while (__atomic_load_n(&verifier->passes, __ATOMIC_RELAXED) < passes)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+TEST(AsyncCheck, Detects)
+{
+    stack_verifier verifier;
+    ASSERT_TRUE(stack_verifierStart(&verifier, 100000));
+
+    GENERIC(stack) S = {};
+    GENERIC(stack_ctor)(&S);
+    int problems = 0;
+    EXPECT_EQ(GENERIC(stack_verifierWatch)(&S, &verifier, countingCallback, &problems), STACK_OK);
+
+    for (long i = 0; i < 1000; ++i)
+        GENERIC(stack_push)(&S, i);
+    uint64_t passes = __atomic_load_n(&verifier.passes, __ATOMIC_RELAXED);
+    waitPasses(&verifier, passes + 2);
+    EXPECT_EQ(__atomic_load_n(&problems, __ATOMIC_RELAXED), 0);
+
+    size_t len = S.len;
+    __atomic_store_n(&S.len, S.capacity + 1, __ATOMIC_RELAXED);        // corrupted outside of any operation
+    while (__atomic_load_n(&problems, __ATOMIC_RELAXED) == 0)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    EXPECT_TRUE(__atomic_load_n(&S.watch->status, __ATOMIC_RELAXED) & STACK_INTEGRITY_VIOLATED);
+
+    GENERIC(stack_verifierUnwatch)(&S, &verifier);
+    EXPECT_TRUE(S.status & STACK_INTEGRITY_VIOLATED);
+    S.len = len;
+    S.status = STACK_OK;
+    #ifdef STACK_USE_STRUCT_HASH
+        S.structHash = GENERIC(stack_calculateStructHash)(&S);
+    #endif
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+
+    GENERIC(stack_dtor)(&S);
+    stack_verifierStop(&verifier);
+}
+
+#if defined(STACK_USE_DATA_HASH) && STACK_INLINE_CAPACITY >= 2 && !defined(STACK_USE_GUARD_PAGES)
+TEST(AsyncCheck, InlineData)
+{
+    stack_verifier verifier;
+    ASSERT_TRUE(stack_verifierStart(&verifier, 100000));
+
+    GENERIC(stack) S = {};
+    GENERIC(stack_ctor)(&S);
+    ASSERT_TRUE(GENERIC(stack_isInline)(&S));
+    int problems = 0;
+    GENERIC(stack_verifierWatch)(&S, &verifier, countingCallback, &problems);
+
+    GENERIC(stack_push)(&S, 1);
+    GENERIC(stack_push)(&S, 2);
+    uint64_t passes = __atomic_load_n(&verifier.passes, __ATOMIC_RELAXED);
+    waitPasses(&verifier, passes + 2);
+    EXPECT_EQ(__atomic_load_n(&problems, __ATOMIC_RELAXED), 0);
+
+    __atomic_store_n(&S.data[0], 100, __ATOMIC_RELAXED);                // corrupted outside of any operation
+    while (__atomic_load_n(&problems, __ATOMIC_RELAXED) == 0)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    EXPECT_TRUE(__atomic_load_n(&S.watch->status, __ATOMIC_RELAXED) & STACK_BAD_DATA_HASH);
+
+    GENERIC(stack_verifierUnwatch)(&S, &verifier);
+    S.data[0] = 1;
+    S.status = STACK_OK;
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+
+    GENERIC(stack_dtor)(&S);
+    stack_verifierStop(&verifier);
+}
+#endif
+
+TEST(AsyncCheck, ConcurrentWriter)
+{
+    stack_verifier verifier;
+    ASSERT_TRUE(stack_verifierStart(&verifier, 0));
+
+    GENERIC(stack) S = {};
+    GENERIC(stack_ctor)(&S);
+    GENERIC(stack_setCheckPolicy)(&S, {STACK_CHECK_EVERY_N, 1000000, 0, 0});
+    int problems = 0;
+    GENERIC(stack_verifierWatch)(&S, &verifier, countingCallback, &problems);
+
+    for (size_t round = 0; round < 20; ++round) {                       // grows, shrinks and clears data under the verifier
+        for (long i = 0; i < 5000; ++i)
+            GENERIC(stack_push)(&S, i);
+        GENERIC(stack_dropN)(&S, 4000);
+        GENERIC(stack_shrinkToFit)(&S);
+        if (round % 5 == 4)
+            GENERIC(stack_clear)(&S);
+        uint64_t passes = __atomic_load_n(&verifier.passes, __ATOMIC_RELAXED);
+        waitPasses(&verifier, passes + 1);                              // snapshots of idle stacks are always consistent
+    }
+    EXPECT_EQ(__atomic_load_n(&problems, __ATOMIC_RELAXED), 0);
+    EXPECT_EQ(S.watch->depth, 0);
+    EXPECT_EQ(S.watch->version % 2, 0);
+
+    GENERIC(stack_verifierUnwatch)(&S, &verifier);
+    EXPECT_EQ(S.watch, nullptr);
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+    GENERIC(stack_dtor)(&S);
+    stack_verifierStop(&verifier);
+}
+
+TEST(AsyncCheck, ConcurrentReader)
+{
+    stack_verifier verifier;
+    ASSERT_TRUE(stack_verifierStart(&verifier, 0));
+
+    GENERIC(stack) S = {};
+    GENERIC(stack_ctor)(&S);
+    for (long i = 0; i < 100; ++i)
+        GENERIC(stack_push)(&S, i);
+    GENERIC(stack_setCheckPolicy)(&S, {STACK_CHECK_EVERY_N, 3, 0, 0});    // every top moves the cadence and rehashes the struct
+    int problems = 0;
+    GENERIC(stack_verifierWatch)(&S, &verifier, countingCallback, &problems);
+
+    uint64_t passes = __atomic_load_n(&verifier.passes, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < 1000000 && __atomic_load_n(&verifier.passes, __ATOMIC_RELAXED) < passes + 1000; ++i) {
+        STACK_TYPE *item = NULL;
+        GENERIC(stack_top)(&S, &item);
+        GENERIC(stack_get)(&S, i % 100, &item);
+    }
+    EXPECT_EQ(__atomic_load_n(&problems, __ATOMIC_RELAXED), 0);
+    EXPECT_EQ(S.watch->depth, 0);
+    EXPECT_EQ(S.watch->version % 2, 0);
+
+    GENERIC(stack_verifierUnwatch)(&S, &verifier);
+    EXPECT_EQ(GENERIC(stack_healthCheck)(&S), STACK_OK);
+    GENERIC(stack_dtor)(&S);
+    stack_verifierStop(&verifier);
+}
+#endif
+
+#ifdef STACK_USE_EVENT_LOG
+static std::string decodeEvents(FILE *events)
+{
+    rewind(events);
+    FILE *text = tmpfile();
+    EXPECT_TRUE(stack_eventDecode(events, text));
+
+    std::string out(ftell(text), '\0');
+    rewind(text);
+    EXPECT_EQ(fread(out.data(), 1, out.size(), text), out.size());
+    fclose(text);
+    return out;
+}
+
+static size_t countOf(const std::string &text, const char *pattern)
+{
+    size_t count = 0;
+    for (size_t pos = text.find(pattern); pos != std::string::npos; pos = text.find(pattern, pos + 1))
+        ++count;
+    return count;
+}
+
+TEST(EventLog, Decode)
+{
+    stack_event_flusher flusher;
+    FILE *events = tmpfile();
+    ASSERT_TRUE(stack_eventFlusherStart(&flusher, events, 0));
+    stack_eventFlusherStop(&flusher);                                   // drops events logged by previous tests
+    fclose(events);
+
+    events = tmpfile();
+    ASSERT_TRUE(stack_eventFlusherStart(&flusher, events, 1000000));
+
+    GENERIC(stack) S = {};
+    GENERIC(stack_ctor)(&S);
+    long *elem = NULL;
+    for (size_t i = 0; i < 3; ++i)
+        GENERIC(stack_get)(&S, i, &elem);
+
+    std::thread logger([&S] {                                           // logs into a ring of its own
+        long *elem = NULL;
+        GENERIC(stack_get)(&S, 10, &elem);
+    });
+    logger.join();
+
+    stack_eventFlusherStop(&flusher);
+    EXPECT_EQ(flusher.written, 4);
+
+    std::string text = decodeEvents(events);
+    EXPECT_EQ(countOf(text, "ERROR: bad position provided to stack_get!"), 4);
+    EXPECT_EQ(countOf(text, "called from func stack_get_long"), 4);
+    EXPECT_EQ(countOf(text, "| Len              = 0"), 4);
+    EXPECT_EQ(countOf(text, "| Current status = 0"), 4);
+    fclose(events);
+
+    GENERIC(stack_dtor)(&S);
+}
+
+TEST(EventLog, FullRing)
+{
+    stack_event_flusher flusher;
+    FILE *events = tmpfile();
+    ASSERT_TRUE(stack_eventFlusherStart(&flusher, events, 0));
+    stack_eventFlush(&flusher);
+    size_t flushed = flusher.written;
+
+    GENERIC(stack) S = {};
+    GENERIC(stack_ctor)(&S);
+    for (size_t i = 0; i < STACK_EVENT_RING_LEN + 5; ++i)               // nothing drains the ring meanwhile
+        stack_eventLog(&S, STACK_OK, i, S.capacity, "burst", __func__, __FILE__, __LINE__);
+
+    stack_eventFlusherStop(&flusher);
+    EXPECT_EQ(flusher.written - flushed, STACK_EVENT_RING_LEN);
+
+    std::string text = decodeEvents(events);
+    EXPECT_EQ(countOf(text, "| burst\n"), STACK_EVENT_RING_LEN);
+    EXPECT_EQ(countOf(text, "| 5 events dropped on a full ring"), 1);
+    fclose(events);
+
+    GENERIC(stack_dtor)(&S);
+}
+
+TEST(EventLog, NullStrings)
+{
+    stack_event_flusher flusher;
+    FILE *events = tmpfile();
+    ASSERT_TRUE(stack_eventFlusherStart(&flusher, events, 0));
+    stack_eventFlush(&flusher);
+
+    GENERIC(stack) S = {};
+    GENERIC(stack_ctor)(&S);
+    stack_eventLog(&S, STACK_OK, 0, S.capacity, NULL, "nullFunc", NULL, __LINE__);
+    stack_eventLog(&S, STACK_OK, 0, S.capacity, "after null", "nullFunc", __FILE__, __LINE__);
+
+    stack_eventFlusherStop(&flusher);
+
+    std::string text = decodeEvents(events);
+    EXPECT_EQ(countOf(text, "| (null)\n"), 1);
+    EXPECT_EQ(countOf(text, "| after null\n"), 1);
+    EXPECT_EQ(countOf(text, "called from func nullFunc"), 2);
+    fclose(events);
+
+    GENERIC(stack_dtor)(&S);
+}
+#endif
+
+#ifdef STACK_USE_STATS
+static uint64_t histogramCount(const uint64_t *histogram)
+{
+    uint64_t count = 0;
+    for (size_t i = 0; i < STACK_LATENCY_BUCKETS; ++i)
+        count += histogram[i];
+    return count;
+}
+
+TEST(Stats, Counters)
+{
+    GENERIC(stack) S = {};
+    GENERIC(stack_ctor)(&S);
+
+    for (long i = 0; i < 100; ++i)
+        GENERIC(stack_push)(&S, i);
+    long items[20] = {};
+    GENERIC(stack_pushN)(&S, items, 10);
+    GENERIC(stack_popN)(&S, items, 20, NULL);
+    for (size_t i = 0; i < 5; ++i)
+        GENERIC(stack_pop)(&S, &items[i]);
+    long *elem = NULL;
+    GENERIC(stack_get)(&S, 3, &elem);
+
+    stack_stats stats = {};
+    EXPECT_EQ(GENERIC(stack_statsSnapshot)(&S, &stats), STACK_OK);
+    EXPECT_EQ(stats.pushes, 110);
+    EXPECT_EQ(stats.pops, 25);
+    EXPECT_EQ(stats.peakLen, 110);
+    EXPECT_GE(stats.peakCapacity, 110);
+    EXPECT_GE(stats.reallocations, 1);
+    EXPECT_EQ(histogramCount(stats.latency[STACK_STATS_PUSH]), 100);
+    EXPECT_EQ(histogramCount(stats.latency[STACK_STATS_PUSH_N]), 1);
+    EXPECT_EQ(histogramCount(stats.latency[STACK_STATS_POP_N]), 1);
+    EXPECT_EQ(histogramCount(stats.latency[STACK_STATS_POP]), 5);
+    EXPECT_EQ(histogramCount(stats.latency[STACK_STATS_GET]), 1);
+    EXPECT_EQ(histogramCount(stats.latency[STACK_STATS_TOP]), 0);
+    EXPECT_LE(stack_statsPercentile(stats.latency[STACK_STATS_PUSH], 0.5), stack_statsPercentile(stats.latency[STACK_STATS_PUSH], 0.99));
+    #if !defined(NDEBUG) && defined(STACK_USE_STRUCT_HASH)
+        EXPECT_GT(stats.healthChecks, 200);
+        EXPECT_GT(stats.phaseNs[STACK_STATS_PHASE_STRUCT_HASH], 0);
+    #endif
+
+    FILE *out = tmpfile();
+    GENERIC(stack_dumpToStream)(&S, out);
+    std::string text(ftell(out), '\0');
+    rewind(out);
+    EXPECT_EQ(fread(text.data(), 1, text.size(), out), text.size());
+    fclose(out);
+    EXPECT_NE(text.find("| Pushes           = 110"), std::string::npos);
+    EXPECT_NE(text.find("| push   latency   = 100 ops"), std::string::npos);
+
+    GENERIC(stack_clear)(&S);                                           // counters belong to the stack, not to its data
+    GENERIC(stack_statsSnapshot)(&S, &stats);
+    EXPECT_EQ(stats.pushes, 110);
+
+    GENERIC(stack_statsReset)(&S);
+    GENERIC(stack_statsSnapshot)(&S, &stats);
+    EXPECT_EQ(stats.pushes, 0);
+    EXPECT_EQ(stats.peakLen, 0);
+    EXPECT_EQ(stats.peakCapacity, S.capacity);
+    EXPECT_EQ(histogramCount(stats.latency[STACK_STATS_PUSH]), 0);
+
+    GENERIC(stack_dtor)(&S);
+}
+
+TEST(Stats, Buckets)
+{
+    EXPECT_EQ(stack_statsBucket(0), 0);
+    EXPECT_EQ(stack_statsBucket(1), 0);
+    EXPECT_EQ(stack_statsBucket(2), 1);
+    EXPECT_EQ(stack_statsBucket(1023), 9);
+    EXPECT_EQ(stack_statsBucket(1024), 10);
+    EXPECT_EQ(stack_statsBucket(UINT64_MAX), STACK_LATENCY_BUCKETS - 1);
+
+    uint64_t histogram[STACK_LATENCY_BUCKETS] = {};
+    EXPECT_EQ(stack_statsPercentile(histogram, 0.5), 0);
+    histogram[4] = 90;
+    histogram[10] = 10;
+    EXPECT_EQ(stack_statsPercentile(histogram, 0.5), 32);
+    EXPECT_EQ(stack_statsPercentile(histogram, 0.9), 32);
+    EXPECT_EQ(stack_statsPercentile(histogram, 0.99), 2048);
+    EXPECT_EQ(stack_statsPercentile(histogram, 1), 2048);
+}
+#endif
+
+TEST(PushPop, EmptyPop)
+{
+    GENERIC(stack) S = {};
+    GENERIC(stack_ctor)(&S);
+
+    long item = 7;
+    EXPECT_EQ(GENERIC(stack_pop)(&S, &item), STACK_EMPTY);
+    EXPECT_EQ(S.len, 0);
+    EXPECT_EQ(S.status, STACK_OK);
+    EXPECT_EQ(item, 7);
+
+    EXPECT_EQ(GENERIC(stack_push)(&S, 42), STACK_OK);
+    EXPECT_EQ(GENERIC(stack_pop)(&S, &item), STACK_OK);
+    EXPECT_EQ(item, 42);
+    EXPECT_EQ(GENERIC(stack_pop)(&S, NULL), STACK_EMPTY);
+
+    GENERIC(stack_dtor)(&S);
+}
+
+TEST(Template, MixedPolicies)
+{
+    gstack<long> fast;
+    gstack<long, stack_policy_full> hardened;
+    EXPECT_LT(sizeof(fast), sizeof(hardened));                          // fields of disabled checks take no space
+
+    for (long i = 0; i < 1000; ++i) {
+        EXPECT_EQ(fast.push(i), STACK_OK);
+        EXPECT_EQ(hardened.push(i), STACK_OK);
+    }
+    long *elem = NULL;
+    EXPECT_EQ(hardened.get(10, &elem), STACK_OK);
+    EXPECT_EQ(*elem, 10);
+    for (long i = 999; i >= 0; --i) {
+        long a = -1, b = -1;
+        EXPECT_EQ(fast.pop(&a), STACK_OK);
+        EXPECT_EQ(hardened.pop(&b), STACK_OK);
+        EXPECT_EQ(a, i);
+        EXPECT_EQ(b, i);
+    }
+    EXPECT_EQ(fast.pop(NULL), STACK_EMPTY);
+    EXPECT_EQ(hardened.pop(NULL), STACK_EMPTY);
+    EXPECT_EQ(hardened.healthCheck(), STACK_OK);
+}
+
+TEST(Template, Detects)
+{
+    gstack<char, stack_policy_full> data;
+    for (char i = 0; i < 10; ++i)
+        data.push(i);
+    EXPECT_EQ(data.dataHash, stack_crc32c(0, data.data, data.len));     // same hash as the C stack
+    data.data[3] = 100;
+    EXPECT_TRUE(data.healthCheck() & STACK_BAD_DATA_HASH);
+    EXPECT_EQ(data.push(1), data.status);                               // corrupt stack refuses operations
+
+    gstack<char, stack_policy_full> canary;
+    canary.push(1);
+    canary.data[canary.capacity] = 0;                                   // first byte of the right data canary
+    EXPECT_TRUE(canary.healthCheck() & STACK_RIGHT_DATA_CANARY_CORRUPT);
+
+    gstack<char, stack_policy_full> poison;
+    poison.data[1] = 0;
+    EXPECT_TRUE(poison.healthCheck() & STACK_DATA_INTEGRITY_VIOLATED);
+
+    gstack<char, stack_policy_cheap> structure;
+    structure.len = 1;
+    EXPECT_TRUE(structure.healthCheck() & STACK_BAD_STRUCT_HASH);
+
+    gstack<char> overrun;                                                // same status bits as the C stack
+    overrun.len = overrun.capacity + 1;
+    EXPECT_TRUE(overrun.healthCheck() & STACK_INTEGRITY_VIOLATED);
+    overrun.len = 0;
+
+    gstack<char> huge;
+    huge.len = huge.capacity = SIZE_MAX / 2;
+    EXPECT_TRUE(huge.push(1) & STACK_BAD_MEM_ALLOC);                    // doubled size would wrap around
+    huge.len = 0;
+
+    gstack<char> unchecked;                                              // same corruption goes unnoticed without checks
+    unchecked.push(1);
+    unchecked.data[0] = 100;
+    unchecked.data[unchecked.capacity - 1] = 0;
+    EXPECT_EQ(unchecked.healthCheck(), STACK_OK);
+}
+
+struct tracked {                                 // counts live objects and moves
+    static int alive;
+    static int moves;
+    static int copies;
+
+    int *value;
+
+    explicit tracked(int v) : value(new int(v)) { ++alive; }
+    tracked(const tracked &other) : value(new int(*other.value)) { ++alive; ++copies; }
+    tracked(tracked &&other) noexcept : value(other.value) { other.value = NULL; ++alive; ++moves; }
+    tracked &operator=(tracked &&other) noexcept { std::swap(value, other.value); ++moves; return *this; }
+    ~tracked() { delete value; --alive; }
+};
+int tracked::alive  = 0;
+int tracked::moves  = 0;
+int tracked::copies = 0;
+
+struct relocated : tracked {
+    using tracked::tracked;
+};
+template <> struct stack_trivially_relocatable<relocated> { static constexpr bool value = true; };
+
+TEST(Template, NonTrivialElems)
+{
+    tracked::alive = tracked::moves = tracked::copies = 0;
+    {
+        gstack<tracked, stack_policy_full> S;
+        for (int i = 0; i < 100; ++i)
+            EXPECT_EQ(S.emplace(i), STACK_OK);
+        EXPECT_EQ(tracked::alive, 100);
+        EXPECT_EQ(tracked::copies, 0);
+        EXPECT_GT(tracked::moves, 0);                                   // growth moved them
+
+        tracked item(-1);
+        EXPECT_EQ(S.pop(&item), STACK_OK);
+        EXPECT_EQ(*item.value, 99);
+        EXPECT_EQ(S.pop(NULL), STACK_OK);
+        EXPECT_EQ(tracked::alive, 99);
+
+        EXPECT_EQ(S.push(item), STACK_OK);
+        EXPECT_EQ(tracked::copies, 1);
+        EXPECT_EQ(S.healthCheck(), STACK_OK);
+    }
+    EXPECT_EQ(tracked::alive, 0);
+
+    tracked::moves = 0;
+    {
+        gstack<relocated> S;
+        for (int i = 0; i < 100; ++i)
+            S.emplace(i);
+        EXPECT_EQ(tracked::moves, 0);                                   // realloc'ed as bytes
+        S.clear();
+        EXPECT_EQ(tracked::alive, 0);
+        S.emplace(1);
+    }
+    EXPECT_EQ(tracked::alive, 0);
+
+    {
+        gstack<std::string, stack_policy_full> S;
+        for (int i = 0; i < 50; ++i)
+            S.push(std::string(i, 'a'));
+        std::string item;
+        S.pop(&item);
+        EXPECT_EQ(item, std::string(49, 'a'));
+        EXPECT_EQ(S.healthCheck(), STACK_OK);
+    }
+}
+
+TEST(Template, PushOwnElem)
+{
+    gstack<long> S;                                                     // realloc'ed on growth
+    for (long i = 0; i < 10; ++i) {
+        while (S.len < S.capacity)
+            S.push(i);
+        EXPECT_EQ(S.push(S.data[0]), STACK_OK);                         // source is in the data freed by growth
+        EXPECT_EQ(S.data[S.len - 1], S.data[0]);
+    }
+
+    tracked::alive = 0;
+    {
+        gstack<tracked, stack_policy_full> T;                           // moved to new data on growth
+        T.emplace(7);
+        for (int i = 0; i < 10; ++i) {
+            while (T.len < T.capacity)
+                T.emplace(i);
+            EXPECT_EQ(T.push(T.data[0]), STACK_OK);
+            EXPECT_EQ(*T.data[T.len - 1].value, 7);
+        }
+        EXPECT_EQ(T.healthCheck(), STACK_OK);
+    }
+    EXPECT_EQ(tracked::alive, 0);
+}
+
+TEST(View, Iterate)
+{
+    GENERIC(stack) S = {};
+    GENERIC(stack_ctor)(&S);
+    for (long i = 0; i < 1000; ++i)
+        GENERIC(stack_push)(&S, i);
+
+    GENERIC(stack_view) view = {};
+    EXPECT_EQ(GENERIC(stack_getView)(&S, &view), STACK_OK);
+    EXPECT_TRUE(GENERIC(stack_viewValid)(&view));
+    EXPECT_EQ(view.end - view.begin, 1000);
+
+    long expected = 0, sum = 0;
+    STACK_VIEW_FOREACH(view, elem) {
+        EXPECT_EQ(*elem, expected++);
+        sum += *elem;
+    }
+    EXPECT_EQ(sum, 999 * 1000 / 2);
+    STACK_VIEW_FOREACH_REVERSE(view, elem)
+        EXPECT_EQ(*elem, --expected);
+    EXPECT_EQ(expected, 0);
+
+    GENERIC(stack) E = {};
+    GENERIC(stack_ctor)(&E);
+    EXPECT_EQ(GENERIC(stack_getView)(&E, &view), STACK_OK);
+    STACK_VIEW_FOREACH_REVERSE(view, elem)
+        ADD_FAILURE();
+    EXPECT_TRUE(GENERIC(stack_viewValid)(&view));
+
+    GENERIC(stack_dtor)(&E);
+    GENERIC(stack_dtor)(&S);
+}
+
+TEST(View, Invalidated)
+{
+    GENERIC(stack) S = {};
+    GENERIC(stack_ctor)(&S);
+    for (long i = 0; i < 4; ++i)
+        GENERIC(stack_push)(&S, i);
+
+    GENERIC(stack_view) view = {};
+    GENERIC(stack_getView)(&S, &view);
+    while (S.len < S.capacity)
+        GENERIC(stack_push)(&S, 0);
+    EXPECT_TRUE(GENERIC(stack_viewValid)(&view));                      // pushes without reallocation keep it
+    GENERIC(stack_push)(&S, 0);
+    EXPECT_FALSE(GENERIC(stack_viewValid)(&view));
+
+    GENERIC(stack_getView)(&S, &view);
+    GENERIC(stack_pop)(&S, NULL);
+    EXPECT_FALSE(GENERIC(stack_viewValid)(&view));
+
+    GENERIC(stack_getView)(&S, &view);
+    GENERIC(stack_clear)(&S);
+    for (long i = 0; i < 2; ++i)
+        GENERIC(stack_push)(&S, i);
+    GENERIC(stack_view) emptyView = view;
+    emptyView.end = emptyView.begin;
+    EXPECT_FALSE(GENERIC(stack_viewValid)(&emptyView));                // data was freed even if the view is empty
+
+    GENERIC(stack_dtor)(&S);
+}
+
+#ifdef STACK_USE_FILE
+#include <sys/wait.h>
+
+/// runs `body` in a child process that dies without syncing or closing its stacks
+template <class Body>
+static void crashAfter(Body body)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        body();
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    ASSERT_TRUE(WIFEXITED(status));
+}
+
+/// flips a byte in the newest or the older commit of a stack file, as if its write was torn
+static void tearCommit(const char *path, bool newest)
+{
+    int fd = open(path, O_RDWR);
+    stack_file_header header = {};
+    ASSERT_EQ(pread(fd, &header, sizeof(header), 0), (ssize_t)sizeof(header));
+
+    size_t slot = (header.commits[1].sequence > header.commits[0].sequence) == newest;
+    header.commits[slot].len ^= 0x40;
+    ASSERT_EQ(pwrite(fd, &header.commits[slot], sizeof(stack_file_commit), offsetof(stack_file_header, commits) + slot * sizeof(stack_file_commit)),
+              (ssize_t)sizeof(stack_file_commit));
+    close(fd);
+}
+
+TEST(File, Reopen)
+{
+    char path[] = "/tmp/gstack-test-XXXXXX";
+    close(mkstemp(path));
+
+    crashAfter([&]() {
+        GENERIC(stack) S = {};
+        EXPECT_EQ(GENERIC(stack_open)(&S, path, 4), STACK_OK);
+        for (long i = 0; i < 1000; ++i)
+            GENERIC(stack_push)(&S, i);
+        EXPECT_EQ(GENERIC(stack_sync)(&S), STACK_OK);
+        for (long i = 0; i < 100; ++i)                                  // lost with the crash
+            GENERIC(stack_push)(&S, -i);
+    });
+
+    GENERIC(stack) S = {};
+    EXPECT_EQ(GENERIC(stack_open)(&S, path, 0), STACK_OK);
+    EXPECT_EQ(S.len, 1000);
+    for (long i = 0; i < 1000; ++i)
+        EXPECT_EQ(S.data[i], i);
+    GENERIC(stack_push)(&S, 1000);
+    EXPECT_EQ(GENERIC(stack_close)(&S), STACK_OK);
+
+    EXPECT_EQ(GENERIC(stack_open)(&S, path, 0), STACK_OK);              // close syncs
+    EXPECT_EQ(S.len, 1001);
+    EXPECT_EQ(GENERIC(stack_close)(&S), STACK_OK);
+
+    unlink(path);
+}
+
+TEST(File, RollBack)
+{
+    char path[] = "/tmp/gstack-test-XXXXXX";
+    close(mkstemp(path));
+
+    crashAfter([&]() {
+        GENERIC(stack) S = {};
+        GENERIC(stack_open)(&S, path, 0);
+        for (long i = 0; i < 1000; ++i)
+            GENERIC(stack_push)(&S, i);
+        GENERIC(stack_sync)(&S);
+        for (long i = 0; i < 300; ++i)                                  // committed elems are overwritten
+            GENERIC(stack_pop)(&S, NULL);
+        for (long i = 0; i < 300; ++i)
+            GENERIC(stack_push)(&S, -i);
+    });
+
+    GENERIC(stack) S = {};
+    EXPECT_EQ(GENERIC(stack_open)(&S, path, 0), STACK_OK);
+    EXPECT_EQ(S.len, 700);                                              // the intact prefix of the commit
+    for (long i = 0; i < 700; ++i)
+        EXPECT_EQ(S.data[i], i);
+    EXPECT_EQ(GENERIC(stack_close)(&S), STACK_OK);
+
+    crashAfter([&]() {
+        GENERIC(stack) S = {};
+        GENERIC(stack_open)(&S, path, 0);
+        for (long i = 700; i < 800; ++i)
+            GENERIC(stack_push)(&S, i);
+        GENERIC(stack_sync)(&S);
+    });
+    tearCommit(path, true);
+
+    EXPECT_EQ(GENERIC(stack_open)(&S, path, 0), STACK_OK);              // torn commit falls back to the previous one
+    EXPECT_EQ(S.len, 700);
+    EXPECT_EQ(GENERIC(stack_close)(&S), STACK_OK);
+
+    tearCommit(path, true);
+    tearCommit(path, false);
+    EXPECT_EQ(GENERIC(stack_open)(&S, path, 0), STACK_DATA_INTEGRITY_VIOLATED);
+
+    unlink(path);
+}
+#endif